@@ -0,0 +1,290 @@
+#include "geofence.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "mqtt_mgt.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Fences loaded at start-up ("id:lat,lng,radius_m;...").
+ */
+#define GEOFENCE_DEFAULT_CIRCLES (CONFIG_GPS_TRACKER_GEOFENCE_CIRCLES)
+
+/**
+ * @brief Maximum size of a geofence event message in bytes.
+ */
+#define GEOFENCE_EVENT_MSG_SIZE (160)
+
+/********************************************************************************
+ *
+ *                              Type Declarations
+ *
+ ********************************************************************************/
+
+/**
+ * @brief A fence transition, recorded while g_lock is held.
+ */
+typedef struct {
+  uint16_t id;                      /**< Identifier of the fence. */
+  geofence_transition_t transition; /**< Enter or exit. */
+} geofence_event_t;
+
+/********************************************************************************
+ *
+ *                              Private Global Variables
+ *
+ ********************************************************************************/
+
+/**
+ * @brief Tag used for logging messages from the geofence module.
+ */
+static char *TAG = "geofence";
+
+/**
+ * @brief Fence index; statically allocated so memory use is fixed at build.
+ */
+static geofence_index_t g_index = {0};
+
+/**
+ * @brief Guards g_index between the payload task and fence updates.
+ */
+static SemaphoreHandle_t g_lock = NULL;
+
+/**
+ * @brief Transitions of the fix being processed. Every fence can change
+ *        state at once; statically allocated for the same reason as g_index.
+ */
+static geofence_event_t g_events[GEOFENCE_MAX_FENCES];
+
+/**
+ * @brief Number of entries in g_events.
+ */
+static size_t g_event_count = 0;
+
+/**
+ * @brief Serializes geofence_process_fix() callers over g_events. Held while
+ *        events are queued, which may block; g_lock is not, so fence updates
+ *        never wait for the MQTT queue.
+ */
+static SemaphoreHandle_t g_fix_lock = NULL;
+
+/********************************************************************************
+ *
+ *                              Private Function Prototypes
+ *
+ ********************************************************************************/
+
+/**
+ * @brief Map an index result code to an esp_err_t.
+ */
+static esp_err_t geofence_to_esp_err(geofence_index_err_t err);
+
+/**
+ * @brief Load the fences configured in Kconfig.
+ */
+static esp_err_t geofence_load_defaults(void);
+
+/**
+ * @brief Record a fence transition in g_events.
+ *
+ * @param fence      Fence whose state changed.
+ * @param transition Enter or exit.
+ * @param ctx        Unused.
+ */
+static void geofence_on_transition(const geofence_fence_t *fence,
+                                   geofence_transition_t transition,
+                                   void *ctx);
+
+/**
+ * @brief Queue an event message for a fence transition.
+ *
+ * @param event Transition to report.
+ * @param lat   Latitude of the fix.
+ * @param lng   Longitude of the fix.
+ * @param stamp Timestamp of the fix.
+ */
+static void geofence_send_event(const geofence_event_t *event, float lat,
+                                float lng, const timestamp_t *stamp);
+
+/********************************************************************************
+ *
+ *                              Public Function Definitions
+ *
+ ********************************************************************************/
+esp_err_t geofence_init(void) {
+  if (NULL != g_lock) {
+    ESP_LOGI(TAG, "geofence is already initialized!");
+    return ESP_OK;
+  }
+  g_lock = xSemaphoreCreateMutex();
+  ESP_RETURN_ON_FALSE(NULL != g_lock, ESP_ERR_NO_MEM, TAG,
+                      "Failed to create the geofence lock!");
+  g_fix_lock = xSemaphoreCreateMutex();
+  ESP_RETURN_ON_FALSE(NULL != g_fix_lock, ESP_ERR_NO_MEM, TAG,
+                      "Failed to create the geofence fix lock!");
+  geofence_index_clear(&g_index);
+  ESP_RETURN_ON_ERROR(geofence_load_defaults(), TAG,
+                      "Failed to load the default fences!");
+  ESP_RETURN_ON_ERROR(geofence_commit(), TAG, "Failed to build the index!");
+  ESP_LOGI(TAG, "Geofence initialized with %u fences (%u bytes).",
+           g_index.fence_count, (unsigned)sizeof(g_index));
+  return ESP_OK;
+}
+
+esp_err_t geofence_clear(void) {
+  ESP_RETURN_ON_FALSE(NULL != g_lock, ESP_ERR_INVALID_STATE, TAG,
+                      "geofence is not initialized!");
+  xSemaphoreTake(g_lock, portMAX_DELAY);
+  geofence_index_clear(&g_index);
+  xSemaphoreGive(g_lock);
+  return ESP_OK;
+}
+
+esp_err_t geofence_add_circle(uint16_t id, float lat, float lng,
+                              float radius_m) {
+  ESP_RETURN_ON_FALSE(NULL != g_lock, ESP_ERR_INVALID_STATE, TAG,
+                      "geofence is not initialized!");
+  xSemaphoreTake(g_lock, portMAX_DELAY);
+  geofence_index_err_t err =
+      geofence_index_add_circle(&g_index, id, lat, lng, radius_m);
+  xSemaphoreGive(g_lock);
+  return geofence_to_esp_err(err);
+}
+
+esp_err_t geofence_add_polygon(uint16_t id, const geofence_point_t *points,
+                               size_t count) {
+  ESP_RETURN_ON_FALSE(NULL != g_lock, ESP_ERR_INVALID_STATE, TAG,
+                      "geofence is not initialized!");
+  xSemaphoreTake(g_lock, portMAX_DELAY);
+  geofence_index_err_t err =
+      geofence_index_add_polygon(&g_index, id, points, count);
+  xSemaphoreGive(g_lock);
+  return geofence_to_esp_err(err);
+}
+
+esp_err_t geofence_commit(void) {
+  ESP_RETURN_ON_FALSE(NULL != g_lock, ESP_ERR_INVALID_STATE, TAG,
+                      "geofence is not initialized!");
+  xSemaphoreTake(g_lock, portMAX_DELAY);
+  geofence_index_err_t err = geofence_index_build(&g_index);
+  xSemaphoreGive(g_lock);
+  if (GEOFENCE_INDEX_OK != err) {
+    ESP_LOGE(TAG, "Too many fence/cell references for the grid!");
+  }
+  return geofence_to_esp_err(err);
+}
+
+esp_err_t geofence_process_fix(float lat, float lng, const timestamp_t *stamp,
+                               bool *suppress) {
+  ESP_RETURN_ON_FALSE(NULL != stamp && NULL != suppress, ESP_ERR_INVALID_ARG,
+                      TAG, "stamp or suppress is NULL!");
+  ESP_RETURN_ON_FALSE(NULL != g_lock, ESP_ERR_INVALID_STATE, TAG,
+                      "geofence is not initialized!");
+  size_t inside = 0;
+  xSemaphoreTake(g_fix_lock, portMAX_DELAY);
+  g_event_count = 0;
+  xSemaphoreTake(g_lock, portMAX_DELAY);
+  geofence_index_err_t err = geofence_index_evaluate(
+      &g_index, lat, lng, geofence_on_transition, NULL, &inside);
+  xSemaphoreGive(g_lock);
+  // Queueing may block until the MQTT task catches up; do it unlocked.
+  for (size_t i = 0; i < g_event_count; i++) {
+    geofence_send_event(&g_events[i], lat, lng, stamp);
+  }
+  xSemaphoreGive(g_fix_lock);
+  if (GEOFENCE_INDEX_ERR_NOT_BUILT == err) {
+    // Fences are being edited; report the raw fix meanwhile.
+    *suppress = false;
+    return ESP_OK;
+  }
+#if CONFIG_GPS_TRACKER_GEOFENCE_SUPPRESS_INSIDE
+  *suppress = inside > 0;
+#else
+  *suppress = false;
+#endif
+  return geofence_to_esp_err(err);
+}
+
+/********************************************************************************
+ *
+ *                              Private Function Definitions
+ *
+ ********************************************************************************/
+static esp_err_t geofence_to_esp_err(geofence_index_err_t err) {
+  switch (err) {
+  case GEOFENCE_INDEX_OK:
+    return ESP_OK;
+  case GEOFENCE_INDEX_ERR_ARG:
+    return ESP_ERR_INVALID_ARG;
+  case GEOFENCE_INDEX_ERR_FULL:
+    return ESP_ERR_NO_MEM;
+  case GEOFENCE_INDEX_ERR_NOT_BUILT:
+    return ESP_ERR_INVALID_STATE;
+  default:
+    return ESP_FAIL;
+  }
+}
+
+static esp_err_t geofence_load_defaults(void) {
+  char list[] = GEOFENCE_DEFAULT_CIRCLES;
+  char *save = NULL;
+  for (char *entry = strtok_r(list, ";", &save); NULL != entry;
+       entry = strtok_r(NULL, ";", &save)) {
+    unsigned id;
+    float lat, lng, radius_m;
+    if (4 != sscanf(entry, " %u : %f , %f , %f", &id, &lat, &lng, &radius_m)) {
+      ESP_LOGE(TAG, "Malformed fence entry: \"%s\"", entry);
+      return ESP_ERR_INVALID_ARG;
+    }
+    if (id > UINT16_MAX) {
+      ESP_LOGE(TAG, "Fence id %u is out of range!", id);
+      return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = geofence_add_circle((uint16_t)id, lat, lng, radius_m);
+    if (ESP_OK != ret) {
+      ESP_LOGE(TAG, "Failed to add fence %u: %s", id, esp_err_to_name(ret));
+      return ret;
+    }
+  }
+  return ESP_OK;
+}
+
+static void geofence_on_transition(const geofence_fence_t *fence,
+                                   geofence_transition_t transition,
+                                   void *ctx) {
+  if (g_event_count < GEOFENCE_MAX_FENCES) {
+    g_events[g_event_count].id = fence->id;
+    g_events[g_event_count].transition = transition;
+    g_event_count++;
+  }
+}
+
+static void geofence_send_event(const geofence_event_t *event, float lat,
+                                float lng, const timestamp_t *stamp) {
+  const char *name = (GEOFENCE_ENTER == event->transition) ? "enter" : "exit";
+  char msg[GEOFENCE_EVENT_MSG_SIZE];
+  int len = snprintf(msg, sizeof(msg),
+                     "{\n"
+                     "\"id\": \"%s\",\n"
+                     "\"event\": \"%s\",\n"
+                     "\"fence\": %u,\n"
+                     "\"lat\": %.5f,\n"
+                     "\"lng\": %.5f,\n"
+                     "\"date\": \"%s\",\n"
+                     "\"time\": \"%s\"\n"
+                     "}\n",
+                     UTILS_DEVICE_ID, name, event->id, lat, lng, stamp->date,
+                     stamp->time);
+  if (len < 0 || len >= (int)sizeof(msg)) {
+    ESP_LOGE(TAG, "Geofence event does not fit in the buffer!");
+    return;
+  }
+  ESP_LOGI(TAG, "Fence %u: %s", event->id, name);
+  if (ESP_OK != mqtt_mgt_queue_msg(msg, len)) {
+    ESP_LOGE(TAG, "Failed to queue the geofence event!");
+  }
+}
@@ -0,0 +1,278 @@
+#include "geofence_index.h"
+#include <math.h>
+#include <string.h>
+
+/**
+ * @brief Meters per degree of latitude.
+ */
+#define GEOFENCE_METERS_PER_DEG (111320.0f)
+
+/**
+ * @brief Smallest grid extent in degrees, used when all fences coincide.
+ */
+#define GEOFENCE_MIN_EXTENT_DEG (1e-4f)
+
+/**
+ * @brief Total number of grid cells.
+ */
+#define GEOFENCE_CELL_COUNT (GEOFENCE_GRID_DIM * GEOFENCE_GRID_DIM)
+
+/********************************************************************************
+ *
+ *                              Private Function Prototypes
+ *
+ ********************************************************************************/
+
+// Reserve the next fence slot; returns NULL if the table is full.
+static geofence_fence_t *geofence_index_next(geofence_index_t *index,
+                                             uint16_t id,
+                                             geofence_shape_t shape);
+
+// Clamp a coordinate to a grid row/column index.
+static int geofence_index_cell_coord(float value, float origin, float size);
+
+// Crossing-number point-in-polygon test.
+static bool geofence_index_in_polygon(const geofence_point_t *v, size_t n,
+                                      float lat, float lng);
+
+/********************************************************************************
+ *
+ *                              Public Function Definitions
+ *
+ ********************************************************************************/
+void geofence_index_clear(geofence_index_t *index) {
+  index->fence_count = 0;
+  index->vertex_count = 0;
+  memset(index->inside, 0, sizeof(index->inside));
+  memset(index->cell_start, 0, sizeof(index->cell_start));
+  index->built = false;
+}
+
+geofence_index_err_t geofence_index_add_circle(geofence_index_t *index,
+                                               uint16_t id, float lat,
+                                               float lng, float radius_m) {
+  if (radius_m <= 0.0f || lat < -90.0f || lat > 90.0f || lng < -180.0f ||
+      lng > 180.0f) {
+    return GEOFENCE_INDEX_ERR_ARG;
+  }
+  geofence_fence_t *fence =
+      geofence_index_next(index, id, GEOFENCE_SHAPE_CIRCLE);
+  if (NULL == fence) {
+    return GEOFENCE_INDEX_ERR_FULL;
+  }
+  float lng_scale = GEOFENCE_METERS_PER_DEG * cosf(lat * (float)M_PI / 180.0f);
+  if (lng_scale < 1.0f) {
+    lng_scale = 1.0f;
+  }
+  float dlat = radius_m / GEOFENCE_METERS_PER_DEG;
+  float dlng = radius_m / lng_scale;
+  fence->center = (geofence_point_t){.lat = lat, .lng = lng};
+  fence->radius_m = radius_m;
+  fence->lng_scale = lng_scale;
+  fence->min = (geofence_point_t){.lat = lat - dlat, .lng = lng - dlng};
+  fence->max = (geofence_point_t){.lat = lat + dlat, .lng = lng + dlng};
+  index->fence_count++;
+  return GEOFENCE_INDEX_OK;
+}
+
+geofence_index_err_t
+geofence_index_add_polygon(geofence_index_t *index, uint16_t id,
+                           const geofence_point_t *points, size_t count) {
+  if (NULL == points || count < 3) {
+    return GEOFENCE_INDEX_ERR_ARG;
+  }
+  if (count > (size_t)(GEOFENCE_MAX_VERTICES - index->vertex_count)) {
+    return GEOFENCE_INDEX_ERR_FULL;
+  }
+  geofence_fence_t *fence =
+      geofence_index_next(index, id, GEOFENCE_SHAPE_POLYGON);
+  if (NULL == fence) {
+    return GEOFENCE_INDEX_ERR_FULL;
+  }
+  fence->vertex_offset = index->vertex_count;
+  fence->vertex_count = (uint16_t)count;
+  fence->min = points[0];
+  fence->max = points[0];
+  for (size_t i = 0; i < count; i++) {
+    fence->min.lat = fminf(fence->min.lat, points[i].lat);
+    fence->min.lng = fminf(fence->min.lng, points[i].lng);
+    fence->max.lat = fmaxf(fence->max.lat, points[i].lat);
+    fence->max.lng = fmaxf(fence->max.lng, points[i].lng);
+  }
+  memcpy(&index->vertices[index->vertex_count], points,
+         count * sizeof(geofence_point_t));
+  index->vertex_count += (uint16_t)count;
+  index->fence_count++;
+  return GEOFENCE_INDEX_OK;
+}
+
+geofence_index_err_t geofence_index_build(geofence_index_t *index) {
+  memset(index->cell_start, 0, sizeof(index->cell_start));
+  if (0 == index->fence_count) {
+    index->built = true;
+    return GEOFENCE_INDEX_OK;
+  }
+
+  geofence_point_t min = index->fences[0].min;
+  geofence_point_t max = index->fences[0].max;
+  for (uint16_t f = 1; f < index->fence_count; f++) {
+    min.lat = fminf(min.lat, index->fences[f].min.lat);
+    min.lng = fminf(min.lng, index->fences[f].min.lng);
+    max.lat = fmaxf(max.lat, index->fences[f].max.lat);
+    max.lng = fmaxf(max.lng, index->fences[f].max.lng);
+  }
+  index->grid_min = min;
+  index->cell_lat =
+      fmaxf(max.lat - min.lat, GEOFENCE_MIN_EXTENT_DEG) / GEOFENCE_GRID_DIM;
+  index->cell_lng =
+      fmaxf(max.lng - min.lng, GEOFENCE_MIN_EXTENT_DEG) / GEOFENCE_GRID_DIM;
+
+  // Pass 1: count the references of every cell.
+  uint32_t total = 0;
+  for (uint16_t f = 0; f < index->fence_count; f++) {
+    const geofence_fence_t *fence = &index->fences[f];
+    int r0 = geofence_index_cell_coord(fence->min.lat, min.lat, index->cell_lat);
+    int r1 = geofence_index_cell_coord(fence->max.lat, min.lat, index->cell_lat);
+    int c0 = geofence_index_cell_coord(fence->min.lng, min.lng, index->cell_lng);
+    int c1 = geofence_index_cell_coord(fence->max.lng, min.lng, index->cell_lng);
+    total += (uint32_t)((r1 - r0 + 1) * (c1 - c0 + 1));
+    if (total > GEOFENCE_MAX_CELL_REFS) {
+      index->built = false;
+      return GEOFENCE_INDEX_ERR_FULL;
+    }
+    for (int r = r0; r <= r1; r++) {
+      for (int c = c0; c <= c1; c++) {
+        index->cell_start[r * GEOFENCE_GRID_DIM + c]++;
+      }
+    }
+  }
+
+  // Turn counts into end offsets.
+  uint16_t acc = 0;
+  for (int i = 0; i < GEOFENCE_CELL_COUNT; i++) {
+    acc += index->cell_start[i];
+    index->cell_start[i] = acc;
+  }
+  index->cell_start[GEOFENCE_CELL_COUNT] = acc;
+
+  // Pass 2: fill back to front, leaving cell_start[i] at the start of cell i
+  // and each cell's references in ascending fence order.
+  for (int f = index->fence_count - 1; f >= 0; f--) {
+    const geofence_fence_t *fence = &index->fences[f];
+    int r0 = geofence_index_cell_coord(fence->min.lat, min.lat, index->cell_lat);
+    int r1 = geofence_index_cell_coord(fence->max.lat, min.lat, index->cell_lat);
+    int c0 = geofence_index_cell_coord(fence->min.lng, min.lng, index->cell_lng);
+    int c1 = geofence_index_cell_coord(fence->max.lng, min.lng, index->cell_lng);
+    for (int r = r0; r <= r1; r++) {
+      for (int c = c0; c <= c1; c++) {
+        index->cell_refs[--index->cell_start[r * GEOFENCE_GRID_DIM + c]] =
+            (uint16_t)f;
+      }
+    }
+  }
+  index->built = true;
+  return GEOFENCE_INDEX_OK;
+}
+
+bool geofence_index_contains(const geofence_index_t *index,
+                             const geofence_fence_t *fence, float lat,
+                             float lng) {
+  if (lat < fence->min.lat || lat > fence->max.lat || lng < fence->min.lng ||
+      lng > fence->max.lng) {
+    return false;
+  }
+  if (fence->shape == GEOFENCE_SHAPE_CIRCLE) {
+    float dy = (lat - fence->center.lat) * GEOFENCE_METERS_PER_DEG;
+    float dx = (lng - fence->center.lng) * fence->lng_scale;
+    return dx * dx + dy * dy <= fence->radius_m * fence->radius_m;
+  }
+  return geofence_index_in_polygon(&index->vertices[fence->vertex_offset],
+                                   fence->vertex_count, lat, lng);
+}
+
+geofence_index_err_t geofence_index_evaluate(geofence_index_t *index,
+                                             float lat, float lng,
+                                             geofence_transition_cb_t cb,
+                                             void *ctx, size_t *inside) {
+  if (!index->built) {
+    return GEOFENCE_INDEX_ERR_NOT_BUILT;
+  }
+  uint32_t now[GEOFENCE_BITSET_WORDS] = {0};
+  size_t count = 0;
+
+  float row = (lat - index->grid_min.lat) / index->cell_lat;
+  float col = (lng - index->grid_min.lng) / index->cell_lng;
+  if (index->fence_count > 0 && row >= 0.0f && col >= 0.0f &&
+      row < (float)GEOFENCE_GRID_DIM && col < (float)GEOFENCE_GRID_DIM) {
+    int cell = (int)row * GEOFENCE_GRID_DIM + (int)col;
+    for (uint16_t i = index->cell_start[cell]; i < index->cell_start[cell + 1];
+         i++) {
+      uint16_t f = index->cell_refs[i];
+      if (geofence_index_contains(index, &index->fences[f], lat, lng)) {
+        now[f / 32] |= 1u << (f % 32);
+        count++;
+      }
+    }
+  }
+
+  for (int w = 0; w < GEOFENCE_BITSET_WORDS; w++) {
+    uint32_t changed = now[w] ^ index->inside[w];
+    while (changed) {
+      int bit = __builtin_ctz(changed);
+      changed &= changed - 1;
+      if (cb) {
+        cb(&index->fences[w * 32 + bit],
+           (now[w] & (1u << bit)) ? GEOFENCE_ENTER : GEOFENCE_EXIT, ctx);
+      }
+    }
+    index->inside[w] = now[w];
+  }
+  if (inside) {
+    *inside = count;
+  }
+  return GEOFENCE_INDEX_OK;
+}
+
+/********************************************************************************
+ *
+ *                              Private Function Definitions
+ *
+ ********************************************************************************/
+static geofence_fence_t *geofence_index_next(geofence_index_t *index,
+                                             uint16_t id,
+                                             geofence_shape_t shape) {
+  if (index->fence_count >= GEOFENCE_MAX_FENCES) {
+    return NULL;
+  }
+  geofence_fence_t *fence = &index->fences[index->fence_count];
+  memset(fence, 0, sizeof(*fence));
+  fence->id = id;
+  fence->shape = (uint8_t)shape;
+  index->built = false;
+  return fence;
+}
+
+static int geofence_index_cell_coord(float value, float origin, float size) {
+  int i = (int)((value - origin) / size);
+  if (i < 0) {
+    return 0;
+  }
+  if (i >= GEOFENCE_GRID_DIM) {
+    return GEOFENCE_GRID_DIM - 1;
+  }
+  return i;
+}
+
+static bool geofence_index_in_polygon(const geofence_point_t *v, size_t n,
+                                      float lat, float lng) {
+  bool in = false;
+  for (size_t i = 0, j = n - 1; i < n; j = i++) {
+    if ((v[i].lat > lat) != (v[j].lat > lat) &&
+        lng < (v[j].lng - v[i].lng) * (lat - v[i].lat) /
+                      (v[j].lat - v[i].lat) +
+                  v[i].lng) {
+      in = !in;
+    }
+  }
+  return in;
+}
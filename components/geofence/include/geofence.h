@@ -0,0 +1,77 @@
+#ifndef _GEOFENCE_H_
+#define _GEOFENCE_H_
+
+#include "esp_err.h"
+#include "geofence_index.h"
+#include "timestamp.h"
+#include <stdbool.h>
+
+/**
+ * @brief Initialize the geofence module.
+ *
+ * Loads the circles configured in CONFIG_GPS_TRACKER_GEOFENCE_CIRCLES, a
+ * ';'-separated list of "id:lat,lng,radius_m" entries.
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the configured fence list is malformed
+ *      - Appropriate esp_err_t error code otherwise
+ */
+esp_err_t geofence_init(void);
+
+/**
+ * @brief Remove all fences.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if not initialized.
+ */
+esp_err_t geofence_clear(void);
+
+/**
+ * @brief Add a circular fence. Takes effect after geofence_commit().
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG on invalid coordinates or radius
+ *      - ESP_ERR_NO_MEM if the fence table is full
+ */
+esp_err_t geofence_add_circle(uint16_t id, float lat, float lng,
+                              float radius_m);
+
+/**
+ * @brief Add a polygonal fence. Takes effect after geofence_commit().
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if fewer than three points are given
+ *      - ESP_ERR_NO_MEM if the fence table or vertex pool is full
+ */
+esp_err_t geofence_add_polygon(uint16_t id, const geofence_point_t *points,
+                               size_t count);
+
+/**
+ * @brief Rebuild the grid index over the current fences.
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the grid overflows.
+ */
+esp_err_t geofence_commit(void);
+
+/**
+ * @brief Evaluate a fix and queue an event message for every transition.
+ *
+ * Events are sent through mqtt_mgt_queue_msg() only when the fix enters or
+ * leaves a fence.
+ *
+ * @param[in]  lat      Latitude in degrees.
+ * @param[in]  lng      Longitude in degrees.
+ * @param[in]  stamp    Timestamp of the fix.
+ * @param[out] suppress Set to true if the raw fix should not be reported
+ *                      (inside a fence with suppression enabled).
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if stamp or suppress is NULL
+ *      - ESP_ERR_INVALID_STATE if not initialized
+ */
+esp_err_t geofence_process_fix(float lat, float lng, const timestamp_t *stamp,
+                               bool *suppress);
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef _GEOFENCE_INDEX_H_
+#define _GEOFENCE_INDEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Fixed-memory geofence index.
+ *
+ * Fences (circles and polygons) are bucketed into a uniform grid laid over
+ * their common bounding box. Evaluating a fix only tests the fences
+ * referenced by the grid cell containing it, so the cost per fix is bounded
+ * by the densest cell rather than by the total number of fences.
+ *
+ * This header has no ESP-IDF dependencies so that the engine can be
+ * benchmarked on the host (see tools/bench).
+ */
+
+#if defined(ESP_PLATFORM)
+#include "sdkconfig.h"
+#endif
+
+/**
+ * @brief Maximum number of fences held by the index.
+ */
+#ifndef GEOFENCE_MAX_FENCES
+#ifdef CONFIG_GPS_TRACKER_GEOFENCE_MAX_FENCES
+#define GEOFENCE_MAX_FENCES (CONFIG_GPS_TRACKER_GEOFENCE_MAX_FENCES)
+#else
+#define GEOFENCE_MAX_FENCES (256)
+#endif
+#endif
+
+/**
+ * @brief Total number of polygon vertices shared by all fences.
+ */
+#ifndef GEOFENCE_MAX_VERTICES
+#ifdef CONFIG_GPS_TRACKER_GEOFENCE_MAX_VERTICES
+#define GEOFENCE_MAX_VERTICES (CONFIG_GPS_TRACKER_GEOFENCE_MAX_VERTICES)
+#else
+#define GEOFENCE_MAX_VERTICES (2048)
+#endif
+#endif
+
+/**
+ * @brief Number of grid cells along each axis.
+ */
+#ifndef GEOFENCE_GRID_DIM
+#ifdef CONFIG_GPS_TRACKER_GEOFENCE_GRID_DIM
+#define GEOFENCE_GRID_DIM (CONFIG_GPS_TRACKER_GEOFENCE_GRID_DIM)
+#else
+#define GEOFENCE_GRID_DIM (32)
+#endif
+#endif
+
+/**
+ * @brief Total number of (cell, fence) references stored by the grid.
+ */
+#ifndef GEOFENCE_MAX_CELL_REFS
+#ifdef CONFIG_GPS_TRACKER_GEOFENCE_MAX_CELL_REFS
+#define GEOFENCE_MAX_CELL_REFS (CONFIG_GPS_TRACKER_GEOFENCE_MAX_CELL_REFS)
+#else
+#define GEOFENCE_MAX_CELL_REFS (4096)
+#endif
+#endif
+
+/**
+ * @brief Number of 32-bit words in a fence bitset.
+ */
+#define GEOFENCE_BITSET_WORDS ((GEOFENCE_MAX_FENCES + 31) / 32)
+
+/**
+ * @brief Result codes of the index operations.
+ */
+typedef enum {
+  GEOFENCE_INDEX_OK = 0,         ///< Success
+  GEOFENCE_INDEX_ERR_ARG,        ///< Invalid argument
+  GEOFENCE_INDEX_ERR_FULL,       ///< Fence, vertex or cell-reference pool full
+  GEOFENCE_INDEX_ERR_NOT_BUILT,  ///< Fences changed since the last build
+} geofence_index_err_t;
+
+/**
+ * @brief Kind of a fence.
+ */
+typedef enum {
+  GEOFENCE_SHAPE_CIRCLE,  ///< Center and radius
+  GEOFENCE_SHAPE_POLYGON, ///< Simple polygon, implicitly closed
+} geofence_shape_t;
+
+/**
+ * @brief Direction of a fence transition.
+ */
+typedef enum {
+  GEOFENCE_ENTER, ///< The fix moved into the fence
+  GEOFENCE_EXIT,  ///< The fix moved out of the fence
+} geofence_transition_t;
+
+/**
+ * @brief A point in degrees.
+ */
+typedef struct geofence_point {
+  float lat; ///< Latitude in degrees
+  float lng; ///< Longitude in degrees
+} geofence_point_t;
+
+/**
+ * @brief A fence stored in the index.
+ */
+typedef struct geofence_fence {
+  uint16_t id;            ///< Application-defined identifier
+  uint8_t shape;          ///< geofence_shape_t
+  uint16_t vertex_count;  ///< Polygon vertex count
+  uint16_t vertex_offset; ///< First vertex in the shared vertex pool
+  geofence_point_t min;   ///< Bounding box, lower corner
+  geofence_point_t max;   ///< Bounding box, upper corner
+  geofence_point_t center; ///< Circle center
+  float radius_m;          ///< Circle radius in meters
+  float lng_scale;         ///< Meters per degree of longitude at the center
+} geofence_fence_t;
+
+/**
+ * @brief Callback invoked for every fence transition.
+ *
+ * @param fence      Fence whose state changed.
+ * @param transition Enter or exit.
+ * @param ctx        User context passed to geofence_index_evaluate().
+ */
+typedef void (*geofence_transition_cb_t)(const geofence_fence_t *fence,
+                                         geofence_transition_t transition,
+                                         void *ctx);
+
+/**
+ * @brief The complete index; all storage is inline.
+ */
+typedef struct geofence_index {
+  geofence_fence_t fences[GEOFENCE_MAX_FENCES];       ///< Fence table
+  geofence_point_t vertices[GEOFENCE_MAX_VERTICES];   ///< Shared vertex pool
+  uint16_t cell_start[GEOFENCE_GRID_DIM * GEOFENCE_GRID_DIM + 1]; ///< CSR
+  uint16_t cell_refs[GEOFENCE_MAX_CELL_REFS];         ///< Fence indices
+  uint32_t inside[GEOFENCE_BITSET_WORDS];             ///< Current state
+  geofence_point_t grid_min;                          ///< Grid origin
+  float cell_lat;                                     ///< Cell height (deg)
+  float cell_lng;                                     ///< Cell width (deg)
+  uint16_t fence_count;                               ///< Fences in use
+  uint16_t vertex_count;                              ///< Vertices in use
+  bool built;                                         ///< Grid is current
+} geofence_index_t;
+
+/**
+ * @brief Remove all fences and reset the inside state.
+ */
+void geofence_index_clear(geofence_index_t *index);
+
+/**
+ * @brief Add a circular fence.
+ *
+ * The grid must be rebuilt with geofence_index_build() before evaluating.
+ */
+geofence_index_err_t geofence_index_add_circle(geofence_index_t *index,
+                                               uint16_t id, float lat,
+                                               float lng, float radius_m);
+
+/**
+ * @brief Add a polygonal fence with at least three vertices.
+ *
+ * The grid must be rebuilt with geofence_index_build() before evaluating.
+ */
+geofence_index_err_t
+geofence_index_add_polygon(geofence_index_t *index, uint16_t id,
+                           const geofence_point_t *points, size_t count);
+
+/**
+ * @brief (Re)build the grid over the current fences.
+ *
+ * The inside state of existing fences is preserved.
+ */
+geofence_index_err_t geofence_index_build(geofence_index_t *index);
+
+/**
+ * @brief Test whether a point lies inside a single fence.
+ */
+bool geofence_index_contains(const geofence_index_t *index,
+                             const geofence_fence_t *fence, float lat,
+                             float lng);
+
+/**
+ * @brief Evaluate a fix and report transitions against the previous fix.
+ *
+ * @param[in]  index  Built index.
+ * @param[in]  lat    Latitude in degrees.
+ * @param[in]  lng    Longitude in degrees.
+ * @param[in]  cb     Transition callback, may be NULL.
+ * @param[in]  ctx    Callback context.
+ * @param[out] inside Number of fences containing the fix, may be NULL.
+ */
+geofence_index_err_t geofence_index_evaluate(geofence_index_t *index,
+                                             float lat, float lng,
+                                             geofence_transition_cb_t cb,
+                                             void *ctx, size_t *inside);
+
+#endif
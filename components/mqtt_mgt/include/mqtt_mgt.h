@@ -2,9 +2,16 @@
 #define _MQTT_MGT_H_
 
 #include "esp_err.h"
+#include <stdbool.h>
 
 esp_err_t mqtt_mgt_init(void);
 
 esp_err_t mqtt_mgt_queue_msg(const void *data, size_t len);
 
+/**
+ * @brief Whether messages go out over the UDP transport (coap:// broker URL),
+ *        which carries binary fixes instead of JSON.
+ */
+bool mqtt_mgt_is_datagram(void);
+
 #endif
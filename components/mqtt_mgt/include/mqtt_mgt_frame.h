@@ -0,0 +1,159 @@
+#ifndef _MQTT_MGT_FRAME_H_
+#define _MQTT_MGT_FRAME_H_
+
+#include "mqtt_mgt_lz.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Datagram framing of the UDP uplink.
+ *
+ * A frame is a CoAP non-confirmable POST to /t/<device id> (RFC 7252), so
+ * it can be received by any CoAP server, whose payload carries a batch of
+ * queued messages:
+ *
+ *   version (1) | flags (1) | seq (4, big endian) | count (1) |
+ *   count x [ length (1) | message (length) ]
+ *
+ * seq is the sequence number of the first message of the frame; every
+ * message of a device is numbered, so the receiver can count lost,
+ * duplicated and reordered messages without acknowledging anything.
+ * Messages are binary fixes or JSON objects, told apart by their first byte
+ * (see payload_encoder.h). With MQTT_MGT_FRAME_FLAG_LZ set in flags, the
+ * length-prefixed messages are compressed as one stream (see mqtt_mgt_lz.h).
+ *
+ * This header is deliberately free of ESP-IDF dependencies so that the exact
+ * codec used by the firmware can also be compiled into host-side tools
+ * (see tools/uplink).
+ */
+
+/**
+ * @brief Version of the payload layout.
+ */
+#define MQTT_MGT_FRAME_VERSION (1)
+
+/**
+ * @brief Flag of a frame whose messages are compressed.
+ */
+#define MQTT_MGT_FRAME_FLAG_LZ (0x01)
+
+/**
+ * @brief Largest frame, the CoAP default that avoids IP fragmentation.
+ */
+#define MQTT_MGT_FRAME_MAX_LEN (1152)
+
+/**
+ * @brief Largest message that fits the one-byte length prefix.
+ */
+#define MQTT_MGT_FRAME_MSG_MAX_LEN (255)
+
+/**
+ * @brief Longest device identifier.
+ */
+#define MQTT_MGT_FRAME_ID_MAX_LEN (32)
+
+/**
+ * @brief Default CoAP port.
+ */
+#define MQTT_MGT_FRAME_DEFAULT_PORT (5683)
+
+/**
+ * @brief Frame being built with mqtt_mgt_frame_begin()/mqtt_mgt_frame_add().
+ */
+typedef struct mqtt_mgt_frame_writer {
+  uint8_t *buf;     ///< Output buffer
+  size_t size;      ///< Size of the output buffer
+  size_t len;       ///< Bytes written so far
+  size_t count_pos; ///< Offset of the message count
+  uint8_t count;    ///< Messages added so far
+} mqtt_mgt_frame_writer_t;
+
+/**
+ * @brief A decoded frame; messages are read with mqtt_mgt_frame_next().
+ */
+typedef struct mqtt_mgt_frame {
+  const char *device_id;   ///< Device identifier (not null-terminated)
+  size_t device_id_len;    ///< Length of the device identifier
+  uint16_t message_id;     ///< CoAP message ID
+  uint8_t flags;           ///< Payload flags
+  uint32_t seq;            ///< Sequence number of the first message
+  uint8_t count;           ///< Number of messages
+  const uint8_t *messages; ///< Length-prefixed messages
+  size_t messages_len;     ///< Size of the messages in bytes
+} mqtt_mgt_frame_t;
+
+/**
+ * @brief Start a frame.
+ *
+ * @param[out] writer     Writer to initialize.
+ * @param[out] buf        Output buffer.
+ * @param[in]  size       Size of the output buffer, at most
+ *                        MQTT_MGT_FRAME_MAX_LEN is used.
+ * @param[in]  device_id  Device identifier, at most
+ *                        MQTT_MGT_FRAME_ID_MAX_LEN characters.
+ * @param[in]  message_id CoAP message ID, unique per frame.
+ * @param[in]  seq        Sequence number of the first message.
+ * @return 0 on success, -1 if the identifier is too long or the buffer too
+ *         small.
+ */
+int mqtt_mgt_frame_begin(mqtt_mgt_frame_writer_t *writer, uint8_t *buf,
+                         size_t size, const char *device_id,
+                         uint16_t message_id, uint32_t seq);
+
+/**
+ * @brief Append a message to a frame.
+ *
+ * @return 0 on success, -1 if the message does not fit in the frame.
+ */
+int mqtt_mgt_frame_add(mqtt_mgt_frame_writer_t *writer, const void *msg,
+                       size_t len);
+
+/**
+ * @brief Compress the messages of a frame if that makes it smaller.
+ *
+ * No message can be added to the frame afterwards.
+ *
+ * @param[in,out] writer  Complete frame.
+ * @param[out]    enc     Encoder state, to keep it off the stack.
+ * @param[out]    scratch Buffer for the compressed messages.
+ * @param[in]     size    Size of the scratch buffer.
+ * @return 1 if the frame was compressed, 0 if compressing did not pay off.
+ */
+int mqtt_mgt_frame_compress(mqtt_mgt_frame_writer_t *writer,
+                            mqtt_mgt_lz_encoder_t *enc, uint8_t *scratch,
+                            size_t size);
+
+/**
+ * @brief Decode a frame.
+ *
+ * The messages of a compressed frame are only checked by
+ * mqtt_mgt_frame_inflate().
+ *
+ * @return 0 on success, -1 if the datagram is not a valid frame.
+ */
+int mqtt_mgt_frame_decode(const uint8_t *buf, size_t len,
+                          mqtt_mgt_frame_t *frame);
+
+/**
+ * @brief Decompress the messages of a decoded frame, if they are compressed.
+ *
+ * @param[in,out] frame Decoded frame; its messages then point to buf.
+ * @param[out]    buf   Output buffer, MQTT_MGT_FRAME_MAX_LEN bytes are
+ *                      always enough.
+ * @param[in]     size  Size of the output buffer.
+ * @return 0 on success, -1 if the messages are invalid.
+ */
+int mqtt_mgt_frame_inflate(mqtt_mgt_frame_t *frame, uint8_t *buf, size_t size);
+
+/**
+ * @brief Read the next message of a decoded frame.
+ *
+ * @param[in]     frame  Decoded frame.
+ * @param[in,out] offset Read position, 0 for the first message.
+ * @param[out]    len    Length of the message.
+ * @return The message, or NULL after the last one.
+ */
+const uint8_t *mqtt_mgt_frame_next(const mqtt_mgt_frame_t *frame,
+                                   size_t *offset, size_t *len);
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef _MQTT_MGT_LZ_H_
+#define _MQTT_MGT_LZ_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Streaming LZSS compression of batched uploads.
+ *
+ * The format follows heatshrink: a bit stream, most significant bit first,
+ * of literals and back-references into the last MQTT_MGT_LZ_WINDOW_LEN
+ * bytes of input:
+ *
+ *   literal        1 | byte (8)
+ *   back-reference 0 | distance - 1 (MQTT_MGT_LZ_WINDOW_BITS) |
+ *                      length - MQTT_MGT_LZ_MIN_MATCH (MQTT_MGT_LZ_LENGTH_BITS)
+ *
+ * The last byte is padded with zero bits, too few to form a back-reference.
+ * The encoder takes its input in pieces (one message at a time) and keeps
+ * only the window between them, so it needs no buffer for the whole batch.
+ *
+ * Batches published over MQTT are compressed into a single message:
+ *
+ *   MQTT_MGT_LZ_BATCH_MAGIC (1) | version (1) | raw length (2, big endian) |
+ *   LZSS stream of count x [ length (1) | message (length) ]
+ *
+ * The magic byte never starts UTF-8 text, so receivers can tell a compressed
+ * batch from a plain JSON message by its first byte.
+ *
+ * This header is deliberately free of ESP-IDF dependencies so that the exact
+ * codec used by the firmware can also be compiled into host-side tools
+ * (see tools/uplink and tools/bench).
+ */
+
+/**
+ * @brief Bits of a back-reference distance; the window is 2^bits bytes.
+ */
+#define MQTT_MGT_LZ_WINDOW_BITS (8)
+#define MQTT_MGT_LZ_WINDOW_LEN (1u << MQTT_MGT_LZ_WINDOW_BITS)
+
+/**
+ * @brief Bits of a back-reference length. Long enough to cover most of a
+ *        JSON fix, which repeats almost entirely from one fix to the next.
+ */
+#define MQTT_MGT_LZ_LENGTH_BITS (6)
+
+/**
+ * @brief Shortest and longest back-reference. A 2-byte match (15 bits)
+ *        is already cheaper than two literals (18 bits).
+ */
+#define MQTT_MGT_LZ_MIN_MATCH (2)
+#define MQTT_MGT_LZ_MAX_MATCH                                                  \
+  (MQTT_MGT_LZ_MIN_MATCH + (1u << MQTT_MGT_LZ_LENGTH_BITS) - 1)
+
+/**
+ * @brief Largest compressed size of n input bytes (all literals).
+ */
+#define MQTT_MGT_LZ_BOUND(n) ((n) + ((n) + 7) / 8)
+
+/**
+ * @brief First byte of a compressed batch.
+ */
+#define MQTT_MGT_LZ_BATCH_MAGIC (0xFF)
+
+/**
+ * @brief Version of the compressed batch layout.
+ */
+#define MQTT_MGT_LZ_BATCH_VERSION (1)
+
+/**
+ * @brief Size of the compressed batch header.
+ */
+#define MQTT_MGT_LZ_BATCH_HEADER_LEN (4)
+
+/**
+ * @brief Largest message of a compressed batch.
+ */
+#define MQTT_MGT_LZ_BATCH_MSG_MAX_LEN (255)
+
+/**
+ * @brief Largest uncompressed batch, including the length prefixes.
+ */
+#define MQTT_MGT_LZ_BATCH_MAX_LEN (UINT16_MAX)
+
+/**
+ * @brief Compression state; see mqtt_mgt_lz_encoder_init().
+ */
+typedef struct mqtt_mgt_lz_encoder {
+  uint8_t window[MQTT_MGT_LZ_WINDOW_LEN]; ///< Most recent input, a ring
+  size_t head;       ///< Position of the next input byte in the ring
+  size_t history;    ///< Valid bytes in the ring
+  size_t in_len;     ///< Input bytes consumed
+  uint8_t *out;      ///< Output buffer
+  size_t size;       ///< Size of the output buffer
+  size_t len;        ///< Bytes written so far
+  uint32_t bits;     ///< Output bits not yet written
+  uint8_t bit_count; ///< Number of pending output bits
+  uint8_t overflow;  ///< Set once the output buffer was too small
+} mqtt_mgt_lz_encoder_t;
+
+/**
+ * @brief Start a compressed stream.
+ *
+ * @param[out] enc  Encoder to initialize.
+ * @param[out] out  Output buffer.
+ * @param[in]  size Size of the output buffer.
+ */
+void mqtt_mgt_lz_encoder_init(mqtt_mgt_lz_encoder_t *enc, uint8_t *out,
+                              size_t size);
+
+/**
+ * @brief Compress the next piece of input.
+ *
+ * Back-references reach into earlier pieces but do not extend past the end
+ * of this one.
+ *
+ * @return 0 on success, -1 if the output buffer is full.
+ */
+int mqtt_mgt_lz_encode(mqtt_mgt_lz_encoder_t *enc, const void *in,
+                       size_t len);
+
+/**
+ * @brief End a compressed stream.
+ *
+ * @return The compressed length, or -1 if the output buffer was too small.
+ */
+int mqtt_mgt_lz_finish(mqtt_mgt_lz_encoder_t *enc);
+
+/**
+ * @brief Decompress a whole stream.
+ *
+ * @return The decompressed length, or -1 if the stream is invalid or does not
+ *         fit in the output buffer.
+ */
+int mqtt_mgt_lz_decode(const uint8_t *in, size_t len, uint8_t *out,
+                       size_t size);
+
+/**
+ * @brief Start a compressed batch in out; its header is written by
+ *        mqtt_mgt_lz_batch_end().
+ *
+ * @return 0 on success, -1 if the buffer is too small for the header.
+ */
+int mqtt_mgt_lz_batch_begin(mqtt_mgt_lz_encoder_t *enc, uint8_t *out,
+                            size_t size);
+
+/**
+ * @brief Append a message to a compressed batch.
+ *
+ * @return 0 on success, -1 if the message is too long or the output buffer is
+ *         full.
+ */
+int mqtt_mgt_lz_batch_add(mqtt_mgt_lz_encoder_t *enc, const void *msg,
+                          size_t len);
+
+/**
+ * @brief End a compressed batch.
+ *
+ * @return The length of the batch message, or -1 on failure.
+ */
+int mqtt_mgt_lz_batch_end(mqtt_mgt_lz_encoder_t *enc);
+
+/**
+ * @brief Decompress a batch message.
+ *
+ * The output holds the length-prefixed messages; read them with
+ * mqtt_mgt_lz_batch_next().
+ *
+ * @return The length of the output, or -1 if the message is not a valid
+ *         compressed batch or does not fit.
+ */
+int mqtt_mgt_lz_batch_decode(const uint8_t *in, size_t len, uint8_t *out,
+                             size_t size);
+
+/**
+ * @brief Read the next message of a decompressed batch (or of the messages of
+ *        a frame, which have the same layout).
+ *
+ * @param[in]     buf    Length-prefixed messages.
+ * @param[in]     len    Size of buf.
+ * @param[in,out] offset Read position, 0 for the first message.
+ * @param[out]    msg_len Length of the message.
+ * @return The message, or NULL after the last one or if it is truncated.
+ */
+const uint8_t *mqtt_mgt_lz_batch_next(const uint8_t *buf, size_t len,
+                                      size_t *offset, size_t *msg_len);
+
+#endif
@@ -1,18 +1,31 @@
 #include "mqtt_mgt.h"
+#include "esp_cpu.h"
 #include "esp_log.h"
 #include "esp_mac.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "mqtt_client.h"
+#include "mqtt_mgt_lz.h"
+#include "mqtt_mgt_tls.h"
+#include "mqtt_mgt_transport.h"
+#include "network_manager.h"
+#include "runtime_config.h"
 #include "utils.h"
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
 /**
  * @brief Default MQTT broker URL used for connections.
  */
 #define MQTT_MGT_DEFAULT_BROKER_URL (CONFIG_GPS_TRACKER_MQTT_BROKER_URL)
 
+/**
+ * @brief Broker URL scheme served by the session-resuming TLS transport.
+ */
+#define MQTT_MGT_TLS_SCHEME "mqtts://"
+
 /**
  * @brief Stack size (in bytes) for the MQTT management task.
  */
@@ -39,9 +52,50 @@
 #define MQTT_MGT_DATA_MAX_LEN (256)
 
 /**
- * @brief Default Quality of Service (QoS) level for MQTT messages.
+ * @brief Maximum size of a (reassembled) ingress message in bytes.
+ */
+#define MQTT_MGT_INGRESS_MAX_LEN (512)
+
+/**
+ * @brief Size of the reply to an ingress message in bytes.
+ */
+#define MQTT_MGT_REPLY_MAX_LEN (384)
+
+/**
+ * @brief QoS of the ingress subscription and of replies.
+ */
+#define MQTT_MGT_INGRESS_QOS (1)
+
+/**
+ * @brief How often a due batch is retried while disconnected.
+ */
+#define MQTT_MGT_RETRY_INTERVAL_MS (1000)
+
+/**
+ * @brief Longest time a wake may take to get Wi-Fi and then MQTT connected.
+ */
+#define MQTT_MGT_WAKE_TIMEOUT_MS (15000)
+
+/**
+ * @brief How long to wait before waking again after a failed wake.
  */
-#define MQTT_MGT_DEFAULT_QOS (1)
+#define MQTT_MGT_WAKE_RETRY_MS (60000)
+
+/**
+ * @brief Time the radio stays on after a batch, so that the broker can
+ *        deliver ingress messages queued while the device was asleep.
+ */
+#define MQTT_MGT_LINGER_MS (300)
+
+/**
+ * @brief Longest time to wait for in-flight publishes before sleeping.
+ */
+#define MQTT_MGT_DRAIN_TIMEOUT_MS (5000)
+
+/**
+ * @brief Polling period while waiting for in-flight publishes.
+ */
+#define MQTT_MGT_DRAIN_POLL_MS (20)
 
 /**
  * @brief Default retain flag for MQTT messages.
@@ -54,16 +108,6 @@
  *
  ********************************************************************************/
 
-/**
- * @brief Structure representing an MQTT message.
- *
- * This structure holds a pointer to the message data and its length.
- */
-typedef struct {
-  char *data; /**< Pointer to the message payload. */
-  size_t len; /**< Length of the message payload in bytes. */
-} mqtt_mgt_msg_t;
-
 /**
  * @brief Structure for managing MQTT client state and resources.
  *
@@ -76,8 +120,17 @@ typedef struct {
   TaskHandle_t task_handle; /**< Handle to the MQTT management task. */
   QueueHandle_t msg_queue;  /**< Queue for pending MQTT messages. */
   esp_mqtt_client_handle_t mqtt_client; /**< Handle to the ESP MQTT client. */
+  esp_transport_handle_t tls; /**< TLS transport for mqtts://, else NULL. */
+  const mqtt_mgt_transport_t *transport; /**< Uplink of the batches. */
   bool is_connected;                    /**< MQTT connection status flag. */
+  bool start_failed; /**< The always-on transport must be started again. */
   char topic[MQTT_MGT_TOPIC_MAX_LEN]; /**< Buffer for the MQTT topic string. */
+  char ingress_topic[MQTT_MGT_TOPIC_MAX_LEN]; /**< Configuration topic. */
+  char ingress[MQTT_MGT_INGRESS_MAX_LEN]; /**< Ingress reassembly buffer. */
+  bool radio_asleep;  /**< Wi-Fi and MQTT stopped between uplinks. */
+  int64_t wake_on_us; /**< Cumulative radio-on time when last woken. */
+  uint32_t sent;      /**< Messages published since boot. */
+  mqtt_mgt_lz_encoder_t lz; /**< Compressor of large batches. */
 } mqtt_mgt_t;
 
 /********************************************************************************
@@ -102,10 +155,50 @@ static mqtt_mgt_t g_mqtt = {0};
 static void mqtt_mgt_event_handler(void *handler_args, esp_event_base_t base,
                                    int32_t event_id, void *event_data);
 
+// Create the MQTT client and select it as the transport.
+static esp_err_t mqtt_mgt_client_init(void);
+
+// Reassemble an ingress message and apply it as a configuration update.
+static void mqtt_mgt_handle_data(const esp_mqtt_event_t *event);
+
+// Record a connection change reported by the transport.
+static void mqtt_mgt_on_state(bool connected);
+
+// MQTT transport operations.
+static esp_err_t mqtt_mgt_mqtt_start(void);
+static void mqtt_mgt_mqtt_stop(void);
+static esp_err_t mqtt_mgt_mqtt_send(mqtt_mgt_msg_t *const *batch, size_t count,
+                                    int qos);
+static int mqtt_mgt_mqtt_in_flight(void);
+
+// Compress a large batch into a single message; NULL if it does not pay off.
+static uint8_t *mqtt_mgt_mqtt_compress(mqtt_mgt_msg_t *const *batch,
+                                       size_t count, size_t *len);
+
+// Send and free every message of a batch.
+static void mqtt_mgt_flush(mqtt_mgt_msg_t **batch, size_t count, int qos);
+
+// Turn the radio on and wait for the transport to connect.
+static esp_err_t mqtt_mgt_wake(void);
+
+// Let in-flight traffic finish, then stop the transport and the radio.
+static void mqtt_mgt_sleep(void);
+
 // Entry point for the MQTT management task.
 // Runs the main loop or logic for MQTT management in a separate task/thread.
 static void mqtt_mgt_task_entry(void *user_ctx);
 
+// Uplink over the MQTT client; the default transport.
+static const mqtt_mgt_transport_t g_mqtt_transport = {
+    .name = "mqtt",
+    // Lets the broker deliver ingress messages queued while asleep.
+    .linger_ms = MQTT_MGT_LINGER_MS,
+    .start = mqtt_mgt_mqtt_start,
+    .stop = mqtt_mgt_mqtt_stop,
+    .send = mqtt_mgt_mqtt_send,
+    .in_flight = mqtt_mgt_mqtt_in_flight,
+};
+
 /********************************************************************************
  *
  *                              Public Function Definitions
@@ -116,31 +209,32 @@ esp_err_t mqtt_mgt_init(void) {
     ESP_LOGI(TAG, "mqtt_mgt is already initialized!");
     return ESP_OK;
   }
-  esp_mqtt_client_config_t mqtt_cfg = {
-      .broker.address.uri = MQTT_MGT_DEFAULT_BROKER_URL,
-  };
-  g_mqtt.mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
-
-  esp_mqtt_client_register_event(g_mqtt.mqtt_client, ESP_EVENT_ANY_ID,
-                                 mqtt_mgt_event_handler, NULL);
-  esp_mqtt_client_start(g_mqtt.mqtt_client);
-
-  BaseType_t ret = xTaskCreatePinnedToCore(
-      mqtt_mgt_task_entry, "mqtt_mgt_task", MQTT_MGT_TASK_SIZE, NULL,
-      MQTT_MGT_TASK_PRIORITY, &g_mqtt.task_handle, 1);
-  if (pdPASS != ret) {
-    ESP_LOGE(TAG, "Failed to create payload task!");
+  if (mqtt_mgt_is_datagram()) {
+    g_mqtt.transport = mqtt_mgt_udp_init(MQTT_MGT_DEFAULT_BROKER_URL,
+                                         UTILS_DEVICE_ID, mqtt_mgt_on_state);
+    if (NULL == g_mqtt.transport) {
+      ESP_LOGE(TAG, "Failed to create the UDP transport!");
+      return ESP_FAIL;
+    }
+  } else if (ESP_OK != mqtt_mgt_client_init()) {
     return ESP_FAIL;
   }
 
   g_mqtt.msg_queue =
       xQueueCreate(MQTT_MGT_QUEUE_SIZE, sizeof(mqtt_mgt_msg_t *));
-
   if (NULL == g_mqtt.msg_queue) {
     ESP_LOGE(TAG, "Failed to create a message queue!");
     return ESP_FAIL;
   }
 
+  BaseType_t ret = xTaskCreatePinnedToCore(
+      mqtt_mgt_task_entry, "mqtt_mgt_task", MQTT_MGT_TASK_SIZE, NULL,
+      MQTT_MGT_TASK_PRIORITY, &g_mqtt.task_handle, 1);
+  if (pdPASS != ret) {
+    ESP_LOGE(TAG, "Failed to create payload task!");
+    return ESP_FAIL;
+  }
+
   uint8_t mac[6];
 
   if (esp_read_mac(mac, ESP_MAC_WIFI_STA) != ESP_OK) {
@@ -153,12 +247,27 @@ esp_err_t mqtt_mgt_init(void) {
   //         mac[2], mac[3], mac[4], mac[5]);
 
   sprintf(g_mqtt.topic, "/egress/ESP_01");
-  ESP_LOGI(TAG, "Successfully initialized MQTT. Topic: %s", g_mqtt.topic);
+  sprintf(g_mqtt.ingress_topic, "/ingress/ESP_01");
+  ESP_LOGI(TAG,
+           "Successfully initialized MQTT. Transport: %s, topic: %s, config "
+           "topic: %s",
+           g_mqtt.transport->name, g_mqtt.topic, g_mqtt.ingress_topic);
   g_mqtt.initialized = true;
   g_mqtt.is_connected = false;
+  // Last, as the transport may report the connection right away. The task
+  // retries a failed start.
+  if (ESP_OK != g_mqtt.transport->start()) {
+    ESP_LOGE(TAG, "Failed to start the %s transport!", g_mqtt.transport->name);
+    g_mqtt.start_failed = true;
+  }
   return ESP_OK;
 }
 
+bool mqtt_mgt_is_datagram(void) {
+  return 0 == strncmp(MQTT_MGT_DEFAULT_BROKER_URL, MQTT_MGT_UDP_SCHEME,
+                      strlen(MQTT_MGT_UDP_SCHEME));
+}
+
 esp_err_t mqtt_mgt_queue_msg(const void *data, size_t len) {
   if (!g_mqtt.initialized) {
     ESP_LOGE(TAG, "MQTT has not been initialized yet!");
@@ -197,43 +306,351 @@ esp_err_t mqtt_mgt_queue_msg(const void *data, size_t len) {
  *                              Private Function Definitions
  *
  ********************************************************************************/
+static esp_err_t mqtt_mgt_client_init(void) {
+  esp_mqtt_client_config_t mqtt_cfg = {
+      .broker.address.uri = MQTT_MGT_DEFAULT_BROKER_URL,
+      // Keep the session (and the ingress subscription) on the broker while
+      // the radio is off, so that updates sent meanwhile are delivered on
+      // the next wake.
+      .session.disable_clean_session = true,
+  };
+  if (0 == strncmp(MQTT_MGT_DEFAULT_BROKER_URL, MQTT_MGT_TLS_SCHEME,
+                   strlen(MQTT_MGT_TLS_SCHEME))) {
+    g_mqtt.tls = mqtt_mgt_tls_init();
+    if (NULL == g_mqtt.tls) {
+      ESP_LOGE(TAG, "Failed to create the TLS transport!");
+      return ESP_FAIL;
+    }
+    mqtt_cfg.network.transport = g_mqtt.tls;
+  }
+  g_mqtt.mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
+  if (NULL == g_mqtt.mqtt_client) {
+    ESP_LOGE(TAG, "Failed to create the MQTT client!");
+    return ESP_FAIL;
+  }
+
+  esp_mqtt_client_register_event(g_mqtt.mqtt_client, ESP_EVENT_ANY_ID,
+                                 mqtt_mgt_event_handler, NULL);
+  g_mqtt.transport = &g_mqtt_transport;
+  return ESP_OK;
+}
+
 static void mqtt_mgt_event_handler(void *handler_args, esp_event_base_t base,
                                    int32_t event_id, void *event_data) {
   ESP_LOGD(TAG,
            "Event dispatched from event loop base=%s, event_id=%" PRIi32 "",
            base, event_id);
+  esp_mqtt_event_handle_t event = event_data;
   switch ((esp_mqtt_event_id_t)event_id) {
   case MQTT_EVENT_CONNECTED:
     ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED!");
-    g_mqtt.is_connected = true;
+    mqtt_mgt_on_state(true);
+    if (NULL != g_mqtt.tls) {
+      mqtt_mgt_tls_stats_t stats;
+      mqtt_mgt_tls_get_stats(g_mqtt.tls, &stats);
+      ESP_LOGI(TAG,
+               "TLS handshakes: %" PRIu32 " full (%.1f ms avg, peak heap %u), "
+               "%" PRIu32 " resumed (%.1f ms avg, peak heap %u), %" PRIu32
+               " failed.",
+               stats.full,
+               stats.full ? stats.full_us / 1000.0 / stats.full : 0.0,
+               (unsigned)stats.full_peak_heap, stats.resumed,
+               stats.resumed ? stats.resumed_us / 1000.0 / stats.resumed : 0.0,
+               (unsigned)stats.resumed_peak_heap, stats.failed);
+    }
+#if CONFIG_GPS_TRACKER_REMOTE_CONFIG
+    if (esp_mqtt_client_subscribe(g_mqtt.mqtt_client, g_mqtt.ingress_topic,
+                                  MQTT_MGT_INGRESS_QOS) < 0) {
+      ESP_LOGE(TAG, "Failed to subscribe to %s!", g_mqtt.ingress_topic);
+    }
+#endif
     break;
   case MQTT_EVENT_DISCONNECTED:
     ESP_LOGW(TAG, "MQTT_EVENT_DISCONNECTED");
-    g_mqtt.is_connected = false;
+    mqtt_mgt_on_state(false);
+    break;
+  case MQTT_EVENT_DATA:
+    mqtt_mgt_handle_data(event);
     break;
   default:
     break;
   }
 }
 
+static void mqtt_mgt_handle_data(const esp_mqtt_event_t *event) {
+#if !CONFIG_GPS_TRACKER_REMOTE_CONFIG
+  // The persistent session may still hold a subscription made while remote
+  // configuration was enabled.
+  if (0 == event->current_data_offset) {
+    ESP_LOGW(TAG, "Remote configuration is disabled, ignoring %.*s",
+             event->topic_len, event->topic);
+  }
+  return;
+#endif
+  // Later fragments of a large message carry no topic; only the first one
+  // is checked.
+  if (0 == event->current_data_offset &&
+      (event->topic_len != (int)strlen(g_mqtt.ingress_topic) ||
+       0 != strncmp(event->topic, g_mqtt.ingress_topic, event->topic_len))) {
+    ESP_LOGW(TAG, "Ignoring data on %.*s", event->topic_len, event->topic);
+    return;
+  }
+  if (event->total_data_len > MQTT_MGT_INGRESS_MAX_LEN) {
+    ESP_LOGE(TAG, "Ingress message too large (%d bytes)!",
+             event->total_data_len);
+    return;
+  }
+  memcpy(g_mqtt.ingress + event->current_data_offset, event->data,
+         event->data_len);
+  if (event->current_data_offset + event->data_len < event->total_data_len) {
+    return;
+  }
+
+  char reply[MQTT_MGT_REPLY_MAX_LEN];
+  runtime_config_apply_json(g_mqtt.ingress, event->total_data_len, reply,
+                            sizeof(reply));
+  // Enqueue rather than publish: this runs inside the MQTT client task.
+  if (esp_mqtt_client_enqueue(g_mqtt.mqtt_client, g_mqtt.topic, reply, 0,
+                              MQTT_MGT_INGRESS_QOS, false, true) < 0) {
+    ESP_LOGE(TAG, "Failed to enqueue the config reply!");
+  }
+}
+
+static void mqtt_mgt_on_state(bool connected) {
+  g_mqtt.is_connected = connected;
+  if (connected && NULL != g_mqtt.task_handle) {
+    xTaskNotifyGive(g_mqtt.task_handle);
+  }
+}
+
+static esp_err_t mqtt_mgt_mqtt_start(void) {
+  return esp_mqtt_client_start(g_mqtt.mqtt_client);
+}
+
+static void mqtt_mgt_mqtt_stop(void) {
+  esp_mqtt_client_stop(g_mqtt.mqtt_client);
+}
+
+static esp_err_t mqtt_mgt_mqtt_send(mqtt_mgt_msg_t *const *batch, size_t count,
+                                    int qos) {
+  size_t len;
+  uint8_t *packed = mqtt_mgt_mqtt_compress(batch, count, &len);
+  if (NULL != packed) {
+    // Not retained: subscribers would replay the whole batch on every
+    // (re)connect and store its fixes again.
+    int msg_id = esp_mqtt_client_publish(g_mqtt.mqtt_client, g_mqtt.topic,
+                                         (const char *)packed, len, qos,
+                                         false);
+    FREE(packed);
+    return msg_id < 0 ? ESP_FAIL : ESP_OK;
+  }
+  esp_err_t ret = ESP_OK;
+  for (size_t i = 0; i < count; i++) {
+    if (esp_mqtt_client_publish(g_mqtt.mqtt_client, g_mqtt.topic,
+                                batch[i]->data, batch[i]->len, qos,
+                                MQTT_MGT_DEFAULT_RETAIN) < 0) {
+      ret = ESP_FAIL;
+    }
+  }
+  return ret;
+}
+
+static uint8_t *mqtt_mgt_mqtt_compress(mqtt_mgt_msg_t *const *batch,
+                                       size_t count, size_t *len) {
+  size_t raw_len = 0;
+  for (size_t i = 0; i < count; i++) {
+    raw_len += batch[i]->len;
+  }
+  if (0 == MQTT_MGT_COMPRESS_THRESHOLD || count < 2 ||
+      raw_len < MQTT_MGT_COMPRESS_THRESHOLD) {
+    return NULL;
+  }
+  // Smaller than the messages alone, or it is not worth it; their
+  // separate publish headers come on top of that.
+  uint8_t *out = MALLOC(raw_len);
+  if (NULL == out) {
+    return NULL;
+  }
+  uint32_t cycles = esp_cpu_get_cycle_count();
+  int ret = mqtt_mgt_lz_batch_begin(&g_mqtt.lz, out, raw_len);
+  for (size_t i = 0; 0 == ret && i < count; i++) {
+    ret = mqtt_mgt_lz_batch_add(&g_mqtt.lz, batch[i]->data, batch[i]->len);
+  }
+  int out_len = 0 == ret ? mqtt_mgt_lz_batch_end(&g_mqtt.lz) : -1;
+  cycles = esp_cpu_get_cycle_count() - cycles;
+  if (out_len < 0) {
+    FREE(out);
+    return NULL;
+  }
+  ESP_LOGD(TAG,
+           "Compressed %u message(s) from %u to %d bytes in %" PRIu32
+           " cycles.",
+           (unsigned)count, (unsigned)raw_len, out_len, cycles);
+  *len = (size_t)out_len;
+  return out;
+}
+
+static int mqtt_mgt_mqtt_in_flight(void) {
+  // QoS 1/2 publishes stay in the outbox until acknowledged.
+  return esp_mqtt_client_get_outbox_size(g_mqtt.mqtt_client);
+}
+
+static void mqtt_mgt_flush(mqtt_mgt_msg_t **batch, size_t count, int qos) {
+  if (ESP_OK != g_mqtt.transport->send(batch, count, qos)) {
+    ESP_LOGE(TAG, "Failed to send part of a batch over %s!",
+             g_mqtt.transport->name);
+  }
+  for (size_t i = 0; i < count; i++) {
+    FREE(batch[i]->data);
+    FREE(batch[i]);
+  }
+  g_mqtt.sent += count;
+
+  network_manager_radio_stats_t stats;
+  if (ESP_OK == network_manager_get_radio_stats(&stats)) {
+    ESP_LOGI(TAG,
+             "Successfully sent %u egress message(s)! Radio on %.1f ms per "
+             "message over %" PRIu32 " message(s) and %" PRIu32 " wake(s).",
+             (unsigned)count, stats.on_us / 1000.0 / g_mqtt.sent, g_mqtt.sent,
+             stats.wakes);
+  }
+}
+
+static esp_err_t mqtt_mgt_wake(void) {
+  ESP_LOGI(TAG, "Waking the radio.");
+  g_mqtt.radio_asleep = false;
+  network_manager_radio_stats_t stats;
+  if (ESP_OK == network_manager_get_radio_stats(&stats)) {
+    g_mqtt.wake_on_us = stats.on_us;
+  }
+
+  esp_err_t ret = network_manager_radio_on(MQTT_MGT_WAKE_TIMEOUT_MS);
+  if (ESP_OK == ret) {
+    // Drop a stale notification; the next one comes from the transport.
+    ulTaskNotifyTake(pdTRUE, 0);
+    ret = g_mqtt.transport->start();
+    if (ESP_OK == ret &&
+        0 ==
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MQTT_MGT_WAKE_TIMEOUT_MS))) {
+      ret = ESP_ERR_TIMEOUT;
+    }
+  }
+  if (ESP_OK != ret) {
+    ESP_LOGE(TAG, "Wake failed (%s), back to sleep.", esp_err_to_name(ret));
+    mqtt_mgt_sleep();
+  }
+  return ret;
+}
+
+static void mqtt_mgt_sleep(void) {
+  if (g_mqtt.is_connected) {
+    vTaskDelay(pdMS_TO_TICKS(g_mqtt.transport->linger_ms));
+    TickType_t start = xTaskGetTickCount();
+    while (g_mqtt.is_connected && g_mqtt.transport->in_flight() > 0 &&
+           xTaskGetTickCount() - start <
+               pdMS_TO_TICKS(MQTT_MGT_DRAIN_TIMEOUT_MS)) {
+      vTaskDelay(pdMS_TO_TICKS(MQTT_MGT_DRAIN_POLL_MS));
+    }
+  }
+  g_mqtt.transport->stop();
+  g_mqtt.is_connected = false;
+  // From now on the transport is started by mqtt_mgt_wake().
+  g_mqtt.start_failed = false;
+  if (ESP_OK != network_manager_radio_off()) {
+    ESP_LOGE(TAG, "Failed to turn the radio off!");
+  }
+  g_mqtt.radio_asleep = true;
+
+  network_manager_radio_stats_t stats;
+  if (ESP_OK == network_manager_get_radio_stats(&stats)) {
+    ESP_LOGI(TAG, "Radio off after %.1f ms on.",
+             (stats.on_us - g_mqtt.wake_on_us) / 1000.0);
+  }
+}
+
 static void mqtt_mgt_task_entry(void *user_ctx) {
-  mqtt_mgt_msg_t *p_msg = {0};
+  mqtt_mgt_msg_t *batch[RUNTIME_CONFIG_BATCH_MAX] = {0};
+  size_t count = 0;
+  TickType_t first_tick = 0;
+  TickType_t wake_tick = xTaskGetTickCount();
+  TickType_t start_tick = wake_tick;
+  bool wake_failed = false;
   while (true) {
-    if (xQueueReceive(g_mqtt.msg_queue, &p_msg, portMAX_DELAY) == pdTRUE &&
-        g_mqtt.is_connected) {
-      if (p_msg) {
-        esp_mqtt_client_publish(g_mqtt.mqtt_client, g_mqtt.topic, p_msg->data,
-                                p_msg->len, MQTT_MGT_DEFAULT_QOS,
-                                MQTT_MGT_DEFAULT_RETAIN);
-        FREE(p_msg->data);
-        FREE(p_msg);
-        ESP_LOGI(TAG, "Successfully sent egress message!");
-      } else {
-        ESP_LOGE(TAG, "NULL message!");
+    // Re-read every time so that updates apply without restarting the task.
+    runtime_config_t config;
+    runtime_config_get(&config);
+    bool duty_cycled = config.wake_interval_ms > 0;
+    TickType_t max_age = pdMS_TO_TICKS(
+        duty_cycled ? config.wake_interval_ms : config.batch_max_age_ms);
+    TickType_t now = xTaskGetTickCount();
+
+    // While the radio is on anyway, a duty-cycled batch goes out at once.
+    bool due = count > 0 && (count >= config.batch_size ||
+                             now - first_tick >= max_age ||
+                             (duty_cycled && g_mqtt.is_connected));
+    if (g_mqtt.radio_asleep && (due || !duty_cycled) &&
+        (!wake_failed ||
+         now - wake_tick >= pdMS_TO_TICKS(MQTT_MGT_WAKE_RETRY_MS))) {
+      wake_tick = now;
+      wake_failed = ESP_OK != mqtt_mgt_wake();
+      continue;
+    }
+    // Once started, esp-mqtt reconnects by itself, but a UDP start that
+    // failed (e.g. DNS not ready yet) is only retried here.
+    if (!duty_cycled && g_mqtt.start_failed && !g_mqtt.radio_asleep &&
+        now - start_tick >= pdMS_TO_TICKS(MQTT_MGT_RETRY_INTERVAL_MS)) {
+      start_tick = now;
+      g_mqtt.start_failed = ESP_OK != g_mqtt.transport->start();
+      continue;
+    }
+    if (due && g_mqtt.is_connected) {
+      mqtt_mgt_flush(batch, count, config.qos);
+      count = 0;
+      continue;
+    }
+    if (duty_cycled && !g_mqtt.radio_asleep && 0 == count &&
+        (g_mqtt.is_connected ||
+         now - wake_tick >= pdMS_TO_TICKS(MQTT_MGT_WAKE_TIMEOUT_MS))) {
+      mqtt_mgt_sleep();
+      continue;
+    }
+
+    TickType_t wait = portMAX_DELAY;
+    if (duty_cycled && !g_mqtt.radio_asleep) {
+      // Awake (e.g. at boot) and waiting for the connection.
+      wait = pdMS_TO_TICKS(MQTT_MGT_RETRY_INTERVAL_MS);
+    } else if (!duty_cycled && g_mqtt.start_failed) {
+      wait = pdMS_TO_TICKS(MQTT_MGT_RETRY_INTERVAL_MS);
+    } else if (due) {
+      if (!duty_cycled) {
+        ESP_LOGI(TAG, "%s is not connected!", g_mqtt.transport->name);
       }
-    } else {
-      ESP_LOGI(TAG, "MQTT is not connected!");
+      wait = pdMS_TO_TICKS(duty_cycled ? MQTT_MGT_WAKE_RETRY_MS
+                                       : MQTT_MGT_RETRY_INTERVAL_MS);
+    } else if (count > 0) {
+      wait = max_age - (now - first_tick);
+    }
+
+    mqtt_mgt_msg_t *p_msg = NULL;
+    if (xQueueReceive(g_mqtt.msg_queue, &p_msg, wait) != pdTRUE) {
+      continue;
+    }
+    if (NULL == p_msg) {
+      ESP_LOGE(TAG, "NULL message!");
+      continue;
+    }
+    if (RUNTIME_CONFIG_BATCH_MAX == count) {
+      // Disconnected for too long: make room by dropping the oldest.
+      ESP_LOGW(TAG, "Batch full while disconnected, dropping a message.");
+      FREE(batch[0]->data);
+      FREE(batch[0]);
+      memmove(&batch[0], &batch[1], (count - 1) * sizeof(batch[0]));
+      count--;
+    }
+    if (0 == count) {
+      first_tick = xTaskGetTickCount();
     }
+    batch[count++] = p_msg;
   }
   vTaskDelete(NULL);
 }
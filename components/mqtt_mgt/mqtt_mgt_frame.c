@@ -0,0 +1,278 @@
+#include "mqtt_mgt_frame.h"
+#include <string.h>
+
+/**
+ * @brief First header byte: version 1, non-confirmable, no token.
+ */
+#define MQTT_MGT_FRAME_COAP_NON (0x50)
+
+/**
+ * @brief CoAP request code POST (0.02).
+ */
+#define MQTT_MGT_FRAME_COAP_POST (0x02)
+
+/**
+ * @brief CoAP Uri-Path option number.
+ */
+#define MQTT_MGT_FRAME_COAP_URI_PATH (11)
+
+/**
+ * @brief Marker between the CoAP options and the payload.
+ */
+#define MQTT_MGT_FRAME_COAP_PAYLOAD_MARKER (0xFF)
+
+/**
+ * @brief First path segment of the resource frames are posted to.
+ */
+#define MQTT_MGT_FRAME_PATH "t"
+
+/**
+ * @brief Size of the payload header: version, flags, seq and count.
+ */
+#define MQTT_MGT_FRAME_HEADER_LEN (7)
+
+/********************************************************************************
+ *
+ *                              Private Function Prototypes
+ *
+ ********************************************************************************/
+
+/**
+ * @brief Write one CoAP option header; returns the bytes written.
+ */
+static size_t mqtt_mgt_frame_put_option(uint8_t *buf, unsigned delta,
+                                        size_t len);
+
+/**
+ * @brief Read one extended option delta or length nibble.
+ *
+ * @return 0 on success, -1 if the value is reserved or truncated.
+ */
+static int mqtt_mgt_frame_get_nibble(unsigned nibble, const uint8_t **p,
+                                     const uint8_t *end, size_t *value);
+
+/**
+ * @brief Check that the messages of a frame add up to its payload, so that
+ *        reading them cannot overrun.
+ *
+ * @return 0 on success, -1 if not.
+ */
+static int mqtt_mgt_frame_check(const mqtt_mgt_frame_t *frame);
+
+/********************************************************************************
+ *
+ *                              Public Function Definitions
+ *
+ ********************************************************************************/
+int mqtt_mgt_frame_begin(mqtt_mgt_frame_writer_t *writer, uint8_t *buf,
+                         size_t size, const char *device_id,
+                         uint16_t message_id, uint32_t seq) {
+  size_t id_len = strlen(device_id);
+  size_t path_len = strlen(MQTT_MGT_FRAME_PATH);
+  // Header, two options with up to one extended length byte, the marker
+  // and the payload header.
+  size_t len = 4 + 1 + path_len + 2 + id_len + 1 + MQTT_MGT_FRAME_HEADER_LEN;
+  if (0 == id_len || id_len > MQTT_MGT_FRAME_ID_MAX_LEN || size < len) {
+    return -1;
+  }
+
+  uint8_t *p = buf;
+  *p++ = MQTT_MGT_FRAME_COAP_NON;
+  *p++ = MQTT_MGT_FRAME_COAP_POST;
+  *p++ = (uint8_t)(message_id >> 8);
+  *p++ = (uint8_t)message_id;
+  p += mqtt_mgt_frame_put_option(p, MQTT_MGT_FRAME_COAP_URI_PATH, path_len);
+  memcpy(p, MQTT_MGT_FRAME_PATH, path_len);
+  p += path_len;
+  p += mqtt_mgt_frame_put_option(p, 0, id_len);
+  memcpy(p, device_id, id_len);
+  p += id_len;
+  *p++ = MQTT_MGT_FRAME_COAP_PAYLOAD_MARKER;
+
+  *p++ = MQTT_MGT_FRAME_VERSION;
+  *p++ = 0;
+  *p++ = (uint8_t)(seq >> 24);
+  *p++ = (uint8_t)(seq >> 16);
+  *p++ = (uint8_t)(seq >> 8);
+  *p++ = (uint8_t)seq;
+  writer->count_pos = (size_t)(p - buf);
+  *p++ = 0;
+
+  writer->buf = buf;
+  writer->size = size < MQTT_MGT_FRAME_MAX_LEN ? size : MQTT_MGT_FRAME_MAX_LEN;
+  writer->len = (size_t)(p - buf);
+  writer->count = 0;
+  return 0;
+}
+
+int mqtt_mgt_frame_add(mqtt_mgt_frame_writer_t *writer, const void *msg,
+                       size_t len) {
+  if (len > MQTT_MGT_FRAME_MSG_MAX_LEN || UINT8_MAX == writer->count ||
+      writer->len + 1 + len > writer->size) {
+    return -1;
+  }
+  writer->buf[writer->len++] = (uint8_t)len;
+  memcpy(writer->buf + writer->len, msg, len);
+  writer->len += len;
+  writer->buf[writer->count_pos] = ++writer->count;
+  return 0;
+}
+
+int mqtt_mgt_frame_compress(mqtt_mgt_frame_writer_t *writer,
+                            mqtt_mgt_lz_encoder_t *enc, uint8_t *scratch,
+                            size_t size) {
+  size_t start = writer->count_pos + 1;
+  size_t raw_len = writer->len - start;
+  // Only worth it if at least a byte is saved.
+  if (raw_len < 2 || size < raw_len - 1) {
+    return 0;
+  }
+  mqtt_mgt_lz_encoder_init(enc, scratch, raw_len - 1);
+  mqtt_mgt_lz_encode(enc, writer->buf + start, raw_len);
+  int len = mqtt_mgt_lz_finish(enc);
+  if (len < 0) {
+    return 0;
+  }
+  memcpy(writer->buf + start, scratch, (size_t)len);
+  writer->len = start + (size_t)len;
+  // The flags precede the sequence number and the count.
+  writer->buf[writer->count_pos - 5] |= MQTT_MGT_FRAME_FLAG_LZ;
+  // Full, so that nothing is appended to the compressed stream.
+  writer->size = writer->len;
+  return 1;
+}
+
+int mqtt_mgt_frame_decode(const uint8_t *buf, size_t len,
+                          mqtt_mgt_frame_t *frame) {
+  if (len < 4 || MQTT_MGT_FRAME_COAP_NON != buf[0] ||
+      MQTT_MGT_FRAME_COAP_POST != buf[1]) {
+    return -1;
+  }
+  memset(frame, 0, sizeof(*frame));
+  frame->message_id = (uint16_t)(buf[2] << 8 | buf[3]);
+
+  const uint8_t *p = buf + 4;
+  const uint8_t *end = buf + len;
+  unsigned number = 0;
+  unsigned segment = 0;
+  while (p < end && MQTT_MGT_FRAME_COAP_PAYLOAD_MARKER != *p) {
+    unsigned nibbles = *p++;
+    size_t delta;
+    size_t opt_len;
+    if (0 != mqtt_mgt_frame_get_nibble(nibbles >> 4, &p, end, &delta) ||
+        0 != mqtt_mgt_frame_get_nibble(nibbles & 0x0F, &p, end, &opt_len) ||
+        opt_len > (size_t)(end - p)) {
+      return -1;
+    }
+    number += (unsigned)delta;
+    if (MQTT_MGT_FRAME_COAP_URI_PATH == number) {
+      if (0 == segment &&
+          (opt_len != strlen(MQTT_MGT_FRAME_PATH) ||
+           0 != memcmp(p, MQTT_MGT_FRAME_PATH, opt_len))) {
+        return -1;
+      }
+      if (1 == segment) {
+        if (0 == opt_len || opt_len > MQTT_MGT_FRAME_ID_MAX_LEN) {
+          return -1;
+        }
+        frame->device_id = (const char *)p;
+        frame->device_id_len = opt_len;
+      }
+      if (++segment > 2) {
+        return -1;
+      }
+    } else if (number & 1) {
+      // Unknown critical option.
+      return -1;
+    }
+    p += opt_len;
+  }
+  if (2 != segment || p == end ||
+      (size_t)(end - p) < 1 + MQTT_MGT_FRAME_HEADER_LEN) {
+    return -1;
+  }
+  p++;
+
+  if (MQTT_MGT_FRAME_VERSION != p[0]) {
+    return -1;
+  }
+  frame->flags = p[1];
+  if (0 != (frame->flags & ~MQTT_MGT_FRAME_FLAG_LZ)) {
+    return -1;
+  }
+  frame->seq = (uint32_t)p[2] << 24 | (uint32_t)p[3] << 16 |
+               (uint32_t)p[4] << 8 | (uint32_t)p[5];
+  frame->count = p[6];
+  frame->messages = p + MQTT_MGT_FRAME_HEADER_LEN;
+  frame->messages_len = (size_t)(end - frame->messages);
+  if (frame->flags & MQTT_MGT_FRAME_FLAG_LZ) {
+    return 0;
+  }
+  return mqtt_mgt_frame_check(frame);
+}
+
+int mqtt_mgt_frame_inflate(mqtt_mgt_frame_t *frame, uint8_t *buf,
+                           size_t size) {
+  if (0 == (frame->flags & MQTT_MGT_FRAME_FLAG_LZ)) {
+    return 0;
+  }
+  int len = mqtt_mgt_lz_decode(frame->messages, frame->messages_len, buf, size);
+  if (len < 0) {
+    return -1;
+  }
+  frame->messages = buf;
+  frame->messages_len = (size_t)len;
+  frame->flags &= (uint8_t)~MQTT_MGT_FRAME_FLAG_LZ;
+  return mqtt_mgt_frame_check(frame);
+}
+
+const uint8_t *mqtt_mgt_frame_next(const mqtt_mgt_frame_t *frame,
+                                   size_t *offset, size_t *len) {
+  // Same layout as a decompressed batch.
+  return mqtt_mgt_lz_batch_next(frame->messages, frame->messages_len, offset,
+                                len);
+}
+
+/********************************************************************************
+ *
+ *                              Private Function Definitions
+ *
+ ********************************************************************************/
+static size_t mqtt_mgt_frame_put_option(uint8_t *buf, unsigned delta,
+                                        size_t len) {
+  // Deltas used here are below 13; lengths up to 268 need one extra byte.
+  if (len < 13) {
+    buf[0] = (uint8_t)(delta << 4 | len);
+    return 1;
+  }
+  buf[0] = (uint8_t)(delta << 4 | 13);
+  buf[1] = (uint8_t)(len - 13);
+  return 2;
+}
+
+static int mqtt_mgt_frame_get_nibble(unsigned nibble, const uint8_t **p,
+                                     const uint8_t *end, size_t *value) {
+  if (nibble < 13) {
+    *value = nibble;
+  } else if (13 == nibble && *p < end) {
+    *value = 13 + (size_t)(*p)[0];
+    *p += 1;
+  } else if (14 == nibble && end - *p >= 2) {
+    *value = 269 + ((size_t)(*p)[0] << 8 | (*p)[1]);
+    *p += 2;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+static int mqtt_mgt_frame_check(const mqtt_mgt_frame_t *frame) {
+  size_t offset = 0;
+  size_t msg_len;
+  for (unsigned i = 0; i < frame->count; i++) {
+    if (NULL == mqtt_mgt_frame_next(frame, &offset, &msg_len)) {
+      return -1;
+    }
+  }
+  return offset == frame->messages_len ? 0 : -1;
+}
@@ -0,0 +1,287 @@
+#include "mqtt_mgt_lz.h"
+#include <string.h>
+
+/**
+ * @brief Mask of a position in the window ring.
+ */
+#define MQTT_MGT_LZ_WINDOW_MASK (MQTT_MGT_LZ_WINDOW_LEN - 1)
+
+/********************************************************************************
+ *
+ *                              Private Function Prototypes
+ *
+ ********************************************************************************/
+
+/**
+ * @brief Append count bits (at most 16) to the output.
+ */
+static void mqtt_mgt_lz_put_bits(mqtt_mgt_lz_encoder_t *enc, uint32_t value,
+                                 unsigned count);
+
+/**
+ * @brief Read count bits at *bit, most significant first, and advance *bit.
+ */
+static uint32_t mqtt_mgt_lz_get_bits(const uint8_t *in, size_t *bit,
+                                     unsigned count);
+
+/**
+ * @brief Byte distance positions before in[pos], from in or the window.
+ */
+static uint8_t mqtt_mgt_lz_byte_at(const mqtt_mgt_lz_encoder_t *enc,
+                                   const uint8_t *in, size_t pos,
+                                   size_t distance);
+
+/**
+ * @brief Longest earlier match of in[pos...] within the window.
+ *
+ * @param[out] distance Distance of the match.
+ * @return Length of the match, 0 if there is none.
+ */
+static size_t mqtt_mgt_lz_find_match(const mqtt_mgt_lz_encoder_t *enc,
+                                     const uint8_t *in, size_t pos,
+                                     size_t len, size_t *distance);
+
+/**
+ * @brief Remember a piece of input in the window.
+ */
+static void mqtt_mgt_lz_update_window(mqtt_mgt_lz_encoder_t *enc,
+                                      const uint8_t *in, size_t len);
+
+/********************************************************************************
+ *
+ *                              Public Function Definitions
+ *
+ ********************************************************************************/
+void mqtt_mgt_lz_encoder_init(mqtt_mgt_lz_encoder_t *enc, uint8_t *out,
+                              size_t size) {
+  memset(enc, 0, sizeof(*enc));
+  enc->out = out;
+  enc->size = size;
+}
+
+int mqtt_mgt_lz_encode(mqtt_mgt_lz_encoder_t *enc, const void *in,
+                       size_t len) {
+  const uint8_t *bytes = in;
+  size_t pos = 0;
+  while (pos < len && !enc->overflow) {
+    size_t distance = 0;
+    size_t match = mqtt_mgt_lz_find_match(enc, bytes, pos, len, &distance);
+    if (match >= MQTT_MGT_LZ_MIN_MATCH) {
+      mqtt_mgt_lz_put_bits(enc, 0, 1);
+      mqtt_mgt_lz_put_bits(enc, (uint32_t)(distance - 1),
+                           MQTT_MGT_LZ_WINDOW_BITS);
+      mqtt_mgt_lz_put_bits(enc, (uint32_t)(match - MQTT_MGT_LZ_MIN_MATCH),
+                           MQTT_MGT_LZ_LENGTH_BITS);
+      pos += match;
+    } else {
+      mqtt_mgt_lz_put_bits(enc, 0x100 | bytes[pos], 9);
+      pos++;
+    }
+  }
+  mqtt_mgt_lz_update_window(enc, bytes, len);
+  enc->in_len += len;
+  return enc->overflow ? -1 : 0;
+}
+
+int mqtt_mgt_lz_finish(mqtt_mgt_lz_encoder_t *enc) {
+  if (enc->bit_count > 0) {
+    mqtt_mgt_lz_put_bits(enc, 0, 8 - enc->bit_count);
+  }
+  return enc->overflow ? -1 : (int)enc->len;
+}
+
+int mqtt_mgt_lz_decode(const uint8_t *in, size_t len, uint8_t *out,
+                       size_t size) {
+  size_t out_len = 0;
+  size_t bit = 0;
+  size_t bits = len * 8;
+  while (bit < bits) {
+    if (mqtt_mgt_lz_get_bits(in, &bit, 1)) {
+      if (bits - bit < 8 || out_len == size) {
+        return -1;
+      }
+      out[out_len++] = (uint8_t)mqtt_mgt_lz_get_bits(in, &bit, 8);
+      continue;
+    }
+    if (bits - bit < MQTT_MGT_LZ_WINDOW_BITS + MQTT_MGT_LZ_LENGTH_BITS) {
+      // Padding of the last byte.
+      break;
+    }
+    size_t distance =
+        1 + mqtt_mgt_lz_get_bits(in, &bit, MQTT_MGT_LZ_WINDOW_BITS);
+    size_t match = MQTT_MGT_LZ_MIN_MATCH +
+                   mqtt_mgt_lz_get_bits(in, &bit, MQTT_MGT_LZ_LENGTH_BITS);
+    if (distance > out_len || match > size - out_len) {
+      return -1;
+    }
+    // Byte by byte, as the match may overlap the bytes it produces.
+    for (size_t i = 0; i < match; i++, out_len++) {
+      out[out_len] = out[out_len - distance];
+    }
+  }
+  return (int)out_len;
+}
+
+int mqtt_mgt_lz_batch_begin(mqtt_mgt_lz_encoder_t *enc, uint8_t *out,
+                            size_t size) {
+  if (size < MQTT_MGT_LZ_BATCH_HEADER_LEN) {
+    return -1;
+  }
+  mqtt_mgt_lz_encoder_init(enc, out + MQTT_MGT_LZ_BATCH_HEADER_LEN,
+                           size - MQTT_MGT_LZ_BATCH_HEADER_LEN);
+  return 0;
+}
+
+int mqtt_mgt_lz_batch_add(mqtt_mgt_lz_encoder_t *enc, const void *msg,
+                          size_t len) {
+  if (len > MQTT_MGT_LZ_BATCH_MSG_MAX_LEN ||
+      enc->in_len + 1 + len > MQTT_MGT_LZ_BATCH_MAX_LEN) {
+    return -1;
+  }
+  uint8_t prefix = (uint8_t)len;
+  if (0 != mqtt_mgt_lz_encode(enc, &prefix, 1)) {
+    return -1;
+  }
+  return mqtt_mgt_lz_encode(enc, msg, len);
+}
+
+int mqtt_mgt_lz_batch_end(mqtt_mgt_lz_encoder_t *enc) {
+  int len = mqtt_mgt_lz_finish(enc);
+  if (len < 0) {
+    return -1;
+  }
+  uint8_t *header = enc->out - MQTT_MGT_LZ_BATCH_HEADER_LEN;
+  header[0] = MQTT_MGT_LZ_BATCH_MAGIC;
+  header[1] = MQTT_MGT_LZ_BATCH_VERSION;
+  header[2] = (uint8_t)(enc->in_len >> 8);
+  header[3] = (uint8_t)enc->in_len;
+  return MQTT_MGT_LZ_BATCH_HEADER_LEN + len;
+}
+
+int mqtt_mgt_lz_batch_decode(const uint8_t *in, size_t len, uint8_t *out,
+                             size_t size) {
+  if (len < MQTT_MGT_LZ_BATCH_HEADER_LEN || MQTT_MGT_LZ_BATCH_MAGIC != in[0] ||
+      MQTT_MGT_LZ_BATCH_VERSION != in[1]) {
+    return -1;
+  }
+  size_t raw_len = (size_t)in[2] << 8 | in[3];
+  if (raw_len > size) {
+    return -1;
+  }
+  int out_len = mqtt_mgt_lz_decode(in + MQTT_MGT_LZ_BATCH_HEADER_LEN,
+                                   len - MQTT_MGT_LZ_BATCH_HEADER_LEN, out,
+                                   raw_len);
+  if (out_len < 0 || (size_t)out_len != raw_len) {
+    return -1;
+  }
+  // Check the message lengths once so that reading them cannot overrun.
+  size_t offset = 0;
+  size_t msg_len;
+  while (NULL != mqtt_mgt_lz_batch_next(out, raw_len, &offset, &msg_len)) {
+  }
+  return offset == raw_len ? out_len : -1;
+}
+
+const uint8_t *mqtt_mgt_lz_batch_next(const uint8_t *buf, size_t len,
+                                      size_t *offset, size_t *msg_len) {
+  if (*offset >= len) {
+    return NULL;
+  }
+  size_t n = buf[*offset];
+  if (n > len - *offset - 1) {
+    return NULL;
+  }
+  const uint8_t *msg = buf + *offset + 1;
+  *offset += 1 + n;
+  *msg_len = n;
+  return msg;
+}
+
+/********************************************************************************
+ *
+ *                              Private Function Definitions
+ *
+ ********************************************************************************/
+static void mqtt_mgt_lz_put_bits(mqtt_mgt_lz_encoder_t *enc, uint32_t value,
+                                 unsigned count) {
+  enc->bits = enc->bits << count | (value & ((1u << count) - 1));
+  enc->bit_count += count;
+  while (enc->bit_count >= 8) {
+    enc->bit_count -= 8;
+    if (enc->len == enc->size) {
+      enc->overflow = 1;
+      return;
+    }
+    enc->out[enc->len++] = (uint8_t)(enc->bits >> enc->bit_count);
+  }
+}
+
+static uint32_t mqtt_mgt_lz_get_bits(const uint8_t *in, size_t *bit,
+                                     unsigned count) {
+  uint32_t value = 0;
+  for (unsigned i = 0; i < count; i++, (*bit)++) {
+    value = value << 1 | ((in[*bit >> 3] >> (7 - (*bit & 7))) & 1);
+  }
+  return value;
+}
+
+static uint8_t mqtt_mgt_lz_byte_at(const mqtt_mgt_lz_encoder_t *enc,
+                                   const uint8_t *in, size_t pos,
+                                   size_t distance) {
+  if (distance <= pos) {
+    return in[pos - distance];
+  }
+  return enc->window[(enc->head - (distance - pos)) & MQTT_MGT_LZ_WINDOW_MASK];
+}
+
+static size_t mqtt_mgt_lz_find_match(const mqtt_mgt_lz_encoder_t *enc,
+                                     const uint8_t *in, size_t pos,
+                                     size_t len, size_t *distance) {
+  size_t reach = pos + enc->history;
+  if (reach > MQTT_MGT_LZ_WINDOW_LEN) {
+    reach = MQTT_MGT_LZ_WINDOW_LEN;
+  }
+  size_t max = len - pos;
+  if (max > MQTT_MGT_LZ_MAX_MATCH) {
+    max = MQTT_MGT_LZ_MAX_MATCH;
+  }
+  size_t best = 0;
+  if (max < MQTT_MGT_LZ_MIN_MATCH) {
+    return 0;
+  }
+  // Nearest first, so that ties keep the shortest distance.
+  for (size_t d = 1; d <= reach; d++) {
+    if (mqtt_mgt_lz_byte_at(enc, in, pos, d) != in[pos] ||
+        mqtt_mgt_lz_byte_at(enc, in, pos + best, d) != in[pos + best]) {
+      continue;
+    }
+    size_t n = 1;
+    while (n < max && mqtt_mgt_lz_byte_at(enc, in, pos + n, d) == in[pos + n]) {
+      n++;
+    }
+    if (n > best) {
+      best = n;
+      *distance = d;
+      if (best == max) {
+        break;
+      }
+    }
+  }
+  return best;
+}
+
+static void mqtt_mgt_lz_update_window(mqtt_mgt_lz_encoder_t *enc,
+                                      const uint8_t *in, size_t len) {
+  if (len > MQTT_MGT_LZ_WINDOW_LEN) {
+    in += len - MQTT_MGT_LZ_WINDOW_LEN;
+    len = MQTT_MGT_LZ_WINDOW_LEN;
+  }
+  for (size_t i = 0; i < len; i++) {
+    enc->window[enc->head] = in[i];
+    enc->head = (enc->head + 1) & MQTT_MGT_LZ_WINDOW_MASK;
+  }
+  enc->history += len;
+  if (enc->history > MQTT_MGT_LZ_WINDOW_LEN) {
+    enc->history = MQTT_MGT_LZ_WINDOW_LEN;
+  }
+}
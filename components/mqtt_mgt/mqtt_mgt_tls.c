@@ -0,0 +1,451 @@
+#include "mqtt_mgt_tls.h"
+#include "esp_attr.h"
+#include "esp_crt_bundle.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_transport_tcp.h"
+#include "lwip/sockets.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/x509_crt.h"
+#include "utils.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @brief Port used when the broker URL does not specify one.
+ */
+#define MQTT_MGT_TLS_DEFAULT_PORT (8883)
+
+/**
+ * @brief Longest broker host name whose session is cached.
+ */
+#define MQTT_MGT_TLS_HOST_MAX_LEN (64)
+
+/**
+ * @brief Space for a serialized session in RTC memory. Sessions that keep the
+ *        peer certificate (CONFIG_MBEDTLS_SSL_KEEP_PEER_CERTIFICATE) may not
+ *        fit and are then only cached in RAM.
+ */
+#define MQTT_MGT_TLS_RTC_SESSION_MAX_LEN (1536)
+
+/**
+ * @brief Marks a valid session in RTC memory.
+ */
+#define MQTT_MGT_TLS_RTC_MAGIC (0x544C5353)
+
+/********************************************************************************
+ *
+ *                              Type Declarations
+ *
+ ********************************************************************************/
+
+/**
+ * @brief Transport state, stored as the transport's context data.
+ */
+typedef struct {
+  esp_transport_handle_t tcp;      /**< Underlying TCP transport. */
+  mbedtls_net_context net;         /**< Socket of the TCP transport. */
+  mbedtls_ssl_context ssl;         /**< TLS connection. */
+  mbedtls_ssl_config conf;         /**< TLS settings. */
+  mbedtls_entropy_context entropy; /**< Entropy source for the DRBG. */
+  mbedtls_ctr_drbg_context drbg;   /**< Random generator for TLS. */
+#ifdef MQTT_MGT_TLS_CUSTOM_CA
+  mbedtls_x509_crt ca; /**< CA from CONFIG_GPS_TRACKER_MQTT_TLS_CA_FILE. */
+#endif
+  mbedtls_ssl_session session; /**< Session of the last handshake. */
+  bool session_valid;          /**< session can be offered. */
+  char session_host[MQTT_MGT_TLS_HOST_MAX_LEN]; /**< Host of session. */
+  mqtt_mgt_tls_stats_t stats;  /**< Handshake statistics. */
+} mqtt_mgt_tls_t;
+
+#if CONFIG_GPS_TRACKER_MQTT_TLS_SESSION_RTC
+/**
+ * @brief Serialized session kept across deep sleep.
+ */
+typedef struct {
+  uint32_t magic;                       /**< MQTT_MGT_TLS_RTC_MAGIC. */
+  uint16_t len;                         /**< Bytes used in data. */
+  char host[MQTT_MGT_TLS_HOST_MAX_LEN]; /**< Host of the session. */
+  uint8_t data[MQTT_MGT_TLS_RTC_SESSION_MAX_LEN]; /**< Serialized session. */
+} mqtt_mgt_tls_rtc_t;
+#endif
+
+/********************************************************************************
+ *
+ *                              Private Global Variables
+ *
+ ********************************************************************************/
+
+// TAG used for logging TLS transport messages
+static char *TAG = "mqtt_mgt_tls";
+
+#ifdef MQTT_MGT_TLS_CUSTOM_CA
+// CA certificate embedded by CMake (NUL-terminated PEM).
+extern const char g_ca_pem_start[] asm("_binary_mqtt_ca_pem_start");
+extern const char g_ca_pem_end[] asm("_binary_mqtt_ca_pem_end");
+#endif
+
+#if CONFIG_GPS_TRACKER_MQTT_TLS_SESSION_RTC
+// Zeroed at power-on, preserved across deep sleep.
+static RTC_DATA_ATTR mqtt_mgt_tls_rtc_t g_rtc_session;
+#endif
+
+/********************************************************************************
+ *
+ *                              Private Function Prototypes
+ *
+ ********************************************************************************/
+
+// esp_transport callbacks.
+static int mqtt_mgt_tls_connect(esp_transport_handle_t t, const char *host,
+                                int port, int timeout_ms);
+static int mqtt_mgt_tls_read(esp_transport_handle_t t, char *buffer, int len,
+                             int timeout_ms);
+static int mqtt_mgt_tls_write(esp_transport_handle_t t, const char *buffer,
+                              int len, int timeout_ms);
+static int mqtt_mgt_tls_poll_read(esp_transport_handle_t t, int timeout_ms);
+static int mqtt_mgt_tls_poll_write(esp_transport_handle_t t, int timeout_ms);
+static int mqtt_mgt_tls_close(esp_transport_handle_t t);
+static int mqtt_mgt_tls_destroy(esp_transport_handle_t t);
+
+// Offer the cached session for host, if any. Returns true if offered.
+static bool mqtt_mgt_tls_offer_session(mqtt_mgt_tls_t *tls, const char *host);
+
+// Cache the session of the handshake that just completed.
+static void mqtt_mgt_tls_save_session(mqtt_mgt_tls_t *tls, const char *host);
+
+// Forget the cached session, e.g. after a failed resumption.
+static void mqtt_mgt_tls_drop_session(mqtt_mgt_tls_t *tls);
+
+/********************************************************************************
+ *
+ *                              Public Function Definitions
+ *
+ ********************************************************************************/
+esp_transport_handle_t mqtt_mgt_tls_init(void) {
+  mqtt_mgt_tls_t *tls = MALLOC(sizeof(mqtt_mgt_tls_t));
+  if (NULL == tls) {
+    ESP_LOGE(TAG, "Memory allocation failed!");
+    return NULL;
+  }
+  memset(tls, 0, sizeof(mqtt_mgt_tls_t));
+  mbedtls_net_init(&tls->net);
+  mbedtls_ssl_init(&tls->ssl);
+  mbedtls_ssl_config_init(&tls->conf);
+  mbedtls_entropy_init(&tls->entropy);
+  mbedtls_ctr_drbg_init(&tls->drbg);
+  mbedtls_ssl_session_init(&tls->session);
+#ifdef MQTT_MGT_TLS_CUSTOM_CA
+  mbedtls_x509_crt_init(&tls->ca);
+#endif
+
+  esp_transport_handle_t t = esp_transport_init();
+  tls->tcp = esp_transport_tcp_init();
+  if (NULL == t || NULL == tls->tcp) {
+    ESP_LOGE(TAG, "Failed to create the transport!");
+    goto fail;
+  }
+
+  int ret = mbedtls_ctr_drbg_seed(&tls->drbg, mbedtls_entropy_func,
+                                  &tls->entropy, NULL, 0);
+  if (0 == ret) {
+    ret = mbedtls_ssl_config_defaults(&tls->conf, MBEDTLS_SSL_IS_CLIENT,
+                                      MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+  }
+  if (0 != ret) {
+    ESP_LOGE(TAG, "TLS setup failed (-0x%04x)!", -ret);
+    goto fail;
+  }
+  // TLS 1.2 delivers the session (ID and ticket) with the handshake itself;
+  // TLS 1.3 tickets arrive later and would complicate caching.
+  mbedtls_ssl_conf_max_tls_version(&tls->conf, MBEDTLS_SSL_VERSION_TLS1_2);
+  mbedtls_ssl_conf_authmode(&tls->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+  mbedtls_ssl_conf_rng(&tls->conf, mbedtls_ctr_drbg_random, &tls->drbg);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+  mbedtls_ssl_conf_session_tickets(&tls->conf,
+                                   MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+#ifdef MQTT_MGT_TLS_CUSTOM_CA
+  ret = mbedtls_x509_crt_parse(&tls->ca, (const unsigned char *)g_ca_pem_start,
+                               g_ca_pem_end - g_ca_pem_start);
+  if (0 != ret) {
+    ESP_LOGE(TAG, "Failed to parse the broker CA (-0x%04x)!", -ret);
+    goto fail;
+  }
+  mbedtls_ssl_conf_ca_chain(&tls->conf, &tls->ca, NULL);
+#else
+  if (ESP_OK != esp_crt_bundle_attach(&tls->conf)) {
+    ESP_LOGE(TAG, "Failed to attach the certificate bundle!");
+    goto fail;
+  }
+#endif
+  ret = mbedtls_ssl_setup(&tls->ssl, &tls->conf);
+  if (0 != ret) {
+    ESP_LOGE(TAG, "TLS setup failed (-0x%04x)!", -ret);
+    goto fail;
+  }
+
+  esp_transport_set_context_data(t, tls);
+  esp_transport_set_func(t, mqtt_mgt_tls_connect, mqtt_mgt_tls_read,
+                         mqtt_mgt_tls_write, mqtt_mgt_tls_close,
+                         mqtt_mgt_tls_poll_read, mqtt_mgt_tls_poll_write,
+                         mqtt_mgt_tls_destroy);
+  esp_transport_set_default_port(t, MQTT_MGT_TLS_DEFAULT_PORT);
+  return t;
+
+fail:
+  if (NULL != t) {
+    esp_transport_destroy(t);
+  }
+  if (NULL != tls->tcp) {
+    esp_transport_destroy(tls->tcp);
+  }
+  mbedtls_ssl_free(&tls->ssl);
+  mbedtls_ssl_config_free(&tls->conf);
+  mbedtls_ctr_drbg_free(&tls->drbg);
+  mbedtls_entropy_free(&tls->entropy);
+#ifdef MQTT_MGT_TLS_CUSTOM_CA
+  mbedtls_x509_crt_free(&tls->ca);
+#endif
+  FREE(tls);
+  return NULL;
+}
+
+void mqtt_mgt_tls_get_stats(esp_transport_handle_t transport,
+                            mqtt_mgt_tls_stats_t *stats) {
+  mqtt_mgt_tls_t *tls = esp_transport_get_context_data(transport);
+  *stats = tls->stats;
+}
+
+/********************************************************************************
+ *
+ *                              Private Function Definitions
+ *
+ ********************************************************************************/
+static int mqtt_mgt_tls_connect(esp_transport_handle_t t, const char *host,
+                                int port, int timeout_ms) {
+  mqtt_mgt_tls_t *tls = esp_transport_get_context_data(t);
+  if (esp_transport_connect(tls->tcp, host, port, timeout_ms) < 0) {
+    ESP_LOGE(TAG, "TCP connection to %s:%d failed!", host, port);
+    return -1;
+  }
+  tls->net.fd = esp_transport_get_socket(tls->tcp);
+  // A resumed handshake ends with the client's Finished, immediately followed
+  // by CONNECT; without this the second segment waits for a delayed ACK.
+  int one = 1;
+  setsockopt(tls->net.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  int ret = mbedtls_ssl_session_reset(&tls->ssl);
+  if (0 != ret) {
+    ESP_LOGE(TAG, "TLS session reset failed (-0x%04x)!", -ret);
+    esp_transport_close(tls->tcp);
+    tls->net.fd = -1;
+    return -1;
+  }
+  mbedtls_ssl_set_hostname(&tls->ssl, host);
+  mbedtls_ssl_set_bio(&tls->ssl, &tls->net, mbedtls_net_send, NULL,
+                      mbedtls_net_recv_timeout);
+  mbedtls_ssl_conf_read_timeout(&tls->conf, timeout_ms);
+  bool offered = mqtt_mgt_tls_offer_session(tls, host);
+  // A resumed session keeps its master secret; a full handshake derives a
+  // new one.
+  unsigned char offered_master[sizeof(tls->session.MBEDTLS_PRIVATE(master))];
+  memcpy(offered_master, tls->session.MBEDTLS_PRIVATE(master),
+         sizeof(offered_master));
+
+  size_t free_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+  heap_caps_monitor_local_minimum_free_size_start();
+  int64_t start_us = esp_timer_get_time();
+  do {
+    ret = mbedtls_ssl_handshake(&tls->ssl);
+  } while (MBEDTLS_ERR_SSL_WANT_READ == ret ||
+           MBEDTLS_ERR_SSL_WANT_WRITE == ret);
+  int64_t elapsed_us = esp_timer_get_time() - start_us;
+  size_t peak_heap =
+      free_before - heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+  heap_caps_monitor_local_minimum_free_size_stop();
+
+  if (0 != ret) {
+    ESP_LOGE(TAG, "TLS handshake with %s failed (-0x%04x)!", host, -ret);
+    tls->stats.failed++;
+    if (offered) {
+      // Do not offer a session that may be the cause again.
+      mqtt_mgt_tls_drop_session(tls);
+    }
+    esp_transport_close(tls->tcp);
+    tls->net.fd = -1;
+    return -1;
+  }
+
+  mqtt_mgt_tls_save_session(tls, host);
+  bool resumed = offered && tls->session_valid &&
+                 0 == memcmp(offered_master,
+                             tls->session.MBEDTLS_PRIVATE(master),
+                             sizeof(offered_master));
+  if (resumed) {
+    tls->stats.resumed++;
+    tls->stats.resumed_us += elapsed_us;
+    if (peak_heap > tls->stats.resumed_peak_heap) {
+      tls->stats.resumed_peak_heap = peak_heap;
+    }
+  } else {
+    tls->stats.full++;
+    tls->stats.full_us += elapsed_us;
+    if (peak_heap > tls->stats.full_peak_heap) {
+      tls->stats.full_peak_heap = peak_heap;
+    }
+  }
+  ESP_LOGI(TAG, "%s TLS handshake: %.1f ms, peak heap %u bytes (%s).",
+           resumed ? "Resumed" : "Full", elapsed_us / 1000.0,
+           (unsigned)peak_heap, mbedtls_ssl_get_ciphersuite(&tls->ssl));
+  return 0;
+}
+
+static int mqtt_mgt_tls_read(esp_transport_handle_t t, char *buffer, int len,
+                             int timeout_ms) {
+  mqtt_mgt_tls_t *tls = esp_transport_get_context_data(t);
+  mbedtls_ssl_conf_read_timeout(&tls->conf, timeout_ms);
+  int ret = mbedtls_ssl_read(&tls->ssl, (unsigned char *)buffer, len);
+  if (ret > 0) {
+    return ret;
+  }
+  if (MBEDTLS_ERR_SSL_TIMEOUT == ret || MBEDTLS_ERR_SSL_WANT_READ == ret ||
+      MBEDTLS_ERR_SSL_WANT_WRITE == ret) {
+    return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+  }
+  if (0 == ret || MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY == ret) {
+    return ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN;
+  }
+  ESP_LOGE(TAG, "TLS read failed (-0x%04x)!", -ret);
+  return ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+}
+
+static int mqtt_mgt_tls_write(esp_transport_handle_t t, const char *buffer,
+                              int len, int timeout_ms) {
+  mqtt_mgt_tls_t *tls = esp_transport_get_context_data(t);
+  int written = 0;
+  while (written < len) {
+    if (esp_transport_poll_write(tls->tcp, timeout_ms) <= 0) {
+      ESP_LOGE(TAG, "TLS write timed out!");
+      return written > 0 ? written : -1;
+    }
+    int ret = mbedtls_ssl_write(&tls->ssl,
+                                (const unsigned char *)buffer + written,
+                                len - written);
+    if (MBEDTLS_ERR_SSL_WANT_READ == ret || MBEDTLS_ERR_SSL_WANT_WRITE == ret) {
+      continue;
+    }
+    if (ret < 0) {
+      ESP_LOGE(TAG, "TLS write failed (-0x%04x)!", -ret);
+      return -1;
+    }
+    written += ret;
+  }
+  return written;
+}
+
+static int mqtt_mgt_tls_poll_read(esp_transport_handle_t t, int timeout_ms) {
+  mqtt_mgt_tls_t *tls = esp_transport_get_context_data(t);
+  // Records already decrypted do not show up on the socket.
+  if (mbedtls_ssl_get_bytes_avail(&tls->ssl) > 0) {
+    return 1;
+  }
+  return esp_transport_poll_read(tls->tcp, timeout_ms);
+}
+
+static int mqtt_mgt_tls_poll_write(esp_transport_handle_t t, int timeout_ms) {
+  mqtt_mgt_tls_t *tls = esp_transport_get_context_data(t);
+  return esp_transport_poll_write(tls->tcp, timeout_ms);
+}
+
+static int mqtt_mgt_tls_close(esp_transport_handle_t t) {
+  mqtt_mgt_tls_t *tls = esp_transport_get_context_data(t);
+  if (tls->net.fd >= 0) {
+    mbedtls_ssl_close_notify(&tls->ssl);
+  }
+  tls->net.fd = -1;
+  return esp_transport_close(tls->tcp);
+}
+
+static int mqtt_mgt_tls_destroy(esp_transport_handle_t t) {
+  mqtt_mgt_tls_t *tls = esp_transport_get_context_data(t);
+  mqtt_mgt_tls_close(t);
+  esp_transport_destroy(tls->tcp);
+  mbedtls_ssl_session_free(&tls->session);
+  mbedtls_ssl_free(&tls->ssl);
+  mbedtls_ssl_config_free(&tls->conf);
+  mbedtls_ctr_drbg_free(&tls->drbg);
+  mbedtls_entropy_free(&tls->entropy);
+#ifdef MQTT_MGT_TLS_CUSTOM_CA
+  mbedtls_x509_crt_free(&tls->ca);
+#endif
+  FREE(tls);
+  return 0;
+}
+
+static bool mqtt_mgt_tls_offer_session(mqtt_mgt_tls_t *tls, const char *host) {
+#if !CONFIG_GPS_TRACKER_MQTT_TLS_SESSION_RESUMPTION
+  return false;
+#else
+#if CONFIG_GPS_TRACKER_MQTT_TLS_SESSION_RTC
+  if (!tls->session_valid && MQTT_MGT_TLS_RTC_MAGIC == g_rtc_session.magic) {
+    // First connection after a deep sleep.
+    if (0 == mbedtls_ssl_session_load(&tls->session, g_rtc_session.data,
+                                      g_rtc_session.len)) {
+      tls->session_valid = true;
+      snprintf(tls->session_host, sizeof(tls->session_host), "%s",
+               g_rtc_session.host);
+    } else {
+      g_rtc_session.magic = 0;
+    }
+  }
+#endif
+  if (!tls->session_valid || 0 != strcmp(tls->session_host, host)) {
+    return false;
+  }
+  return 0 == mbedtls_ssl_set_session(&tls->ssl, &tls->session);
+#endif
+}
+
+static void mqtt_mgt_tls_save_session(mqtt_mgt_tls_t *tls, const char *host) {
+#if CONFIG_GPS_TRACKER_MQTT_TLS_SESSION_RESUMPTION
+  if (strlen(host) >= sizeof(tls->session_host)) {
+    return;
+  }
+  mbedtls_ssl_session_free(&tls->session);
+  mbedtls_ssl_session_init(&tls->session);
+  tls->session_valid = 0 == mbedtls_ssl_get_session(&tls->ssl, &tls->session);
+  if (!tls->session_valid) {
+    return;
+  }
+  snprintf(tls->session_host, sizeof(tls->session_host), "%s", host);
+#if CONFIG_GPS_TRACKER_MQTT_TLS_SESSION_RTC
+  size_t len = 0;
+  g_rtc_session.magic = 0;
+  int ret = mbedtls_ssl_session_save(&tls->session, g_rtc_session.data,
+                                     sizeof(g_rtc_session.data), &len);
+  if (0 != ret) {
+    ESP_LOGW(TAG, "Session does not fit in RTC memory (-0x%04x).", -ret);
+    return;
+  }
+  g_rtc_session.len = (uint16_t)len;
+  snprintf(g_rtc_session.host, sizeof(g_rtc_session.host), "%s", host);
+  g_rtc_session.magic = MQTT_MGT_TLS_RTC_MAGIC;
+#endif
+#endif
+}
+
+static void mqtt_mgt_tls_drop_session(mqtt_mgt_tls_t *tls) {
+  mbedtls_ssl_session_free(&tls->session);
+  mbedtls_ssl_session_init(&tls->session);
+  tls->session_valid = false;
+#if CONFIG_GPS_TRACKER_MQTT_TLS_SESSION_RTC
+  g_rtc_session.magic = 0;
+#endif
+}
@@ -0,0 +1,53 @@
+#ifndef _MQTT_MGT_TLS_H_
+#define _MQTT_MGT_TLS_H_
+
+#include "esp_transport.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * TLS transport for mqtts:// brokers with session resumption.
+ *
+ * esp-mqtt's built-in SSL transport performs a full handshake on every
+ * reconnect. This transport keeps the TLS session of the last successful
+ * handshake and offers it (by session ID or session ticket) on the next
+ * connection to the same host, so a resumed handshake skips certificate
+ * verification and the key exchange. With
+ * CONFIG_GPS_TRACKER_MQTT_TLS_SESSION_RTC the session is also kept in RTC
+ * memory, which survives deep sleep.
+ */
+
+/**
+ * @brief Handshake counters, times and heap use since boot.
+ *
+ * Peak heap is the largest drop in free heap observed during a handshake,
+ * across the whole system.
+ */
+typedef struct mqtt_mgt_tls_stats {
+  uint32_t full;            ///< Completed full handshakes
+  uint32_t resumed;         ///< Completed resumed handshakes
+  uint32_t failed;          ///< Failed handshakes
+  int64_t full_us;          ///< Total time spent in full handshakes
+  int64_t resumed_us;       ///< Total time spent in resumed handshakes
+  size_t full_peak_heap;    ///< Peak heap of a full handshake
+  size_t resumed_peak_heap; ///< Peak heap of a resumed handshake
+} mqtt_mgt_tls_stats_t;
+
+/**
+ * @brief Create the transport; pass it as network.transport to esp-mqtt,
+ *        which destroys it with the client.
+ *
+ * @return The transport, or NULL on failure.
+ */
+esp_transport_handle_t mqtt_mgt_tls_init(void);
+
+/**
+ * @brief Copy the handshake statistics of a transport.
+ *
+ * @param[in]  transport Transport from mqtt_mgt_tls_init().
+ * @param[out] stats     Statistics to fill.
+ */
+void mqtt_mgt_tls_get_stats(esp_transport_handle_t transport,
+                            mqtt_mgt_tls_stats_t *stats);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef _MQTT_MGT_TRANSPORT_H_
+#define _MQTT_MGT_TRANSPORT_H_
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Uplink transports under the mqtt_mgt queue.
+ *
+ * mqtt_mgt queues, batches and duty-cycles; a transport only connects and
+ * sends batches. The MQTT transport lives in mqtt_mgt.c, the UDP transport
+ * (selected by a coap:// broker URL) in mqtt_mgt_udp.c.
+ */
+
+/**
+ * @brief Broker URL scheme that selects the UDP transport.
+ */
+#define MQTT_MGT_UDP_SCHEME "coap://"
+
+/**
+ * @brief Batches of several messages totalling at least this many bytes are
+ *        compressed (see mqtt_mgt_lz.h); 0 disables compression.
+ */
+#define MQTT_MGT_COMPRESS_THRESHOLD (CONFIG_GPS_TRACKER_MQTT_COMPRESS_THRESHOLD)
+
+/**
+ * @brief Structure representing an MQTT message.
+ *
+ * This structure holds a pointer to the message data and its length.
+ */
+typedef struct {
+  char *data; /**< Pointer to the message payload. */
+  size_t len; /**< Length of the message payload in bytes. */
+} mqtt_mgt_msg_t;
+
+/**
+ * @brief Called by a transport when it connects or loses its connection.
+ */
+typedef void (*mqtt_mgt_transport_state_cb_t)(bool connected);
+
+/**
+ * @brief Operations of an uplink transport.
+ */
+typedef struct mqtt_mgt_transport {
+  const char *name;   ///< Name used in logs
+  uint32_t linger_ms; ///< Time to stay connected after a batch before sleeping
+  /// Connect; the state callback reports the connection, possibly before
+  /// this returns.
+  esp_err_t (*start)(void);
+  /// Disconnect.
+  void (*stop)(void);
+  /// Send a batch; messages stay owned by the caller.
+  esp_err_t (*send)(mqtt_mgt_msg_t *const *batch, size_t count, int qos);
+  /// Amount of sent data not yet acknowledged, 0 once everything is.
+  int (*in_flight)(void);
+} mqtt_mgt_transport_t;
+
+/**
+ * @brief Create the UDP transport.
+ *
+ * @param[in] url       Receiver as coap://host[:port].
+ * @param[in] device_id Identifier sent with every frame.
+ * @param[in] on_state  Connection callback.
+ * @return The transport, or NULL on failure.
+ */
+const mqtt_mgt_transport_t *
+mqtt_mgt_udp_init(const char *url, const char *device_id,
+                  mqtt_mgt_transport_state_cb_t on_state);
+
+#endif
@@ -0,0 +1,220 @@
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+#include "mqtt_mgt_frame.h"
+#include "mqtt_mgt_transport.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief Longest receiver host name.
+ */
+#define MQTT_MGT_UDP_HOST_MAX_LEN (64)
+
+/**
+ * @brief Time to keep the radio on after the last frame.
+ *
+ * send() only queues the datagram for the Wi-Fi driver, which drops it if
+ * Wi-Fi stops first. This covers a full frame at the lowest rate, with
+ * retries.
+ */
+#define MQTT_MGT_UDP_LINGER_MS (50)
+
+/********************************************************************************
+ *
+ *                              Type Declarations
+ *
+ ********************************************************************************/
+
+/**
+ * @brief UDP transport state.
+ */
+typedef struct {
+  char host[MQTT_MGT_UDP_HOST_MAX_LEN]; /**< Receiver host. */
+  char port[6];                         /**< Receiver port. */
+  char device_id[MQTT_MGT_FRAME_ID_MAX_LEN + 1]; /**< Sent in every frame. */
+  mqtt_mgt_transport_state_cb_t on_state; /**< Connection callback. */
+  int sock;            /**< Connected datagram socket, or -1. */
+  uint32_t seq;        /**< Sequence number of the next message. */
+  uint16_t message_id; /**< CoAP message ID of the next frame. */
+  uint32_t datagrams;  /**< Datagrams sent since boot. */
+  uint32_t bytes;      /**< Bytes sent since boot, excluding UDP/IP. */
+  uint8_t buf[MQTT_MGT_FRAME_MAX_LEN]; /**< Frame being built. */
+  uint8_t lz_buf[MQTT_MGT_FRAME_MAX_LEN]; /**< Compressed messages. */
+  mqtt_mgt_lz_encoder_t lz;               /**< Compressor of large frames. */
+} mqtt_mgt_udp_t;
+
+/********************************************************************************
+ *
+ *                              Private Function Prototypes
+ *
+ ********************************************************************************/
+
+// Transport operations.
+static esp_err_t mqtt_mgt_udp_start(void);
+static void mqtt_mgt_udp_stop(void);
+static esp_err_t mqtt_mgt_udp_send(mqtt_mgt_msg_t *const *batch, size_t count,
+                                   int qos);
+static int mqtt_mgt_udp_in_flight(void);
+
+/********************************************************************************
+ *
+ *                              Private Global Variables
+ *
+ ********************************************************************************/
+
+// TAG used for logging UDP transport messages
+static char *TAG = "mqtt_mgt_udp";
+
+static mqtt_mgt_udp_t g_udp = {.sock = -1};
+
+static const mqtt_mgt_transport_t g_udp_transport = {
+    .name = "udp",
+    // Nothing is acknowledged and nothing comes back; only lets the last
+    // frame leave.
+    .linger_ms = MQTT_MGT_UDP_LINGER_MS,
+    .start = mqtt_mgt_udp_start,
+    .stop = mqtt_mgt_udp_stop,
+    .send = mqtt_mgt_udp_send,
+    .in_flight = mqtt_mgt_udp_in_flight,
+};
+
+/********************************************************************************
+ *
+ *                              Public Function Definitions
+ *
+ ********************************************************************************/
+const mqtt_mgt_transport_t *
+mqtt_mgt_udp_init(const char *url, const char *device_id,
+                  mqtt_mgt_transport_state_cb_t on_state) {
+  size_t scheme_len = strlen(MQTT_MGT_UDP_SCHEME);
+  if (0 != strncmp(url, MQTT_MGT_UDP_SCHEME, scheme_len)) {
+    ESP_LOGE(TAG, "Receiver URL must start with %s: %s", MQTT_MGT_UDP_SCHEME,
+             url);
+    return NULL;
+  }
+  const char *host = url + scheme_len;
+  size_t host_len = strcspn(host, ":/");
+  unsigned long port = MQTT_MGT_FRAME_DEFAULT_PORT;
+  if (':' == host[host_len]) {
+    char *end = NULL;
+    port = strtoul(host + host_len + 1, &end, 10);
+    if (end == host + host_len + 1 || ('\0' != *end && '/' != *end) ||
+        0 == port || port > UINT16_MAX) {
+      ESP_LOGE(TAG, "Invalid port in %s", url);
+      return NULL;
+    }
+  }
+  if (0 == host_len || host_len >= sizeof(g_udp.host) ||
+      strlen(device_id) > MQTT_MGT_FRAME_ID_MAX_LEN) {
+    ESP_LOGE(TAG, "Invalid receiver URL or device ID!");
+    return NULL;
+  }
+  snprintf(g_udp.host, sizeof(g_udp.host), "%.*s", (int)host_len, host);
+  snprintf(g_udp.port, sizeof(g_udp.port), "%lu", port);
+  snprintf(g_udp.device_id, sizeof(g_udp.device_id), "%s", device_id);
+  g_udp.on_state = on_state;
+  ESP_LOGI(TAG, "Uplink to %s:%s as %s.", g_udp.host, g_udp.port,
+           g_udp.device_id);
+  return &g_udp_transport;
+}
+
+/********************************************************************************
+ *
+ *                              Private Function Definitions
+ *
+ ********************************************************************************/
+static esp_err_t mqtt_mgt_udp_start(void) {
+  if (g_udp.sock < 0) {
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM};
+    struct addrinfo *res = NULL;
+    if (0 != getaddrinfo(g_udp.host, g_udp.port, &hints, &res) ||
+        NULL == res) {
+      ESP_LOGE(TAG, "Failed to resolve %s!", g_udp.host);
+      return ESP_FAIL;
+    }
+    int sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    // Connected, so that every frame goes to the same receiver without a
+    // lookup and ICMP errors are reported.
+    if (sock < 0 || 0 != connect(sock, res->ai_addr, res->ai_addrlen)) {
+      ESP_LOGE(TAG, "Failed to open the socket (errno %d)!", errno);
+      if (sock >= 0) {
+        close(sock);
+      }
+      freeaddrinfo(res);
+      return ESP_FAIL;
+    }
+    freeaddrinfo(res);
+    g_udp.sock = sock;
+  }
+  g_udp.on_state(true);
+  return ESP_OK;
+}
+
+static void mqtt_mgt_udp_stop(void) {
+  if (g_udp.sock >= 0) {
+    close(g_udp.sock);
+    g_udp.sock = -1;
+  }
+}
+
+static esp_err_t mqtt_mgt_udp_send(mqtt_mgt_msg_t *const *batch, size_t count,
+                                   int qos) {
+  // Every datagram is fire-and-forget; losses show up as sequence gaps at
+  // the receiver.
+  (void)qos;
+  esp_err_t ret = ESP_OK;
+  size_t i = 0;
+  while (i < count) {
+    mqtt_mgt_frame_writer_t writer;
+    if (0 != mqtt_mgt_frame_begin(&writer, g_udp.buf, sizeof(g_udp.buf),
+                                  g_udp.device_id, g_udp.message_id,
+                                  g_udp.seq)) {
+      return ESP_FAIL;
+    }
+    while (i < count &&
+           0 == mqtt_mgt_frame_add(&writer, batch[i]->data, batch[i]->len)) {
+      i++;
+    }
+    g_udp.seq += writer.count;
+    if (0 == writer.count) {
+      // Skip it, but keep its number so that the receiver counts it as lost.
+      ESP_LOGE(TAG, "Dropping a %u-byte message, too large for a frame!",
+               (unsigned)batch[i]->len);
+      g_udp.seq++;
+      i++;
+      ret = ESP_ERR_INVALID_SIZE;
+      continue;
+    }
+    size_t raw_len = writer.len - writer.count_pos - 1;
+    if (0 != MQTT_MGT_COMPRESS_THRESHOLD && writer.count > 1 &&
+        raw_len >= MQTT_MGT_COMPRESS_THRESHOLD) {
+      uint32_t cycles = esp_cpu_get_cycle_count();
+      int packed = mqtt_mgt_frame_compress(&writer, &g_udp.lz, g_udp.lz_buf,
+                                           sizeof(g_udp.lz_buf));
+      cycles = esp_cpu_get_cycle_count() - cycles;
+      ESP_LOGD(TAG, "%s %u message(s) of %u bytes in %" PRIu32 " cycles.",
+               packed ? "Compressed" : "Could not compress",
+               (unsigned)writer.count, (unsigned)raw_len, cycles);
+    }
+    g_udp.message_id++;
+    if (g_udp.sock < 0 || send(g_udp.sock, writer.buf, writer.len, 0) < 0) {
+      ESP_LOGE(TAG, "Failed to send %u message(s) (errno %d)!",
+               (unsigned)writer.count, errno);
+      ret = ESP_FAIL;
+      continue;
+    }
+    g_udp.datagrams++;
+    g_udp.bytes += writer.len;
+  }
+  ESP_LOGD(TAG, "%" PRIu32 " datagram(s), %" PRIu32 " byte(s) since boot.",
+           g_udp.datagrams, g_udp.bytes);
+  return ret;
+}
+
+static int mqtt_mgt_udp_in_flight(void) { return 0; }
@@ -2,6 +2,15 @@
 #define _NETWORK_MANAGER_H_
 
 #include "esp_err.h"
+#include <stdint.h>
+
+/**
+ * @brief Cumulative radio usage since boot.
+ */
+typedef struct network_manager_radio_stats {
+  int64_t on_us;  ///< Time Wi-Fi has been started, in microseconds
+  uint32_t wakes; ///< Number of times Wi-Fi has been started
+} network_manager_radio_stats_t;
 
 /**
  * @brief Initialize the network manager.
@@ -17,4 +26,42 @@
  */
 esp_err_t network_manager_init(void);
 
+/**
+ * @brief Start Wi-Fi after network_manager_radio_off() and wait until the
+ *        station has an IP address.
+ *
+ * Does nothing if the radio is already on. Must not be called concurrently
+ * with network_manager_radio_off().
+ *
+ * @param timeout_ms Longest time to wait for the connection.
+ * @return
+ *      - ESP_OK once connected
+ *      - ESP_ERR_TIMEOUT if the station did not connect in time; the radio
+ *        is left on and the caller decides whether to turn it off
+ *      - Appropriate esp_err_t error code otherwise
+ */
+esp_err_t network_manager_radio_on(uint32_t timeout_ms);
+
+/**
+ * @brief Stop Wi-Fi until the next network_manager_radio_on().
+ *
+ * Connections over the station interface are lost; close them first.
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Appropriate esp_err_t error code otherwise
+ */
+esp_err_t network_manager_radio_off(void);
+
+/**
+ * @brief Read the cumulative radio-on time, including the current wake.
+ *
+ * @param[out] stats Statistics to fill.
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if stats is NULL
+ *      - ESP_ERR_INVALID_STATE if not initialized
+ */
+esp_err_t network_manager_get_radio_stats(network_manager_radio_stats_t *stats);
+
 #endif
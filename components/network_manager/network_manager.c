@@ -1,11 +1,13 @@
 #include "network_manager.h"
 #include "esp_check.h"
 #include "esp_netif.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "mqtt_mgt.h"
 #include "nvs_flash.h"
 #include "timestamp.h"
 #include "utils.h"
+#include <stdbool.h>
 #include <string.h>
 
 /**
@@ -44,6 +46,9 @@ typedef struct network_manager {
   esp_netif_t *netif;             /**< Pointer to the network interface */
   wifi_config_t config;           /**< WiFi configuration settings */
   EventGroupHandle_t event_group; /**< Event group handle for WiFi events */
+  bool radio_off;                 /**< Wi-Fi stopped on purpose */
+  int64_t radio_on_since_us;      /**< When Wi-Fi was last started */
+  network_manager_radio_stats_t stats; /**< Radio-on time of past wakes */
 } network_manager_t;
 
 /********************************************************************************
@@ -110,6 +115,7 @@ static void network_manager_ip_event_cb(void *arg, esp_event_base_t event_base,
 
 esp_err_t network_manager_init(void) {
   g_net = MALLOC(sizeof(network_manager_t));
+  memset(g_net, 0, sizeof(network_manager_t));
   g_net->event_group = xEventGroupCreate();
   g_net->netif = esp_netif_create_default_wifi_sta();
 
@@ -137,6 +143,8 @@ esp_err_t network_manager_init(void) {
   ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
   ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &g_net->config));
   ESP_ERROR_CHECK(esp_wifi_set_bandwidth(ESP_IF_WIFI_STA, WIFI_BW_HT20));
+  g_net->radio_on_since_us = esp_timer_get_time();
+  g_net->stats.wakes = 1;
   ESP_ERROR_CHECK(esp_wifi_start());
 
   ESP_LOGI(TAG, "Wifi STA configured successfully.");
@@ -162,6 +170,56 @@ esp_err_t network_manager_init(void) {
   return ESP_OK;
 }
 
+esp_err_t network_manager_radio_on(uint32_t timeout_ms) {
+  ESP_RETURN_ON_FALSE(NULL != g_net, ESP_ERR_INVALID_STATE, TAG,
+                      "network_manager is not initialized!");
+  if (!g_net->radio_off) {
+    return ESP_OK;
+  }
+  xEventGroupClearBits(g_net->event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
+  g_retry_count = 0;
+  g_net->radio_off = false;
+  g_net->radio_on_since_us = esp_timer_get_time();
+  g_net->stats.wakes++;
+  ESP_RETURN_ON_ERROR(esp_wifi_start(), TAG, "Failed to start Wi-Fi!");
+
+  EventBits_t bits = xEventGroupWaitBits(
+      g_net->event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT, pdFALSE, pdFALSE,
+      pdMS_TO_TICKS(timeout_ms));
+  if (!(bits & WIFI_CONNECTED_BIT)) {
+    ESP_LOGE(TAG, "Wi-Fi did not connect within %" PRIu32 " ms!", timeout_ms);
+    return ESP_ERR_TIMEOUT;
+  }
+  return ESP_OK;
+}
+
+esp_err_t network_manager_radio_off(void) {
+  ESP_RETURN_ON_FALSE(NULL != g_net, ESP_ERR_INVALID_STATE, TAG,
+                      "network_manager is not initialized!");
+  if (g_net->radio_off) {
+    return ESP_OK;
+  }
+  // Set first so that the disconnect event does not try to reconnect.
+  g_net->radio_off = true;
+  esp_err_t ret = esp_wifi_stop();
+  g_net->stats.on_us += esp_timer_get_time() - g_net->radio_on_since_us;
+  xEventGroupClearBits(g_net->event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
+  return ret;
+}
+
+esp_err_t
+network_manager_get_radio_stats(network_manager_radio_stats_t *stats) {
+  ESP_RETURN_ON_FALSE(NULL != stats, ESP_ERR_INVALID_ARG, TAG,
+                      "stats is NULL!");
+  ESP_RETURN_ON_FALSE(NULL != g_net, ESP_ERR_INVALID_STATE, TAG,
+                      "network_manager is not initialized!");
+  *stats = g_net->stats;
+  if (!g_net->radio_off) {
+    stats->on_us += esp_timer_get_time() - g_net->radio_on_since_us;
+  }
+  return ESP_OK;
+}
+
 /********************************************************************************
  *
  *                              Private Function Definitions
@@ -178,6 +236,11 @@ static void network_manager_wifi_event_cb(void *arg,
     break;
   }
   case WIFI_EVENT_STA_DISCONNECTED: {
+    xEventGroupClearBits(g_net->event_group, WIFI_CONNECTED_BIT);
+    if (g_net->radio_off) {
+      ESP_LOGI(TAG, "Wi-Fi stopped.");
+      break;
+    }
     ESP_LOGE(TAG, "WIFI_EVENT_STA_DISCONNECTED!");
     if (g_retry_count < NETWORK_MANAGER_MAXIMUM_RETRY) {
       ESP_ERROR_CHECK(esp_wifi_connect());
@@ -2,6 +2,7 @@
 #define _PAYLOAD_H_
 
 #include "esp_err.h"
+#include "payload_filter.h"
 
 /**
  * @brief Initialize the payload generator module.
@@ -12,4 +13,18 @@
  */
 esp_err_t payload_init(void);
 
+/**
+ * @brief Get the current position estimate.
+ *
+ * Between fixes the position is dead-reckoned from the last filtered fix
+ * along the estimated velocity.
+ *
+ * @param[out] estimate Position, speed, heading and accuracy now.
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if estimate is NULL
+ *      - ESP_ERR_INVALID_STATE if no fix has been filtered yet
+ */
+esp_err_t payload_get_position(payload_filter_estimate_t *estimate);
+
 #endif
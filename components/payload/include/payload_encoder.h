@@ -0,0 +1,147 @@
+#ifndef _PAYLOAD_ENCODER_H_
+#define _PAYLOAD_ENCODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * This header is deliberately free of ESP-IDF dependencies so that the exact
+ * encoder used by the firmware can also be compiled into host-side tools
+ * (see tools/loadgen).
+ */
+
+/**
+ * @brief Version of the fix encoding, sent as "v" in JSON messages.
+ *
+ * Version 1 (no "v") carried 16-bit coordinates, about 300 m per step.
+ */
+#define PAYLOAD_ENCODER_VERSION (2)
+
+/**
+ * @brief Length of the hex-encoded fix string, including the null terminator.
+ *
+ * Format: LAT (8) + LNG (8) + SPEED (4) + HEADING (4) + BAT (2) + NULL (1).
+ */
+#define PAYLOAD_ENCODER_HEX_LEN (27)
+
+/**
+ * @brief Maximum length of a single JSON-encoded payload message.
+ */
+#define PAYLOAD_ENCODER_MSG_MAX_LEN (128)
+
+/**
+ * @brief Length of a binary-encoded fix.
+ *
+ * Format: TYPE (1) + LAT (4) + LNG (4) + SPEED (2) + HEADING (2) + BAT (1) +
+ * TIME (4), all big endian.
+ */
+#define PAYLOAD_ENCODER_BIN_LEN (18)
+
+/**
+ * @brief First byte of a binary-encoded fix.
+ *
+ * JSON messages sent alongside (e.g. geofence events) start with '{'.
+ */
+#define PAYLOAD_ENCODER_BIN_TYPE_FIX (0x01)
+
+/**
+ * @brief A single position fix in its on-wire representation.
+ */
+typedef struct payload_fix {
+  int32_t lat_e7;        ///< Latitude in 1e-7 degrees
+  int32_t lng_e7;        ///< Longitude in 1e-7 degrees
+  uint16_t speed_cm_s;   ///< Ground speed, saturated; 0 if unknown
+  uint16_t heading_cdeg; ///< Course in 0.01 degrees from north; 0 if unknown
+  uint8_t bat;           ///< Battery level mapped from [0, 100] to [0, 255]
+} payload_fix_t;
+
+/**
+ * @brief Fill a fix from coordinates in 1e-7 degrees, without motion.
+ *
+ * Out-of-range inputs are clamped to the representable range. Speed and
+ * heading are set to 0; set them afterwards if known.
+ *
+ * @param[out] fix     Fix to fill.
+ * @param[in]  lat_e7  Latitude in 1e-7 degrees.
+ * @param[in]  lng_e7  Longitude in 1e-7 degrees.
+ * @param[in]  battery Battery level in percent.
+ */
+void payload_fix_from_e7(payload_fix_t *fix, int32_t lat_e7, int32_t lng_e7,
+                         float battery);
+
+/**
+ * @brief Fill a fix from coordinates in degrees, without motion.
+ *
+ * Same as payload_fix_from_e7(); a float only resolves about 1 m at these
+ * magnitudes, so prefer payload_fix_from_e7() for measured positions.
+ *
+ * @param[out] fix       Fix to fill.
+ * @param[in]  latitude  Latitude in degrees.
+ * @param[in]  longitude Longitude in degrees.
+ * @param[in]  battery   Battery level in percent.
+ */
+void payload_fix_from_degrees(payload_fix_t *fix, float latitude,
+                              float longitude, float battery);
+
+/**
+ * @brief Convert a fix back to degrees and percent.
+ *
+ * Any of the output pointers may be NULL.
+ *
+ * @param[in]  fix       Fix to convert.
+ * @param[out] latitude  Latitude in degrees.
+ * @param[out] longitude Longitude in degrees.
+ * @param[out] battery   Battery level in percent.
+ */
+void payload_fix_to_degrees(const payload_fix_t *fix, float *latitude,
+                            float *longitude, float *battery);
+
+/**
+ * @brief Encode a fix as the "LLLLLLLLGGGGGGGGSSSSHHHHBB" hex string.
+ *
+ * Coordinates are two's complement.
+ *
+ * @param[in]  fix Fix to encode.
+ * @param[out] out Buffer of at least PAYLOAD_ENCODER_HEX_LEN bytes.
+ */
+void payload_encode_hex(const payload_fix_t *fix,
+                        char out[PAYLOAD_ENCODER_HEX_LEN]);
+
+/**
+ * @brief Encode a fix as the JSON message published on the egress topic.
+ *
+ * @param[out] buf  Output buffer.
+ * @param[in]  size Size of the output buffer in bytes.
+ * @param[in]  id   Device identifier.
+ * @param[in]  fix  Fix to encode.
+ * @param[in]  date Date string ("YYYY-MM-DD").
+ * @param[in]  time Time string ("HH:MM:SS").
+ * @return Length of the message excluding the null terminator, or -1 if the
+ *         buffer is too small.
+ */
+int payload_encode_json(char *buf, size_t size, const char *id,
+                        const payload_fix_t *fix, const char *date,
+                        const char *time);
+
+/**
+ * @brief Encode a fix as the compact binary record sent over the UDP uplink.
+ *
+ * @param[out] out    Buffer of at least PAYLOAD_ENCODER_BIN_LEN bytes.
+ * @param[in]  fix    Fix to encode.
+ * @param[in]  time_s Time of the fix in seconds since the Unix epoch (UTC).
+ */
+void payload_encode_binary(uint8_t out[PAYLOAD_ENCODER_BIN_LEN],
+                           const payload_fix_t *fix, uint32_t time_s);
+
+/**
+ * @brief Decode a record written by payload_encode_binary().
+ *
+ * @param[in]  in     Record of PAYLOAD_ENCODER_BIN_LEN bytes.
+ * @param[out] fix    Decoded fix.
+ * @param[out] time_s Time of the fix in seconds since the Unix epoch (UTC).
+ * @return 0 on success, -1 if the record is not a fix.
+ */
+int payload_decode_binary(const uint8_t in[PAYLOAD_ENCODER_BIN_LEN],
+                          payload_fix_t *fix, uint32_t *time_s);
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef _PAYLOAD_FILTER_H_
+#define _PAYLOAD_FILTER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Fixed-point constant-velocity Kalman filter for position fixes.
+ *
+ * Fixes are projected onto a local north/east plane around an origin that
+ * follows the device. Both axes share one 2x2 covariance (position and
+ * velocity), since they see the same process and measurement noise, so an
+ * update costs a handful of 32/64-bit integer operations and no floating
+ * point. The covariance is 64-bit so that it can grow across long gaps
+ * between fixes without saturating.
+ *
+ * Units: coordinates in 1e-7 degrees, state in millimeters and mm/s,
+ * covariance in cm^2, cm^2/s and cm^2/s^2, time in milliseconds.
+ *
+ * Like payload_encoder.h, this header has no ESP-IDF dependencies so that the
+ * filter can be benchmarked on the host (see tools/bench).
+ */
+
+#if defined(ESP_PLATFORM)
+#include "sdkconfig.h"
+#endif
+
+/**
+ * @brief Default 1-sigma GNSS error per axis in centimeters.
+ */
+#ifndef PAYLOAD_FILTER_MEAS_SIGMA_CM
+#ifdef CONFIG_GPS_TRACKER_PAYLOAD_FILTER_MEAS_SIGMA_CM
+#define PAYLOAD_FILTER_MEAS_SIGMA_CM (CONFIG_GPS_TRACKER_PAYLOAD_FILTER_MEAS_SIGMA_CM)
+#else
+#define PAYLOAD_FILTER_MEAS_SIGMA_CM (500)
+#endif
+#endif
+
+/**
+ * @brief Default 1-sigma acceleration (process noise) in cm/s^2.
+ */
+#ifndef PAYLOAD_FILTER_ACCEL_SIGMA_CM_S2
+#ifdef CONFIG_GPS_TRACKER_PAYLOAD_FILTER_ACCEL_SIGMA_CM_S2
+#define PAYLOAD_FILTER_ACCEL_SIGMA_CM_S2                                       \
+  (CONFIG_GPS_TRACKER_PAYLOAD_FILTER_ACCEL_SIGMA_CM_S2)
+#else
+#define PAYLOAD_FILTER_ACCEL_SIGMA_CM_S2 (200)
+#endif
+#endif
+
+/**
+ * @brief Default outlier gate, in standard deviations of the innovation.
+ */
+#ifndef PAYLOAD_FILTER_GATE_SIGMA
+#ifdef CONFIG_GPS_TRACKER_PAYLOAD_FILTER_GATE_SIGMA
+#define PAYLOAD_FILTER_GATE_SIGMA (CONFIG_GPS_TRACKER_PAYLOAD_FILTER_GATE_SIGMA)
+#else
+#define PAYLOAD_FILTER_GATE_SIGMA (5)
+#endif
+#endif
+
+/**
+ * @brief Default number of consecutive outliers after which the filter
+ *        restarts from the latest fix.
+ */
+#ifndef PAYLOAD_FILTER_MAX_OUTLIERS
+#ifdef CONFIG_GPS_TRACKER_PAYLOAD_FILTER_MAX_OUTLIERS
+#define PAYLOAD_FILTER_MAX_OUTLIERS (CONFIG_GPS_TRACKER_PAYLOAD_FILTER_MAX_OUTLIERS)
+#else
+#define PAYLOAD_FILTER_MAX_OUTLIERS (3)
+#endif
+#endif
+
+/**
+ * @brief Longest gap between fixes bridged by the filter; longer gaps restart
+ *        it.
+ */
+#define PAYLOAD_FILTER_MAX_GAP_MS (600000)
+
+/**
+ * @brief Filter tuning.
+ */
+typedef struct payload_filter_config {
+  uint16_t meas_sigma_cm;      ///< GNSS error per axis (1 sigma)
+  uint16_t accel_sigma_cm_s2;  ///< Unmodelled acceleration (1 sigma)
+  uint16_t init_speed_sigma_cm_s; ///< Velocity uncertainty after a restart
+  uint8_t gate_sigma;          ///< Innovation gate for outliers
+  uint8_t max_outliers;        ///< Consecutive outliers before a restart
+} payload_filter_config_t;
+
+/**
+ * @brief Default configuration from Kconfig.
+ */
+#define PAYLOAD_FILTER_CONFIG_DEFAULT()                                        \
+  {                                                                            \
+      .meas_sigma_cm = PAYLOAD_FILTER_MEAS_SIGMA_CM,                           \
+      .accel_sigma_cm_s2 = PAYLOAD_FILTER_ACCEL_SIGMA_CM_S2,                   \
+      .init_speed_sigma_cm_s = 3000,                                           \
+      .gate_sigma = PAYLOAD_FILTER_GATE_SIGMA,                                 \
+      .max_outliers = PAYLOAD_FILTER_MAX_OUTLIERS,                             \
+  }
+
+/**
+ * @brief Outcome of feeding a fix to the filter.
+ */
+typedef enum {
+  PAYLOAD_FILTER_STARTED,  ///< First fix or restart after a long gap
+  PAYLOAD_FILTER_ACCEPTED, ///< Fix fused into the estimate
+  PAYLOAD_FILTER_OUTLIER,  ///< Fix rejected; estimate is the prediction
+  PAYLOAD_FILTER_RESTARTED, ///< Too many outliers; restarted from this fix
+} payload_filter_result_t;
+
+/**
+ * @brief Position and motion estimate.
+ */
+typedef struct payload_filter_estimate {
+  int32_t lat_e7;        ///< Latitude in 1e-7 degrees
+  int32_t lng_e7;        ///< Longitude in 1e-7 degrees
+  uint32_t speed_mm_s;   ///< Ground speed in mm/s
+  uint16_t heading_cdeg; ///< Course over ground in 0.01 degrees from north
+  uint32_t accuracy_cm;  ///< Position uncertainty per axis (1 sigma)
+} payload_filter_estimate_t;
+
+/**
+ * @brief Filter state; all storage is inline.
+ */
+typedef struct payload_filter {
+  payload_filter_config_t config; ///< Tuning
+  int32_t lat0_e7;      ///< Origin of the local plane
+  int32_t lng0_e7;      ///< Origin of the local plane
+  int32_t lng_mm_q16;   ///< Millimeters per 1e-7 degree of longitude, Q16
+  int32_t pos_mm[2];    ///< North, east position
+  int32_t vel_mm_s[2];  ///< North, east velocity
+  int64_t p_pp;         ///< Position variance (cm^2)
+  int64_t p_pv;         ///< Position/velocity covariance (cm^2/s)
+  int64_t p_vv;         ///< Velocity variance (cm^2/s^2)
+  uint32_t t_ms;        ///< Time of the last fix
+  uint8_t outliers;     ///< Consecutive outliers so far
+  bool started;         ///< At least one fix was seen
+} payload_filter_t;
+
+/**
+ * @brief Initialize a filter.
+ *
+ * @param filter Filter to initialize.
+ * @param config Tuning, or NULL for PAYLOAD_FILTER_CONFIG_DEFAULT().
+ */
+void payload_filter_init(payload_filter_t *filter,
+                         const payload_filter_config_t *config);
+
+/**
+ * @brief Feed a fix to the filter.
+ *
+ * @param[in]  filter   Filter to update.
+ * @param[in]  t_ms     Time of the fix (wrapping millisecond clock).
+ * @param[in]  lat_e7   Latitude in 1e-7 degrees.
+ * @param[in]  lng_e7   Longitude in 1e-7 degrees.
+ * @param[out] estimate Estimate at t_ms, may be NULL.
+ * @return What the filter did with the fix.
+ */
+payload_filter_result_t
+payload_filter_update(payload_filter_t *filter, uint32_t t_ms, int32_t lat_e7,
+                      int32_t lng_e7, payload_filter_estimate_t *estimate);
+
+/**
+ * @brief Estimate the position at any time without changing the filter.
+ *
+ * Times after the last fix are dead-reckoned along the current velocity and
+ * their accuracy grows accordingly.
+ *
+ * @param[in]  filter   Filter that has seen at least one fix.
+ * @param[in]  t_ms     Time of the estimate.
+ * @param[out] estimate Estimate at t_ms.
+ * @return false if the filter has not been started.
+ */
+bool payload_filter_predict(const payload_filter_t *filter, uint32_t t_ms,
+                            payload_filter_estimate_t *estimate);
+
+#endif
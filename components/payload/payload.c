@@ -1,15 +1,23 @@
 #include "payload.h"
 #include "esp_check.h"
+#include "esp_cpu.h"
 #include "esp_log.h"
 #include "esp_random.h"
 #include "esp_sntp.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
+#include "geofence.h"
 #include "mqtt_mgt.h"
+#include "payload_encoder.h"
+#include "payload_filter.h"
+#include "runtime_config.h"
 #include "timestamp.h"
 #include "utils.h"
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <time.h>
 
 /**
  * @brief Size of the payload task stack in bytes.
@@ -22,21 +30,32 @@
 #define PAYLOAD_TASK_PRIORITY (tskIDLE_PRIORITY + 2)
 
 /**
- * @brief Interval in milliseconds between payload generations.
+ * @brief Maximum size of the payload message in bytes.
  */
-#define PAYLOAD_GENERATION_INTERVAL_MS                                         \
-  (CONFIG_GPS_TRACKER_PAYLOAD_GEN_INTERVAL_MS)
+#define PAYLOAD_MSG_SIZE (PAYLOAD_ENCODER_MSG_MAX_LEN)
 
 /**
- * @brief Size of the payload data in bytes (LNG (4) + LAT (4) + BAT (2) + NULL
- * (1)).
+ * @brief Starting point of the simulated track (1e-7 degrees).
  */
-#define PAYLOAD_DATA_SIZE (11)
+#define PAYLOAD_SIM_LAT0_E7 (137563000)
+#define PAYLOAD_SIM_LNG0_E7 (1005018000)
 
 /**
- * @brief Maximum size of the payload message in bytes.
+ * @brief Millimeters per 1e-7 degree at the start of the simulated track,
+ *        scaled by 1000.
+ */
+#define PAYLOAD_SIM_LAT_MM_X1000 (11132)
+#define PAYLOAD_SIM_LNG_MM_X1000 (10813)
+
+/**
+ * @brief Maximum speed of the simulated track in mm/s.
+ */
+#define PAYLOAD_SIM_MAX_SPEED_MM_S (20000)
+
+/**
+ * @brief Maximum GNSS error added to simulated fixes in mm, per axis.
  */
-#define PAYLOAD_MSG_SIZE (100)
+#define PAYLOAD_SIM_NOISE_MM (5000)
 
 /********************************************************************************
  *
@@ -64,6 +83,22 @@ static char *TAG = "payload";
  */
 static char g_msg[PAYLOAD_MSG_SIZE] = {0};
 
+/**
+ * @brief Position filter fed by the payload task.
+ */
+static payload_filter_t g_filter;
+
+/**
+ * @brief Guards g_filter between the payload task and position queries.
+ */
+static SemaphoreHandle_t g_filter_lock = NULL;
+
+/**
+ * @brief State of the simulated track: north/east position and velocity.
+ */
+static int32_t g_sim_pos_mm[2] = {0};
+static int32_t g_sim_vel_mm_s[2] = {PAYLOAD_SIM_MAX_SPEED_MM_S / 2, 0};
+
 /********************************************************************************
  *
  *                              Private Function Prototypes
@@ -80,70 +115,214 @@ static char g_msg[PAYLOAD_MSG_SIZE] = {0};
  */
 static void payload_task_entry(void *user_ctx);
 
+/**
+ * @brief Wake the payload task so that a new configuration applies now
+ *        rather than after the current interval.
+ */
+static void payload_on_config(const runtime_config_t *config);
+
+#if CONFIG_GPS_TRACKER_PAYLOAD_FILTER
+/**
+ * @brief Copy the runtime filter tuning into g_filter if it changed.
+ */
+static void payload_apply_filter_config(const runtime_config_t *config);
+#endif
+
+/**
+ * @brief Produce the next simulated GNSS fix.
+ *
+ * Stands in for a GNSS receiver: a vehicle wandering around the start point
+ * with a few meters of noise on every fix.
+ *
+ * @param[in]  dt_ms  Time since the previous fix.
+ * @param[out] lat_e7 Latitude in 1e-7 degrees.
+ * @param[out] lng_e7 Longitude in 1e-7 degrees.
+ */
+static void payload_simulate_fix(uint32_t dt_ms, int32_t *lat_e7,
+                                 int32_t *lng_e7);
+
+/**
+ * @brief Uniform random integer in [-range, range].
+ */
+static int32_t payload_random_range(int32_t range);
+
 /********************************************************************************
  *
  *                              Public Function Definitions
  *
  ********************************************************************************/
 esp_err_t payload_init(void) {
+  g_filter_lock = xSemaphoreCreateMutex();
+  ESP_RETURN_ON_FALSE(NULL != g_filter_lock, ESP_ERR_NO_MEM, TAG,
+                      "Failed to create the filter lock!");
+  payload_filter_init(&g_filter, NULL);
+
   BaseType_t ret = xTaskCreatePinnedToCore(
       payload_task_entry, "payload_task", PAYLOAD_TASK_SIZE, NULL,
       PAYLOAD_TASK_PRIORITY, &g_payload_task_handle, 1);
   if (pdPASS != ret) {
     ESP_LOGE(TAG, "Failed to create payload task!");
   }
+  ESP_RETURN_ON_ERROR(runtime_config_add_listener(payload_on_config), TAG,
+                      "Failed to register the config listener!");
   ESP_LOGI(TAG, "Payload generation has started successfully.");
   return ESP_OK;
 }
 
+esp_err_t payload_get_position(payload_filter_estimate_t *estimate) {
+  ESP_RETURN_ON_FALSE(NULL != estimate, ESP_ERR_INVALID_ARG, TAG,
+                      "estimate is NULL!");
+  ESP_RETURN_ON_FALSE(NULL != g_filter_lock, ESP_ERR_INVALID_STATE, TAG,
+                      "payload is not initialized!");
+  uint32_t now_ms = pdTICKS_TO_MS(xTaskGetTickCount());
+  xSemaphoreTake(g_filter_lock, portMAX_DELAY);
+  bool started = payload_filter_predict(&g_filter, now_ms, estimate);
+  xSemaphoreGive(g_filter_lock);
+  return started ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
 /********************************************************************************
  *
  *                              Private Function Definitions
  *
  ********************************************************************************/
 static void payload_task_entry(void *user_ctx) {
+  runtime_config_t config;
+  TickType_t last_tick = xTaskGetTickCount();
   while (true) {
-    uint16_t lat = (uint16_t)esp_random();
-    uint16_t lng = (uint16_t)esp_random();
-    uint8_t bat_percent = (uint8_t)esp_random();
-    ESP_LOGI(TAG, ">>>>>>> PAYLOAD MESSAGE <<<<<<<<");
+    runtime_config_get(&config);
+#if CONFIG_GPS_TRACKER_PAYLOAD_FILTER
+    payload_apply_filter_config(&config);
+#endif
 
-    // Map raw 16-bit to real-world coordinates
-    float latitude = ((float)lat / 65535.0) * 180.0 - 90.0;   // -90° to +90°
-    float longitude = ((float)lng / 65535.0) * 360.0 - 180.0; // -180° to +180°
-    float battery = ((float)bat_percent / 255.0) * 100.0;     // 0-100%
-
-    ESP_LOGI(TAG, "Latitude: %.3f", latitude);
-    ESP_LOGI(TAG, "Logitude: %.3f", longitude);
-    ESP_LOGI(TAG, "Battery Percentage: %.3f", battery);
+    TickType_t tick = xTaskGetTickCount();
+    int32_t lat_e7, lng_e7;
+    payload_simulate_fix(pdTICKS_TO_MS(tick - last_tick), &lat_e7, &lng_e7);
+    last_tick = tick;
+    float battery = (float)(esp_random() % 10001) / 100.0f;
+    ESP_LOGI(TAG, ">>>>>>> PAYLOAD MESSAGE <<<<<<<<");
+    payload_fix_t fix;
 
-    char payload[PAYLOAD_DATA_SIZE] = {0};
+#if CONFIG_GPS_TRACKER_PAYLOAD_FILTER
+    payload_filter_estimate_t estimate;
+    uint32_t now_ms = pdTICKS_TO_MS(xTaskGetTickCount());
+    xSemaphoreTake(g_filter_lock, portMAX_DELAY);
+    uint32_t cycles = esp_cpu_get_cycle_count();
+    payload_filter_result_t result =
+        payload_filter_update(&g_filter, now_ms, lat_e7, lng_e7, &estimate);
+    cycles = esp_cpu_get_cycle_count() - cycles;
+    xSemaphoreGive(g_filter_lock);
+    ESP_LOGD(TAG, "Filter update took %" PRIu32 " cycles.", cycles);
 
-    sprintf(payload, "%04X%04X%02X", lat, lng, bat_percent);
-    ESP_LOGD(TAG, "Payload: %s", payload);
+    if (PAYLOAD_FILTER_OUTLIER == result) {
+      ESP_LOGW(TAG, "Outlier fix rejected.");
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(config.interval_ms));
+      continue;
+    }
+    // The estimate goes on the wire at full resolution, motion included.
+    payload_fix_from_e7(&fix, estimate.lat_e7, estimate.lng_e7, battery);
+    uint32_t speed_cm_s = estimate.speed_mm_s / 10;
+    fix.speed_cm_s = speed_cm_s > UINT16_MAX ? UINT16_MAX : speed_cm_s;
+    fix.heading_cdeg = estimate.heading_cdeg;
+    ESP_LOGI(TAG, "Speed: %.1f m/s, Heading: %.1f, Accuracy: %.1f m",
+             estimate.speed_mm_s / 1000.0f, estimate.heading_cdeg / 100.0f,
+             estimate.accuracy_cm / 100.0f);
+#else
+    payload_fix_from_e7(&fix, lat_e7, lng_e7, battery);
+#endif
 
-    int offset = 0;
-    offset += snprintf(g_msg + offset, sizeof(g_msg) - offset, "{\n");
-    offset += snprintf(g_msg + offset, sizeof(g_msg) - offset,
-                       "\"id\": \"%s\",\n", UTILS_DEVICE_ID);
-    offset += snprintf(g_msg + offset, sizeof(g_msg) - offset,
-                       "\"payload\": \"%s\",\n", payload);
+    float latitude, longitude;
+    payload_fix_to_degrees(&fix, &latitude, &longitude, NULL);
+    ESP_LOGI(TAG, "Latitude: %.7f", fix.lat_e7 / 1e7);
+    ESP_LOGI(TAG, "Logitude: %.7f", fix.lng_e7 / 1e7);
+    ESP_LOGI(TAG, "Battery Percentage: %.3f", battery);
 
     timestamp_t timestamp;
     if (ESP_OK != timestamp_now(&timestamp)) {
       ESP_LOGE(TAG, "Failed to get current timestamp!");
     }
-    offset += snprintf(g_msg + offset, sizeof(g_msg) - offset,
-                       "\"date\": \"%s\",\n", timestamp.date);
-    offset += snprintf(g_msg + offset, sizeof(g_msg) - offset,
-                       "\"time\": \"%s\"\n", timestamp.time);
-    offset += snprintf(g_msg + offset, sizeof(g_msg) - offset, "}\n");
-
-    ESP_LOGI(TAG, "%s", g_msg);
-    if (ESP_OK != mqtt_mgt_queue_msg(g_msg, strlen(g_msg))) {
-      ESP_LOGE(TAG, "Failed to queue the payload!");
+
+    bool suppress = false;
+    if (ESP_OK !=
+        geofence_process_fix(latitude, longitude, &timestamp, &suppress)) {
+      ESP_LOGE(TAG, "Failed to evaluate geofences!");
+    }
+
+    bool datagram = mqtt_mgt_is_datagram();
+    int len;
+    if (datagram) {
+      // The UDP uplink carries the device ID per frame and the time as epoch
+      // seconds.
+      payload_encode_binary((uint8_t *)g_msg, &fix, (uint32_t)time(NULL));
+      len = PAYLOAD_ENCODER_BIN_LEN;
+    } else {
+      len = payload_encode_json(g_msg, sizeof(g_msg), UTILS_DEVICE_ID, &fix,
+                                timestamp.date, timestamp.time);
+    }
+    if (suppress) {
+      ESP_LOGD(TAG, "Inside a fence, raw fix suppressed.");
+    } else if (len < 0) {
+      ESP_LOGE(TAG, "Payload message does not fit in the buffer!");
+    } else {
+      if (!datagram) {
+        ESP_LOGI(TAG, "%s", g_msg);
+      }
+      if (ESP_OK != mqtt_mgt_queue_msg(g_msg, len)) {
+        ESP_LOGE(TAG, "Failed to queue the payload!");
+      }
     }
-    vTaskDelay(pdMS_TO_TICKS(PAYLOAD_GENERATION_INTERVAL_MS));
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(config.interval_ms));
   }
   vTaskDelete(NULL);
 }
+
+static void payload_on_config(const runtime_config_t *config) {
+  (void)config;
+  if (NULL != g_payload_task_handle) {
+    xTaskNotifyGive(g_payload_task_handle);
+  }
+}
+
+#if CONFIG_GPS_TRACKER_PAYLOAD_FILTER
+static void payload_apply_filter_config(const runtime_config_t *config) {
+  xSemaphoreTake(g_filter_lock, portMAX_DELAY);
+  payload_filter_config_t *current = &g_filter.config;
+  if (current->meas_sigma_cm != config->filter_meas_sigma_cm ||
+      current->accel_sigma_cm_s2 != config->filter_accel_sigma_cm_s2 ||
+      current->gate_sigma != config->filter_gate_sigma ||
+      current->max_outliers != config->filter_max_outliers) {
+    // Only the tuning changes; the estimate carries on from its current state.
+    current->meas_sigma_cm = config->filter_meas_sigma_cm;
+    current->accel_sigma_cm_s2 = config->filter_accel_sigma_cm_s2;
+    current->gate_sigma = config->filter_gate_sigma;
+    current->max_outliers = config->filter_max_outliers;
+    ESP_LOGI(TAG, "Filter retuned.");
+  }
+  xSemaphoreGive(g_filter_lock);
+}
+#endif
+
+static void payload_simulate_fix(uint32_t dt_ms, int32_t *lat_e7,
+                                 int32_t *lng_e7) {
+  for (int axis = 0; axis < 2; axis++) {
+    // Wander: nudge the velocity by up to 1 m/s per fix.
+    int32_t vel = g_sim_vel_mm_s[axis] + payload_random_range(1000);
+    if (vel > PAYLOAD_SIM_MAX_SPEED_MM_S) {
+      vel = PAYLOAD_SIM_MAX_SPEED_MM_S;
+    } else if (vel < -PAYLOAD_SIM_MAX_SPEED_MM_S) {
+      vel = -PAYLOAD_SIM_MAX_SPEED_MM_S;
+    }
+    g_sim_vel_mm_s[axis] = vel;
+    g_sim_pos_mm[axis] += (int32_t)((int64_t)vel * dt_ms / 1000);
+  }
+  int32_t north = g_sim_pos_mm[0] + payload_random_range(PAYLOAD_SIM_NOISE_MM);
+  int32_t east = g_sim_pos_mm[1] + payload_random_range(PAYLOAD_SIM_NOISE_MM);
+  *lat_e7 = PAYLOAD_SIM_LAT0_E7 +
+            (int32_t)((int64_t)north * 1000 / PAYLOAD_SIM_LAT_MM_X1000);
+  *lng_e7 = PAYLOAD_SIM_LNG0_E7 +
+            (int32_t)((int64_t)east * 1000 / PAYLOAD_SIM_LNG_MM_X1000);
+}
+
+static int32_t payload_random_range(int32_t range) {
+  return (int32_t)(esp_random() % (uint32_t)(2 * range + 1)) - range;
+}
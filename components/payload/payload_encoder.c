@@ -0,0 +1,176 @@
+#include "payload_encoder.h"
+#include <inttypes.h>
+#include <stdio.h>
+
+/**
+ * @brief Largest latitude and longitude in 1e-7 degrees.
+ */
+#define PAYLOAD_LAT_MAX_E7 (900000000)
+#define PAYLOAD_LNG_MAX_E7 (1800000000)
+
+/********************************************************************************
+ *
+ *                              Private Function Prototypes
+ *
+ ********************************************************************************/
+
+/**
+ * @brief Map a value from [min, max] onto [0, scale], clamping and rounding.
+ */
+static uint32_t payload_quantize(float value, float min, float max,
+                                 uint32_t scale);
+
+/**
+ * @brief Convert degrees to 1e-7 degrees, clamping to [-max, max] first so
+ *        that the conversion cannot overflow.
+ */
+static int32_t payload_degrees_to_e7(float degrees, float max);
+
+/**
+ * @brief Clamp a coordinate to [-max, max].
+ */
+static int32_t payload_clamp(int32_t value, int32_t max);
+
+/**
+ * @brief Write a big-endian 32-bit value.
+ */
+static void payload_put_u32(uint8_t *out, uint32_t value);
+
+/**
+ * @brief Read a big-endian 32-bit value.
+ */
+static uint32_t payload_get_u32(const uint8_t *in);
+
+/********************************************************************************
+ *
+ *                              Public Function Definitions
+ *
+ ********************************************************************************/
+void payload_fix_from_e7(payload_fix_t *fix, int32_t lat_e7, int32_t lng_e7,
+                         float battery) {
+  fix->lat_e7 = payload_clamp(lat_e7, PAYLOAD_LAT_MAX_E7);
+  fix->lng_e7 = payload_clamp(lng_e7, PAYLOAD_LNG_MAX_E7);
+  fix->speed_cm_s = 0;
+  fix->heading_cdeg = 0;
+  fix->bat = (uint8_t)payload_quantize(battery, 0.0f, 100.0f, 255);
+}
+
+void payload_fix_from_degrees(payload_fix_t *fix, float latitude,
+                              float longitude, float battery) {
+  payload_fix_from_e7(fix, payload_degrees_to_e7(latitude, 90.0f),
+                      payload_degrees_to_e7(longitude, 180.0f), battery);
+}
+
+void payload_fix_to_degrees(const payload_fix_t *fix, float *latitude,
+                            float *longitude, float *battery) {
+  if (latitude) {
+    *latitude = (float)(fix->lat_e7 / 1e7);
+  }
+  if (longitude) {
+    *longitude = (float)(fix->lng_e7 / 1e7);
+  }
+  if (battery) {
+    *battery = ((float)fix->bat / 255.0f) * 100.0f; // 0-100%
+  }
+}
+
+void payload_encode_hex(const payload_fix_t *fix,
+                        char out[PAYLOAD_ENCODER_HEX_LEN]) {
+  snprintf(out, PAYLOAD_ENCODER_HEX_LEN,
+           "%08" PRIX32 "%08" PRIX32 "%04X%04X%02X", (uint32_t)fix->lat_e7,
+           (uint32_t)fix->lng_e7, fix->speed_cm_s, fix->heading_cdeg,
+           fix->bat);
+}
+
+int payload_encode_json(char *buf, size_t size, const char *id,
+                        const payload_fix_t *fix, const char *date,
+                        const char *time) {
+  char payload[PAYLOAD_ENCODER_HEX_LEN] = {0};
+  payload_encode_hex(fix, payload);
+
+  int len = snprintf(buf, size,
+                     "{\n"
+                     "\"id\": \"%s\",\n"
+                     "\"v\": %d,\n"
+                     "\"payload\": \"%s\",\n"
+                     "\"date\": \"%s\",\n"
+                     "\"time\": \"%s\"\n"
+                     "}\n",
+                     id, PAYLOAD_ENCODER_VERSION, payload, date, time);
+  if (len < 0 || (size_t)len >= size) {
+    return -1;
+  }
+  return len;
+}
+
+void payload_encode_binary(uint8_t out[PAYLOAD_ENCODER_BIN_LEN],
+                           const payload_fix_t *fix, uint32_t time_s) {
+  out[0] = PAYLOAD_ENCODER_BIN_TYPE_FIX;
+  payload_put_u32(out + 1, (uint32_t)fix->lat_e7);
+  payload_put_u32(out + 5, (uint32_t)fix->lng_e7);
+  out[9] = (uint8_t)(fix->speed_cm_s >> 8);
+  out[10] = (uint8_t)fix->speed_cm_s;
+  out[11] = (uint8_t)(fix->heading_cdeg >> 8);
+  out[12] = (uint8_t)fix->heading_cdeg;
+  out[13] = fix->bat;
+  payload_put_u32(out + 14, time_s);
+}
+
+int payload_decode_binary(const uint8_t in[PAYLOAD_ENCODER_BIN_LEN],
+                          payload_fix_t *fix, uint32_t *time_s) {
+  if (PAYLOAD_ENCODER_BIN_TYPE_FIX != in[0]) {
+    return -1;
+  }
+  fix->lat_e7 = (int32_t)payload_get_u32(in + 1);
+  fix->lng_e7 = (int32_t)payload_get_u32(in + 5);
+  fix->speed_cm_s = (uint16_t)(in[9] << 8 | in[10]);
+  fix->heading_cdeg = (uint16_t)(in[11] << 8 | in[12]);
+  fix->bat = in[13];
+  *time_s = payload_get_u32(in + 14);
+  return 0;
+}
+
+/********************************************************************************
+ *
+ *                              Private Function Definitions
+ *
+ ********************************************************************************/
+static uint32_t payload_quantize(float value, float min, float max,
+                                 uint32_t scale) {
+  if (value <= min) {
+    return 0;
+  }
+  if (value >= max) {
+    return scale;
+  }
+  return (uint32_t)(((value - min) / (max - min)) * (float)scale + 0.5f);
+}
+
+static int32_t payload_degrees_to_e7(float degrees, float max) {
+  if (degrees <= -max) {
+    degrees = -max;
+  } else if (degrees >= max) {
+    degrees = max;
+  }
+  double e7 = (double)degrees * 1e7;
+  return (int32_t)(e7 < 0.0 ? e7 - 0.5 : e7 + 0.5);
+}
+
+static int32_t payload_clamp(int32_t value, int32_t max) {
+  if (value < -max) {
+    return -max;
+  }
+  return value > max ? max : value;
+}
+
+static void payload_put_u32(uint8_t *out, uint32_t value) {
+  out[0] = (uint8_t)(value >> 24);
+  out[1] = (uint8_t)(value >> 16);
+  out[2] = (uint8_t)(value >> 8);
+  out[3] = (uint8_t)value;
+}
+
+static uint32_t payload_get_u32(const uint8_t *in) {
+  return (uint32_t)in[0] << 24 | (uint32_t)in[1] << 16 |
+         (uint32_t)in[2] << 8 | (uint32_t)in[3];
+}
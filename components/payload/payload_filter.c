@@ -0,0 +1,350 @@
+#include "payload_filter.h"
+#include <math.h>
+#include <stddef.h>
+
+/**
+ * @brief Millimeters per 1e-7 degree of latitude, scaled by 1000.
+ */
+#define PAYLOAD_FILTER_LAT_MM_X1000 (11132)
+
+/**
+ * @brief Distance from the origin at which the local plane is re-centered.
+ */
+#define PAYLOAD_FILTER_RECENTER_MM (50000000)
+
+/**
+ * @brief Upper bound of the position variance (cm^2), ~30 km at 1 sigma.
+ */
+#define PAYLOAD_FILTER_MAX_P_PP (1000000000000LL)
+
+/**
+ * @brief Upper bound of the velocity variance (cm^2/s^2), 100 m/s at 1 sigma.
+ */
+#define PAYLOAD_FILTER_MAX_P_VV (100000000LL)
+
+/**
+ * @brief Speed below which the heading is held instead of recomputed.
+ */
+#define PAYLOAD_FILTER_MIN_HEADING_SPEED_MM_S (500)
+
+/********************************************************************************
+ *
+ *                              Private Function Prototypes
+ *
+ ********************************************************************************/
+
+// Restart the filter at a fix.
+static void payload_filter_restart(payload_filter_t *filter, uint32_t t_ms,
+                                   int32_t lat_e7, int32_t lng_e7);
+
+// Set the origin of the local plane and its longitude scale.
+static void payload_filter_set_origin(payload_filter_t *filter, int32_t lat_e7,
+                                      int32_t lng_e7);
+
+// Project a fix onto the local plane.
+static void payload_filter_project(const payload_filter_t *filter,
+                                   int32_t lat_e7, int32_t lng_e7,
+                                   int64_t pos_mm[2]);
+
+// Move the state and covariance forward by dt_ms.
+static void payload_filter_propagate(const payload_filter_t *filter,
+                                     int32_t dt_ms, int32_t pos_mm[2],
+                                     int64_t *p_pp, int64_t *p_pv,
+                                     int64_t *p_vv);
+
+// Turn a state into an estimate in degrees.
+static void payload_filter_estimate(const payload_filter_t *filter,
+                                    const int32_t pos_mm[2], int64_t p_pp,
+                                    payload_filter_estimate_t *estimate);
+
+// Clamp to the int32_t range.
+static int32_t payload_filter_sat(int64_t value);
+
+// Clamp to [lo, hi].
+static int64_t payload_filter_clamp(int64_t value, int64_t lo, int64_t hi);
+
+// Integer square root.
+static uint32_t payload_filter_isqrt(uint64_t value);
+
+// Course over ground in 0.01 degrees, clockwise from north.
+static uint16_t payload_filter_heading(int32_t vn, int32_t ve);
+
+/********************************************************************************
+ *
+ *                              Public Function Definitions
+ *
+ ********************************************************************************/
+void payload_filter_init(payload_filter_t *filter,
+                         const payload_filter_config_t *config) {
+  static const payload_filter_config_t defaults =
+      PAYLOAD_FILTER_CONFIG_DEFAULT();
+  *filter = (payload_filter_t){.config = config ? *config : defaults};
+}
+
+payload_filter_result_t
+payload_filter_update(payload_filter_t *filter, uint32_t t_ms, int32_t lat_e7,
+                      int32_t lng_e7, payload_filter_estimate_t *estimate) {
+  int32_t dt_ms = (int32_t)(t_ms - filter->t_ms);
+  if (!filter->started || dt_ms > PAYLOAD_FILTER_MAX_GAP_MS) {
+    payload_filter_restart(filter, t_ms, lat_e7, lng_e7);
+    if (estimate) {
+      payload_filter_estimate(filter, filter->pos_mm, filter->p_pp, estimate);
+    }
+    return PAYLOAD_FILTER_STARTED;
+  }
+  if (dt_ms < 0) {
+    // Out-of-order fix: fuse it as if it were simultaneous.
+    dt_ms = 0;
+    t_ms = filter->t_ms;
+  }
+
+  payload_filter_propagate(filter, dt_ms, filter->pos_mm, &filter->p_pp,
+                           &filter->p_pv, &filter->p_vv);
+  filter->t_ms = t_ms;
+
+  int64_t z[2];
+  payload_filter_project(filter, lat_e7, lng_e7, z);
+  int64_t y[2] = {z[0] - filter->pos_mm[0], z[1] - filter->pos_mm[1]};
+
+  // Innovation covariance (per axis) and gate on its normalized square.
+  int64_t r = (int64_t)filter->config.meas_sigma_cm * filter->config.meas_sigma_cm;
+  int64_t s = filter->p_pp + r;
+  int64_t yn_cm = y[0] / 10, ye_cm = y[1] / 10;
+  int64_t gate = filter->config.gate_sigma;
+  if (yn_cm * yn_cm + ye_cm * ye_cm > gate * gate * s) {
+    if (++filter->outliers > filter->config.max_outliers) {
+      payload_filter_restart(filter, t_ms, lat_e7, lng_e7);
+      if (estimate) {
+        payload_filter_estimate(filter, filter->pos_mm, filter->p_pp, estimate);
+      }
+      return PAYLOAD_FILTER_RESTARTED;
+    }
+    if (estimate) {
+      payload_filter_estimate(filter, filter->pos_mm, filter->p_pp, estimate);
+    }
+    return PAYLOAD_FILTER_OUTLIER;
+  }
+  filter->outliers = 0;
+
+  // Gains in Q16: k_p is dimensionless, k_v is in 1/s. The covariance update
+  // is written in terms of the gains so that no product exceeds 64 bits:
+  //   P_pp' = (1 - k_p) P_pp = k_p R
+  //   P_pv' = (1 - k_p) P_pv = k_v R
+  //   P_vv' = P_vv - k_v P_pv
+  int64_t k_p = (filter->p_pp << 16) / s;
+  int64_t k_v = (filter->p_pv << 16) / s;
+  for (int axis = 0; axis < 2; axis++) {
+    filter->pos_mm[axis] =
+        payload_filter_sat(filter->pos_mm[axis] + ((k_p * y[axis]) >> 16));
+    filter->vel_mm_s[axis] =
+        payload_filter_sat(filter->vel_mm_s[axis] + ((k_v * y[axis]) >> 16));
+  }
+  filter->p_vv = payload_filter_clamp(
+      filter->p_vv - ((k_v * filter->p_pv) >> 16), 0, PAYLOAD_FILTER_MAX_P_VV);
+  filter->p_pp = (k_p * r) >> 16;
+  filter->p_pv = (k_v * r) >> 16;
+
+  // Keep the projection local as the device travels.
+  if (filter->pos_mm[0] > PAYLOAD_FILTER_RECENTER_MM ||
+      filter->pos_mm[0] < -PAYLOAD_FILTER_RECENTER_MM ||
+      filter->pos_mm[1] > PAYLOAD_FILTER_RECENTER_MM ||
+      filter->pos_mm[1] < -PAYLOAD_FILTER_RECENTER_MM) {
+    payload_filter_estimate_t here;
+    payload_filter_estimate(filter, filter->pos_mm, filter->p_pp, &here);
+    payload_filter_set_origin(filter, here.lat_e7, here.lng_e7);
+    filter->pos_mm[0] = 0;
+    filter->pos_mm[1] = 0;
+  }
+
+  if (estimate) {
+    payload_filter_estimate(filter, filter->pos_mm, filter->p_pp, estimate);
+  }
+  return PAYLOAD_FILTER_ACCEPTED;
+}
+
+bool payload_filter_predict(const payload_filter_t *filter, uint32_t t_ms,
+                            payload_filter_estimate_t *estimate) {
+  if (!filter->started) {
+    return false;
+  }
+  int32_t dt_ms = (int32_t)(t_ms - filter->t_ms);
+  if (dt_ms > PAYLOAD_FILTER_MAX_GAP_MS) {
+    dt_ms = PAYLOAD_FILTER_MAX_GAP_MS;
+  } else if (dt_ms < -PAYLOAD_FILTER_MAX_GAP_MS) {
+    dt_ms = -PAYLOAD_FILTER_MAX_GAP_MS;
+  }
+  int32_t pos_mm[2] = {filter->pos_mm[0], filter->pos_mm[1]};
+  int64_t p_pp = filter->p_pp, p_pv = filter->p_pv, p_vv = filter->p_vv;
+  payload_filter_propagate(filter, dt_ms, pos_mm, &p_pp, &p_pv, &p_vv);
+  payload_filter_estimate(filter, pos_mm, p_pp, estimate);
+  return true;
+}
+
+/********************************************************************************
+ *
+ *                              Private Function Definitions
+ *
+ ********************************************************************************/
+static void payload_filter_restart(payload_filter_t *filter, uint32_t t_ms,
+                                   int32_t lat_e7, int32_t lng_e7) {
+  payload_filter_set_origin(filter, lat_e7, lng_e7);
+  filter->pos_mm[0] = filter->pos_mm[1] = 0;
+  filter->vel_mm_s[0] = filter->vel_mm_s[1] = 0;
+  filter->p_pp = (int64_t)filter->config.meas_sigma_cm *
+                 filter->config.meas_sigma_cm;
+  filter->p_pv = 0;
+  filter->p_vv = (int64_t)filter->config.init_speed_sigma_cm_s *
+                 filter->config.init_speed_sigma_cm_s;
+  filter->t_ms = t_ms;
+  filter->outliers = 0;
+  filter->started = true;
+}
+
+static void payload_filter_set_origin(payload_filter_t *filter, int32_t lat_e7,
+                                      int32_t lng_e7) {
+  filter->lat0_e7 = lat_e7;
+  filter->lng0_e7 = lng_e7;
+  // The only floating-point operation, done when the origin moves.
+  float scale = (float)PAYLOAD_FILTER_LAT_MM_X1000 / 1000.0f * 65536.0f *
+                cosf((float)lat_e7 * (float)(M_PI / 180.0 / 1e7));
+  filter->lng_mm_q16 = scale < 1.0f ? 1 : (int32_t)scale;
+}
+
+static void payload_filter_project(const payload_filter_t *filter,
+                                   int32_t lat_e7, int32_t lng_e7,
+                                   int64_t pos_mm[2]) {
+  int64_t dlat = (int64_t)lat_e7 - filter->lat0_e7;
+  int64_t dlng = (int64_t)lng_e7 - filter->lng0_e7;
+  // Take the short way around the antimeridian.
+  if (dlng > 1800000000) {
+    dlng -= 3600000000LL;
+  } else if (dlng < -1800000000) {
+    dlng += 3600000000LL;
+  }
+  pos_mm[0] = dlat * PAYLOAD_FILTER_LAT_MM_X1000 / 1000;
+  pos_mm[1] = (dlng * filter->lng_mm_q16) >> 16;
+}
+
+static void payload_filter_propagate(const payload_filter_t *filter,
+                                     int32_t dt_ms, int32_t pos_mm[2],
+                                     int64_t *p_pp, int64_t *p_pv,
+                                     int64_t *p_vv) {
+  for (int axis = 0; axis < 2; axis++) {
+    pos_mm[axis] = payload_filter_sat(
+        pos_mm[axis] + (int64_t)filter->vel_mm_s[axis] * dt_ms / 1000);
+  }
+  // Uncertainty grows both ways in time.
+  int64_t dt = dt_ms < 0 ? -(int64_t)dt_ms : dt_ms;
+  int64_t q = (int64_t)filter->config.accel_sigma_cm_s2 *
+              filter->config.accel_sigma_cm_s2;
+
+  // Continuous white-noise acceleration:
+  //   P_pp += 2 dt P_pv + dt^2 P_vv + q dt^3 / 3
+  //   P_pv += dt P_vv + q dt^2 / 2
+  //   P_vv += q dt
+  // With dt <= PAYLOAD_FILTER_MAX_GAP_MS and every factor bounded by the
+  // variance caps, each product fits in 64 bits.
+  int64_t q1 = payload_filter_clamp(q * dt / 1000, 0, PAYLOAD_FILTER_MAX_P_PP);
+  int64_t q2 = payload_filter_clamp(q1 * dt / 1000, 0, PAYLOAD_FILTER_MAX_P_PP);
+  int64_t q3 = payload_filter_clamp(q2 * dt / 1000, 0, PAYLOAD_FILTER_MAX_P_PP);
+  int64_t vv1 = *p_vv * dt / 1000;
+  int64_t vv2 = vv1 * dt / 1000;
+  int64_t pv1 = *p_pv * dt / 1000;
+
+  int64_t pp = *p_pp + 2 * pv1 + vv2 + q3 / 3;
+  int64_t vv = *p_vv + q1;
+  *p_pv += vv1 + q2 / 2;
+  if (pp > PAYLOAD_FILTER_MAX_P_PP || vv > PAYLOAD_FILTER_MAX_P_VV) {
+    // Capping the variances must not leave the covariance indefinite.
+    pp = payload_filter_clamp(pp, 0, PAYLOAD_FILTER_MAX_P_PP);
+    vv = payload_filter_clamp(vv, 0, PAYLOAD_FILTER_MAX_P_VV);
+    int64_t limit = (int64_t)payload_filter_isqrt((uint64_t)pp) *
+                    (int64_t)payload_filter_isqrt((uint64_t)vv);
+    *p_pv = payload_filter_clamp(*p_pv, -limit, limit);
+  }
+  *p_pp = pp;
+  *p_vv = vv;
+}
+
+static void payload_filter_estimate(const payload_filter_t *filter,
+                                    const int32_t pos_mm[2], int64_t p_pp,
+                                    payload_filter_estimate_t *estimate) {
+  int64_t lat =
+      filter->lat0_e7 + (int64_t)pos_mm[0] * 1000 / PAYLOAD_FILTER_LAT_MM_X1000;
+  int64_t lng =
+      filter->lng0_e7 + ((int64_t)pos_mm[1] << 16) / filter->lng_mm_q16;
+  if (lng > 1800000000) {
+    lng -= 3600000000LL;
+  } else if (lng < -1800000000) {
+    lng += 3600000000LL;
+  }
+  estimate->lat_e7 = payload_filter_sat(lat);
+  estimate->lng_e7 = (int32_t)lng;
+
+  int64_t vn = filter->vel_mm_s[0], ve = filter->vel_mm_s[1];
+  estimate->speed_mm_s = payload_filter_isqrt((uint64_t)(vn * vn + ve * ve));
+  estimate->heading_cdeg =
+      estimate->speed_mm_s < PAYLOAD_FILTER_MIN_HEADING_SPEED_MM_S
+          ? 0
+          : payload_filter_heading((int32_t)vn, (int32_t)ve);
+  estimate->accuracy_cm = payload_filter_isqrt(p_pp < 0 ? 0 : (uint64_t)p_pp);
+}
+
+static int32_t payload_filter_sat(int64_t value) {
+  if (value > INT32_MAX) {
+    return INT32_MAX;
+  }
+  if (value < INT32_MIN) {
+    return INT32_MIN;
+  }
+  return (int32_t)value;
+}
+
+static int64_t payload_filter_clamp(int64_t value, int64_t lo, int64_t hi) {
+  if (value > hi) {
+    return hi;
+  }
+  if (value < lo) {
+    return lo;
+  }
+  return value;
+}
+
+static uint32_t payload_filter_isqrt(uint64_t value) {
+  uint64_t root = 0;
+  uint64_t bit = 1ull << 62;
+  while (bit > value) {
+    bit >>= 2;
+  }
+  while (bit) {
+    if (value >= root + bit) {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint32_t)root;
+}
+
+static uint16_t payload_filter_heading(int32_t vn, int32_t ve) {
+  uint32_t an = (uint32_t)(vn < 0 ? -(int64_t)vn : vn);
+  uint32_t ae = (uint32_t)(ve < 0 ? -(int64_t)ve : ve);
+  uint32_t lo = an < ae ? an : ae;
+  uint32_t hi = an < ae ? ae : an;
+  // atan(r) ~= 45 r + 15.64 r (1 - r) degrees on [0, 1], within 0.25 deg.
+  uint32_t r = (uint32_t)(((uint64_t)lo << 15) / hi);
+  uint32_t angle = (r * (4500 + ((1564 * ((1u << 15) - r)) >> 15))) >> 15;
+  if (ae > an) {
+    angle = 9000 - angle;
+  }
+  // angle is now measured from the north/south axis towards east/west.
+  uint32_t heading;
+  if (vn >= 0) {
+    heading = ve >= 0 ? angle : 36000 - angle;
+  } else {
+    heading = ve >= 0 ? 18000 - angle : 18000 + angle;
+  }
+  return (uint16_t)(heading % 36000);
+}
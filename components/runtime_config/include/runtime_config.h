@@ -0,0 +1,95 @@
+#ifndef _RUNTIME_CONFIG_H_
+#define _RUNTIME_CONFIG_H_
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Largest number of messages published as one batch, and the number
+ *        of messages buffered while the radio is off.
+ */
+#define RUNTIME_CONFIG_BATCH_MAX (64)
+
+/**
+ * @brief Settings that can be changed at runtime.
+ *
+ * Defaults come from Kconfig. With CONFIG_GPS_TRACKER_REMOTE_CONFIG, updates
+ * received over MQTT are validated, persisted to NVS and survive reboots.
+ * The filter fields only apply with CONFIG_GPS_TRACKER_PAYLOAD_FILTER.
+ */
+typedef struct runtime_config {
+  uint32_t interval_ms;      ///< Payload generation interval
+  uint32_t batch_max_age_ms; ///< Longest a queued message waits for a batch
+  uint32_t wake_interval_ms; ///< Radio wake cadence; 0 keeps the radio on
+  uint16_t filter_meas_sigma_cm;     ///< Position filter GNSS error
+  uint16_t filter_accel_sigma_cm_s2; ///< Position filter process noise
+  uint8_t batch_size;          ///< Messages published together
+  uint8_t qos;                 ///< QoS of egress messages
+  uint8_t filter_gate_sigma;   ///< Position filter outlier gate
+  uint8_t filter_max_outliers; ///< Outliers in a row before a filter restart
+} runtime_config_t;
+
+/**
+ * @brief Callback invoked after a new configuration has been applied.
+ *
+ * Runs in the context of the task that applied the update; keep it short.
+ *
+ * @param config The configuration now in effect.
+ */
+typedef void (*runtime_config_listener_t)(const runtime_config_t *config);
+
+/**
+ * @brief Load the configuration from NVS, falling back to Kconfig defaults.
+ *
+ * NVS must have been initialized.
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Appropriate esp_err_t error code otherwise
+ */
+esp_err_t runtime_config_init(void);
+
+/**
+ * @brief Copy the configuration currently in effect.
+ *
+ * @param[out] config Configuration to fill.
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if config is NULL
+ *      - ESP_ERR_INVALID_STATE if not initialized
+ */
+esp_err_t runtime_config_get(runtime_config_t *config);
+
+/**
+ * @brief Register a callback for configuration changes.
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NO_MEM if all listener slots are taken
+ */
+esp_err_t runtime_config_add_listener(runtime_config_listener_t listener);
+
+/**
+ * @brief Validate, apply and persist a JSON configuration update.
+ *
+ * The update is an object with any subset of the runtime_config_t field
+ * names, e.g. {"interval_ms": 10000, "qos": 0}. It is applied atomically:
+ * an unknown key or an out-of-range value rejects the whole update.
+ * {"reset": true} restores the Kconfig defaults. If
+ * CONFIG_GPS_TRACKER_REMOTE_CONFIG_TOKEN is set, the update must also carry
+ * it as "token".
+ *
+ * @param[in]  json       Update, not necessarily null-terminated.
+ * @param[in]  len        Length of the update in bytes.
+ * @param[out] reply      Buffer for a JSON reply describing the outcome.
+ * @param[in]  reply_size Size of the reply buffer.
+ * @return
+ *      - ESP_OK if the update was applied
+ *      - ESP_ERR_INVALID_ARG if it was rejected
+ *      - Appropriate esp_err_t error code otherwise
+ */
+esp_err_t runtime_config_apply_json(const char *json, size_t len, char *reply,
+                                    size_t reply_size);
+
+#endif
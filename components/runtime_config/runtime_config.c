@@ -0,0 +1,439 @@
+#include "runtime_config.h"
+#include "cJSON.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "nvs.h"
+#include "utils.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @brief NVS namespace and key holding the persisted configuration.
+ */
+#define RUNTIME_CONFIG_NVS_NAMESPACE "rt_config"
+#define RUNTIME_CONFIG_NVS_KEY "config"
+
+/**
+ * @brief Layout version of the persisted blob; bump when runtime_config_t
+ *        changes.
+ */
+#define RUNTIME_CONFIG_BLOB_VERSION (2)
+
+/**
+ * @brief Maximum number of change listeners.
+ */
+#define RUNTIME_CONFIG_MAX_LISTENERS (4)
+
+/**
+ * @brief Token updates must carry; empty if none is required.
+ */
+#if CONFIG_GPS_TRACKER_REMOTE_CONFIG
+#define RUNTIME_CONFIG_TOKEN CONFIG_GPS_TRACKER_REMOTE_CONFIG_TOKEN
+#else
+#define RUNTIME_CONFIG_TOKEN ""
+#endif
+
+/**
+ * @brief Describe a runtime_config_t field and its valid range.
+ */
+#define RUNTIME_CONFIG_FIELD(name, lo, hi)                                     \
+  {#name, offsetof(runtime_config_t, name),                                    \
+   sizeof(((runtime_config_t *)0)->name), (lo), (hi)}
+
+/********************************************************************************
+ *
+ *                              Type Declarations
+ *
+ ********************************************************************************/
+
+/**
+ * @brief A configurable field: JSON key, location and valid range.
+ */
+typedef struct {
+  const char *key; /**< JSON key, same as the field name. */
+  size_t offset;   /**< Offset in runtime_config_t. */
+  size_t size;     /**< Size of the field in bytes. */
+  uint32_t min;    /**< Smallest valid value. */
+  uint32_t max;    /**< Largest valid value. */
+} runtime_config_field_t;
+
+/**
+ * @brief Configuration as stored in NVS.
+ */
+typedef struct {
+  uint16_t version;        /**< RUNTIME_CONFIG_BLOB_VERSION. */
+  runtime_config_t config; /**< Persisted settings. */
+} runtime_config_blob_t;
+
+/********************************************************************************
+ *
+ *                              Private Global Variables
+ *
+ ********************************************************************************/
+
+/**
+ * @brief Tag used for logging messages from the runtime config module.
+ */
+static char *TAG = "runtime_config";
+
+/**
+ * @brief Every field that can be updated remotely.
+ */
+static const runtime_config_field_t g_fields[] = {
+    RUNTIME_CONFIG_FIELD(interval_ms, 100, 86400000),
+    RUNTIME_CONFIG_FIELD(batch_size, 1, RUNTIME_CONFIG_BATCH_MAX),
+    RUNTIME_CONFIG_FIELD(batch_max_age_ms, 0, 3600000),
+    RUNTIME_CONFIG_FIELD(wake_interval_ms, 0, 86400000),
+    RUNTIME_CONFIG_FIELD(qos, 0, 2),
+#if CONFIG_GPS_TRACKER_PAYLOAD_FILTER
+    RUNTIME_CONFIG_FIELD(filter_meas_sigma_cm, 1, 10000),
+    RUNTIME_CONFIG_FIELD(filter_accel_sigma_cm_s2, 1, 5000),
+    RUNTIME_CONFIG_FIELD(filter_gate_sigma, 2, 20),
+    RUNTIME_CONFIG_FIELD(filter_max_outliers, 0, 255),
+#endif
+};
+
+/**
+ * @brief Defaults from Kconfig.
+ */
+static const runtime_config_t g_defaults = {
+    .interval_ms = CONFIG_GPS_TRACKER_PAYLOAD_GEN_INTERVAL_MS,
+    .batch_size = CONFIG_GPS_TRACKER_MQTT_BATCH_SIZE,
+    .batch_max_age_ms = CONFIG_GPS_TRACKER_MQTT_BATCH_MAX_AGE_MS,
+    .wake_interval_ms = CONFIG_GPS_TRACKER_RADIO_WAKE_INTERVAL_MS,
+    .qos = CONFIG_GPS_TRACKER_MQTT_QOS,
+#if CONFIG_GPS_TRACKER_PAYLOAD_FILTER
+    .filter_meas_sigma_cm = CONFIG_GPS_TRACKER_PAYLOAD_FILTER_MEAS_SIGMA_CM,
+    .filter_accel_sigma_cm_s2 =
+        CONFIG_GPS_TRACKER_PAYLOAD_FILTER_ACCEL_SIGMA_CM_S2,
+    .filter_gate_sigma = CONFIG_GPS_TRACKER_PAYLOAD_FILTER_GATE_SIGMA,
+    .filter_max_outliers = CONFIG_GPS_TRACKER_PAYLOAD_FILTER_MAX_OUTLIERS,
+#endif
+};
+
+/**
+ * @brief Configuration in effect.
+ */
+static runtime_config_t g_config = {0};
+
+/**
+ * @brief Guards g_config and g_listeners.
+ */
+static SemaphoreHandle_t g_lock = NULL;
+
+/**
+ * @brief Registered change listeners.
+ */
+static runtime_config_listener_t g_listeners[RUNTIME_CONFIG_MAX_LISTENERS] = {
+    0};
+
+/********************************************************************************
+ *
+ *                              Private Function Prototypes
+ *
+ ********************************************************************************/
+
+// Read a field as an unsigned integer.
+static uint32_t runtime_config_read_field(const runtime_config_t *config,
+                                          const runtime_config_field_t *field);
+
+// Write a field from an unsigned integer already checked against its range.
+static void runtime_config_write_field(runtime_config_t *config,
+                                       const runtime_config_field_t *field,
+                                       uint32_t value);
+
+// Check every field of a configuration against its range.
+static bool runtime_config_is_valid(const runtime_config_t *config);
+
+// Whether an update carries the configured token, if one is required.
+static bool runtime_config_is_authorized(const cJSON *update);
+
+#if CONFIG_GPS_TRACKER_REMOTE_CONFIG
+// Load the persisted configuration into *config.
+static esp_err_t runtime_config_load(runtime_config_t *config);
+#endif
+
+// Persist a configuration.
+static esp_err_t runtime_config_store(const runtime_config_t *config);
+
+// Swap in a new configuration and notify listeners.
+static void runtime_config_commit(const runtime_config_t *config);
+
+// Write {"id", "status", "config"|"error"} into reply.
+static void runtime_config_reply(char *reply, size_t reply_size,
+                                 const runtime_config_t *config,
+                                 const char *error);
+
+/********************************************************************************
+ *
+ *                              Public Function Definitions
+ *
+ ********************************************************************************/
+esp_err_t runtime_config_init(void) {
+  if (NULL != g_lock) {
+    ESP_LOGI(TAG, "runtime_config is already initialized!");
+    return ESP_OK;
+  }
+  g_lock = xSemaphoreCreateMutex();
+  ESP_RETURN_ON_FALSE(NULL != g_lock, ESP_ERR_NO_MEM, TAG,
+                      "Failed to create the config lock!");
+  g_config = g_defaults;
+#if CONFIG_GPS_TRACKER_REMOTE_CONFIG
+  esp_err_t ret = runtime_config_load(&g_config);
+  if (ESP_OK != ret) {
+    ESP_LOGW(TAG, "Using Kconfig defaults (%s).", esp_err_to_name(ret));
+    g_config = g_defaults;
+  }
+#else
+  // Whatever was persisted while remote configuration was enabled no longer
+  // applies.
+  ESP_LOGI(TAG, "Remote configuration is disabled, using Kconfig defaults.");
+#endif
+  ESP_LOGI(TAG,
+           "interval %" PRIu32 " ms, batch %u/%" PRIu32 " ms, qos %u, filter "
+           "%u cm %u cm/s2 gate %u",
+           g_config.interval_ms, g_config.batch_size, g_config.batch_max_age_ms,
+           g_config.qos, g_config.filter_meas_sigma_cm,
+           g_config.filter_accel_sigma_cm_s2, g_config.filter_gate_sigma);
+  return ESP_OK;
+}
+
+esp_err_t runtime_config_get(runtime_config_t *config) {
+  ESP_RETURN_ON_FALSE(NULL != config, ESP_ERR_INVALID_ARG, TAG,
+                      "config is NULL!");
+  ESP_RETURN_ON_FALSE(NULL != g_lock, ESP_ERR_INVALID_STATE, TAG,
+                      "runtime_config is not initialized!");
+  xSemaphoreTake(g_lock, portMAX_DELAY);
+  *config = g_config;
+  xSemaphoreGive(g_lock);
+  return ESP_OK;
+}
+
+esp_err_t runtime_config_add_listener(runtime_config_listener_t listener) {
+  ESP_RETURN_ON_FALSE(NULL != listener, ESP_ERR_INVALID_ARG, TAG,
+                      "listener is NULL!");
+  ESP_RETURN_ON_FALSE(NULL != g_lock, ESP_ERR_INVALID_STATE, TAG,
+                      "runtime_config is not initialized!");
+  esp_err_t ret = ESP_ERR_NO_MEM;
+  xSemaphoreTake(g_lock, portMAX_DELAY);
+  for (int i = 0; i < RUNTIME_CONFIG_MAX_LISTENERS; i++) {
+    if (NULL == g_listeners[i]) {
+      g_listeners[i] = listener;
+      ret = ESP_OK;
+      break;
+    }
+  }
+  xSemaphoreGive(g_lock);
+  return ret;
+}
+
+esp_err_t runtime_config_apply_json(const char *json, size_t len, char *reply,
+                                    size_t reply_size) {
+  ESP_RETURN_ON_FALSE(NULL != json && NULL != reply, ESP_ERR_INVALID_ARG, TAG,
+                      "json or reply is NULL!");
+  ESP_RETURN_ON_FALSE(NULL != g_lock, ESP_ERR_INVALID_STATE, TAG,
+                      "runtime_config is not initialized!");
+
+  runtime_config_t update;
+  runtime_config_get(&update);
+  char error[64] = {0};
+
+  cJSON *root = cJSON_ParseWithLength(json, len);
+  if (NULL == root || !cJSON_IsObject(root)) {
+    snprintf(error, sizeof(error), "not a JSON object");
+  } else if (!runtime_config_is_authorized(root)) {
+    snprintf(error, sizeof(error), "missing or wrong token");
+  } else {
+    // A reset applies first, so other keys in the same update override it.
+    if (cJSON_IsTrue(cJSON_GetObjectItem(root, "reset"))) {
+      update = g_defaults;
+    }
+    cJSON *item = NULL;
+    cJSON_ArrayForEach(item, root) {
+      if (0 == strcmp(item->string, "reset") ||
+          0 == strcmp(item->string, "token")) {
+        continue;
+      }
+      const runtime_config_field_t *field = NULL;
+      for (size_t i = 0; i < sizeof(g_fields) / sizeof(g_fields[0]); i++) {
+        if (0 == strcmp(item->string, g_fields[i].key)) {
+          field = &g_fields[i];
+          break;
+        }
+      }
+      if (NULL == field) {
+        snprintf(error, sizeof(error), "unknown key \"%.32s\"", item->string);
+        break;
+      }
+      double value = cJSON_GetNumberValue(item);
+      if (!cJSON_IsNumber(item) || value != floor(value) ||
+          value < field->min || value > field->max) {
+        snprintf(error, sizeof(error), "%s must be an integer in [%" PRIu32
+                 ", %" PRIu32 "]", field->key, field->min, field->max);
+        break;
+      }
+      runtime_config_write_field(&update, field, (uint32_t)value);
+    }
+  }
+  cJSON_Delete(root);
+
+  if (error[0]) {
+    ESP_LOGW(TAG, "Rejected config update: %s", error);
+    runtime_config_reply(reply, reply_size, NULL, error);
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  esp_err_t ret = runtime_config_store(&update);
+  if (ESP_OK != ret) {
+    // Still apply it; it will be lost on reboot.
+    ESP_LOGE(TAG, "Failed to persist config: %s", esp_err_to_name(ret));
+  }
+  runtime_config_commit(&update);
+  runtime_config_reply(reply, reply_size, &update, NULL);
+  ESP_LOGI(TAG, "Applied config update.");
+  return ESP_OK;
+}
+
+/********************************************************************************
+ *
+ *                              Private Function Definitions
+ *
+ ********************************************************************************/
+static uint32_t runtime_config_read_field(const runtime_config_t *config,
+                                          const runtime_config_field_t *field) {
+  const uint8_t *p = (const uint8_t *)config + field->offset;
+  switch (field->size) {
+  case sizeof(uint8_t):
+    return *p;
+  case sizeof(uint16_t):
+    return *(const uint16_t *)p;
+  default:
+    return *(const uint32_t *)p;
+  }
+}
+
+static void runtime_config_write_field(runtime_config_t *config,
+                                       const runtime_config_field_t *field,
+                                       uint32_t value) {
+  uint8_t *p = (uint8_t *)config + field->offset;
+  switch (field->size) {
+  case sizeof(uint8_t):
+    *p = (uint8_t)value;
+    break;
+  case sizeof(uint16_t):
+    *(uint16_t *)p = (uint16_t)value;
+    break;
+  default:
+    *(uint32_t *)p = value;
+    break;
+  }
+}
+
+static bool runtime_config_is_valid(const runtime_config_t *config) {
+  for (size_t i = 0; i < sizeof(g_fields) / sizeof(g_fields[0]); i++) {
+    uint32_t value = runtime_config_read_field(config, &g_fields[i]);
+    if (value < g_fields[i].min || value > g_fields[i].max) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool runtime_config_is_authorized(const cJSON *update) {
+  if (0 == RUNTIME_CONFIG_TOKEN[0]) {
+    return true;
+  }
+  const cJSON *token = cJSON_GetObjectItem(update, "token");
+  return cJSON_IsString(token) &&
+         0 == strcmp(cJSON_GetStringValue(token), RUNTIME_CONFIG_TOKEN);
+}
+
+#if CONFIG_GPS_TRACKER_REMOTE_CONFIG
+static esp_err_t runtime_config_load(runtime_config_t *config) {
+  nvs_handle_t handle;
+  ESP_RETURN_ON_ERROR(
+      nvs_open(RUNTIME_CONFIG_NVS_NAMESPACE, NVS_READONLY, &handle), TAG,
+      "No persisted config.");
+  runtime_config_blob_t blob;
+  size_t size = sizeof(blob);
+  esp_err_t ret = nvs_get_blob(handle, RUNTIME_CONFIG_NVS_KEY, &blob, &size);
+  nvs_close(handle);
+  if (ESP_OK != ret) {
+    return ret;
+  }
+  if (size != sizeof(blob) || RUNTIME_CONFIG_BLOB_VERSION != blob.version) {
+    ESP_LOGW(TAG, "Persisted config has an old layout, ignoring it.");
+    return ESP_ERR_INVALID_VERSION;
+  }
+  if (!runtime_config_is_valid(&blob.config)) {
+    ESP_LOGW(TAG, "Persisted config is out of range, ignoring it.");
+    return ESP_ERR_INVALID_STATE;
+  }
+  *config = blob.config;
+  return ESP_OK;
+}
+#endif
+
+static esp_err_t runtime_config_store(const runtime_config_t *config) {
+  nvs_handle_t handle;
+  ESP_RETURN_ON_ERROR(
+      nvs_open(RUNTIME_CONFIG_NVS_NAMESPACE, NVS_READWRITE, &handle), TAG,
+      "Failed to open NVS!");
+  runtime_config_blob_t blob = {
+      .version = RUNTIME_CONFIG_BLOB_VERSION,
+      .config = *config,
+  };
+  esp_err_t ret =
+      nvs_set_blob(handle, RUNTIME_CONFIG_NVS_KEY, &blob, sizeof(blob));
+  if (ESP_OK == ret) {
+    ret = nvs_commit(handle);
+  }
+  nvs_close(handle);
+  return ret;
+}
+
+static void runtime_config_commit(const runtime_config_t *config) {
+  runtime_config_listener_t listeners[RUNTIME_CONFIG_MAX_LISTENERS];
+  xSemaphoreTake(g_lock, portMAX_DELAY);
+  g_config = *config;
+  memcpy(listeners, g_listeners, sizeof(listeners));
+  xSemaphoreGive(g_lock);
+  for (int i = 0; i < RUNTIME_CONFIG_MAX_LISTENERS; i++) {
+    if (listeners[i]) {
+      listeners[i](config);
+    }
+  }
+}
+
+static void runtime_config_reply(char *reply, size_t reply_size,
+                                 const runtime_config_t *config,
+                                 const char *error) {
+  const char *status = error ? "error" : "ok";
+  // cJSON escapes the error, which may quote a key of the update.
+  cJSON *root = cJSON_CreateObject();
+  bool ok = NULL != root &&
+            NULL != cJSON_AddStringToObject(root, "id", UTILS_DEVICE_ID) &&
+            NULL != cJSON_AddStringToObject(root, "status", status);
+  if (ok && error) {
+    ok = NULL != cJSON_AddStringToObject(root, "error", error);
+  } else if (ok) {
+    cJSON *values = cJSON_AddObjectToObject(root, "config");
+    ok = NULL != values;
+    for (size_t i = 0; ok && i < sizeof(g_fields) / sizeof(g_fields[0]); i++) {
+      ok = NULL != cJSON_AddNumberToObject(
+                       values, g_fields[i].key,
+                       runtime_config_read_field(config, &g_fields[i]));
+    }
+  }
+  if (!ok || !cJSON_PrintPreallocated(root, reply, (int)reply_size, false)) {
+    ESP_LOGE(TAG, "Failed to format the config reply!");
+    snprintf(reply, reply_size, "{\"id\": \"%s\", \"status\": \"%s\"}\n",
+             UTILS_DEVICE_ID, status);
+  }
+  cJSON_Delete(root);
+}
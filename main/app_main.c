@@ -1,13 +1,31 @@
 #include "esp_event.h"
 #include "esp_netif.h"
+#include "esp_pm.h"
 #include "freertos/FreeRTOS.h"
+#include "geofence.h"
 #include "network_manager.h"
 #include "nvs_flash.h"
 #include "payload.h"
+#include "runtime_config.h"
 
 #include <stdbool.h>
 
+/**
+ * @brief Lowest CPU frequency used by dynamic frequency scaling.
+ */
+#define APP_MAIN_MIN_CPU_FREQ_MHZ (40)
+
 void app_main(void) {
+#if CONFIG_PM_ENABLE
+  // Let the CPU enter light sleep whenever every task is blocked; Wi-Fi keeps
+  // its connection through modem sleep in the meantime.
+  esp_pm_config_t pm_config = {
+      .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+      .min_freq_mhz = APP_MAIN_MIN_CPU_FREQ_MHZ,
+      .light_sleep_enable = true,
+  };
+  ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
+#endif
   esp_err_t ret = nvs_flash_init();
   if (ret == ESP_ERR_NVS_NO_FREE_PAGES ||
       ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -15,9 +33,11 @@ void app_main(void) {
     ret = nvs_flash_init();
   }
   ESP_ERROR_CHECK(ret);
+  ESP_ERROR_CHECK(runtime_config_init());
   ESP_ERROR_CHECK(esp_netif_init());
   ESP_ERROR_CHECK(esp_event_loop_create_default());
   ESP_ERROR_CHECK(network_manager_init());
+  ESP_ERROR_CHECK(geofence_init());
   ESP_ERROR_CHECK(payload_init());
   while (true) {
     vTaskDelay(1000);
@@ -0,0 +1,68 @@
+"""Compressed batches published by the firmware.
+
+Above a size threshold the firmware publishes a batch of messages as one
+LZSS-compressed message (components/mqtt_mgt/include/mqtt_mgt_lz.h)::
+
+    0xFF | version | raw length (2, big endian) | LZSS stream of
+    count x [length (1) | message]
+
+Anything that does not start with 0xFF is a single plain message.
+"""
+
+BATCH_MAGIC = 0xFF
+BATCH_VERSION = 1
+BATCH_HEADER_LEN = 4
+
+# Codec parameters; must match mqtt_mgt_lz.h.
+WINDOW_BITS = 8
+LENGTH_BITS = 6
+MIN_MATCH = 2
+
+
+def decompress(data, size):
+    """Decompress an LZSS stream that expands to exactly size bytes."""
+    out = bytearray()
+    # Every bit of the stream, most significant first.
+    bits = "".join(f"{byte:08b}" for byte in data)
+    pos = 0
+    while pos < len(bits):
+        if bits[pos] == "1":
+            if len(bits) - pos < 9:
+                raise ValueError("truncated literal")
+            out.append(int(bits[pos + 1 : pos + 9], 2))
+            pos += 9
+            continue
+        pos += 1
+        if len(bits) - pos < WINDOW_BITS + LENGTH_BITS:
+            break  # padding of the last byte
+        distance = int(bits[pos : pos + WINDOW_BITS], 2) + 1
+        pos += WINDOW_BITS
+        length = int(bits[pos : pos + LENGTH_BITS], 2) + MIN_MATCH
+        pos += LENGTH_BITS
+        if distance > len(out):
+            raise ValueError("back-reference before the start")
+        # Byte by byte, as the match may overlap the bytes it produces.
+        for _ in range(length):
+            out.append(out[-distance])
+    if len(out) != size:
+        raise ValueError("wrong decompressed length")
+    return bytes(out)
+
+
+def messages(payload):
+    """The messages carried by an MQTT payload, one unless it is a batch."""
+    if not payload or payload[0] != BATCH_MAGIC:
+        return [payload]
+    if len(payload) < BATCH_HEADER_LEN or payload[1] != BATCH_VERSION:
+        raise ValueError("unsupported batch")
+    size = int.from_bytes(payload[2:4], "big")
+    raw = decompress(payload[BATCH_HEADER_LEN:], size)
+    out = []
+    pos = 0
+    while pos < len(raw):
+        end = pos + 1 + raw[pos]
+        if end > len(raw):
+            raise ValueError("truncated message")
+        out.append(raw[pos + 1 : end])
+        pos = end
+    return out
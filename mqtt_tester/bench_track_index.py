@@ -0,0 +1,98 @@
+"""Query latency of the track index against a brute-force scan.
+
+Example (10,000 trackers, one fix per minute for a day):
+
+    uv run python bench_track_index.py --devices 10000 --hours 24
+
+Every query result is checked against the brute-force answer.
+"""
+
+import argparse
+import shutil
+import tempfile
+import time
+
+import numpy as np
+
+from track_index import TrackIndex, brute_force_inside
+from track_store import TrackStore
+
+
+def percentiles(samples):
+    a = np.array(samples) * 1e3
+    return f"p50 {np.percentile(a, 50):8.2f} ms  p99 {np.percentile(a, 99):8.2f} ms"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--devices", type=int, default=2000)
+    parser.add_argument("--hours", type=int, default=24)
+    parser.add_argument("--period-s", type=int, default=60,
+                        help="report period of each device")
+    parser.add_argument("--queries", type=int, default=100)
+    parser.add_argument("--box-deg", type=float, default=0.1,
+                        help="edge length of the query box")
+    parser.add_argument("--window-min", type=int, default=60,
+                        help="length of the query time window")
+    parser.add_argument("--cell-deg", type=float, default=0.05)
+    args = parser.parse_args()
+
+    root = tempfile.mkdtemp(prefix="trackindex-")
+    store = TrackStore(root, background=False)
+    index = TrackIndex(store, cell_deg=args.cell_deg)
+    rng = np.random.default_rng(2)
+
+    # A metro-sized fleet: devices start inside a 2° square and random-walk.
+    n = args.hours * 3600 // args.period_s
+    t0 = 1_700_000_000_000
+    t = t0 + np.arange(n, dtype=np.int64) * args.period_s * 1000
+    start = time.perf_counter()
+    for i in range(args.devices):
+        lat = 13.0 + 2.0 * rng.random() + np.cumsum(rng.normal(0, 2e-3, n))
+        lng = 100.0 + 2.0 * rng.random() + np.cumsum(rng.normal(0, 2e-3, n))
+        bat = np.linspace(100.0, 20.0, n)
+        store.append_many(f"DEV_{i:05d}", t, lat, lng, bat)
+    load_s = time.perf_counter() - start
+    print(f"loaded {args.devices * n:,} fixes from {args.devices} devices in "
+          f"{load_s:.1f} s (store + index)")
+
+    start = time.perf_counter()
+    last = index.last_positions()
+    print(f"last position of {len(last)} devices: "
+          f"{(time.perf_counter() - start) * 1e3:.2f} ms")
+
+    span_ms = int(t[-1] - t0)
+    window_ms = args.window_min * 60_000
+    indexed, brute, matches = [], [], 0
+    for _ in range(args.queries):
+        lat_min = 13.0 + 2.0 * rng.random()
+        lng_min = 100.0 + 2.0 * rng.random()
+        t_from = t0 + int(rng.integers(max(span_ms - window_ms, 1)))
+        q = (lat_min, lat_min + args.box_deg, lng_min, lng_min + args.box_deg,
+             t_from, t_from + window_ms)
+
+        started = time.perf_counter()
+        got = index.inside(*q)
+        indexed.append(time.perf_counter() - started)
+
+        started = time.perf_counter()
+        want = brute_force_inside(store, *q)
+        brute.append(time.perf_counter() - started)
+
+        if got != want:
+            raise SystemExit(f"mismatch for {q}: {len(got)} vs {len(want)}")
+        matches += len(got)
+
+    print(f"{args.queries} box queries ({args.box_deg}° box, "
+          f"{args.window_min} min window), {matches / args.queries:.1f} "
+          f"devices/answer on average")
+    print(f"  index        {percentiles(indexed)}")
+    print(f"  brute force  {percentiles(brute)}")
+    print(f"  speedup      {np.median(brute) / np.median(indexed):.0f}x (median)")
+
+    store.close()
+    shutil.rmtree(root)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,127 @@
+"""Ingest and range-scan benchmark for the track store.
+
+Example (one billion points, ~7 GB on disk):
+
+    uv run python bench_track_store.py --points 1000000000 --devices 1000
+
+Points are generated as per-device random walks reporting every second and
+written in chunks, so memory use stays bounded regardless of --points.
+"""
+
+import argparse
+import os
+import shutil
+import tempfile
+import time
+
+import numpy as np
+
+from track_store import FSYNC_BLOCK, FSYNC_INTERVAL, FSYNC_NEVER, TrackStore
+
+
+def generate(rng, n, t0, lat0, lng0, bat0):
+    t = t0 + np.arange(n, dtype=np.int64) * 1000
+    lat = lat0 + np.cumsum(rng.normal(0.0, 5e-5, n))
+    lng = lng0 + np.cumsum(rng.normal(0.0, 5e-5, n))
+    bat = np.clip(bat0 - np.arange(n) * 1e-4, 0.0, 100.0)
+    return t, lat, lng, bat
+
+
+def dir_size(path):
+    total = 0
+    for root, _, files in os.walk(path):
+        for name in files:
+            total += os.path.getsize(os.path.join(root, name))
+    return total
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--points", type=int, default=10_000_000)
+    parser.add_argument("--devices", type=int, default=100)
+    parser.add_argument("--chunk", type=int, default=65_536,
+                        help="points per device per append")
+    parser.add_argument("--partition-s", type=int, default=86_400)
+    parser.add_argument("--fsync", default=FSYNC_INTERVAL,
+                        choices=(FSYNC_NEVER, FSYNC_BLOCK, FSYNC_INTERVAL))
+    parser.add_argument("--scans", type=int, default=200,
+                        help="random range scans to time")
+    parser.add_argument("--root", help="store directory (default: temp dir)")
+    parser.add_argument("--keep", action="store_true")
+    args = parser.parse_args()
+
+    root = args.root or tempfile.mkdtemp(prefix="trackstore-")
+    store = TrackStore(root, partition_s=args.partition_s, fsync=args.fsync,
+                       compact_block_size=args.chunk, background=False)
+    rng = np.random.default_rng(1)
+    per_device = args.points // args.devices
+    t0 = 1_700_000_000_000
+    state = {
+        f"DEV_{i:05d}": (t0, rng.uniform(-60, 60), rng.uniform(-170, 170), 100.0)
+        for i in range(args.devices)
+    }
+
+    print(f"store: {root}")
+    print(f"ingest: {per_device * args.devices:,} points, {args.devices} "
+          f"devices, chunk {args.chunk}, fsync={args.fsync}")
+    written = 0
+    gen_s = 0.0
+    start = time.perf_counter()
+    for offset in range(0, per_device, args.chunk):
+        n = min(args.chunk, per_device - offset)
+        for device, (t, lat, lng, bat) in state.items():
+            g = time.perf_counter()
+            cols = generate(rng, n, t, lat, lng, bat)
+            gen_s += time.perf_counter() - g
+            store.append_many(device, *cols)
+            state[device] = (int(cols[0][-1]) + 1000, cols[1][-1],
+                             cols[2][-1], cols[3][-1])
+            written += n
+        store.flush(sync=args.fsync != FSYNC_NEVER)
+    ingest_s = time.perf_counter() - start - gen_s
+    size = dir_size(root)
+    print(f"  {written / ingest_s:,.0f} points/s "
+          f"({ingest_s:.1f} s excluding {gen_s:.1f} s generation)")
+    print(f"  {size / written:.2f} bytes/point on disk ({size / 1e9:.2f} GB)")
+
+    devices = list(state)
+    # Full scans: every point of a sample of devices.
+    sample = devices[: min(len(devices), 20)]
+    start = time.perf_counter()
+    scanned = 0
+    for device in sample:
+        scanned += store.scan(device)["t"].size
+    full_s = time.perf_counter() - start
+    print(f"full scan: {scanned / full_s:,.0f} points/s over {len(sample)} "
+          f"devices")
+
+    # Random one-hour windows: exercises partition and block pruning.
+    span_ms = per_device * 1000
+    start = time.perf_counter()
+    scanned = 0
+    for _ in range(args.scans):
+        device = devices[rng.integers(len(devices))]
+        lo = t0 + int(rng.integers(max(span_ms - 3_600_000, 1)))
+        scanned += store.scan(device, lo, lo + 3_600_000)["t"].size
+    window_s = time.perf_counter() - start
+    print(f"1 h window scan: {args.scans / window_s:,.0f} queries/s, "
+          f"{window_s / args.scans * 1e3:.2f} ms/query, "
+          f"{scanned / window_s:,.0f} points/s")
+
+    # Raw column access: reductions straight over the mapped deltas.
+    start = time.perf_counter()
+    raw = 0
+    for device in sample:
+        for _, block in store.blocks(device):
+            block.deltas("lat").sum()
+            raw += block.count
+    raw_s = time.perf_counter() - start
+    print(f"mmap column reduce: {raw / raw_s:,.0f} points/s")
+
+    store.close()
+    if not args.keep and not args.root:
+        shutil.rmtree(root)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,59 @@
+"""Downsampling of time series to a fixed number of points for plotting.
+
+Both functions take the same arguments and return the indices of the points
+to keep, in order, so the same selection can be applied to several columns.
+"""
+
+import numpy as np
+
+
+def lttb(x, y, n_out):
+    """Largest-Triangle-Three-Buckets: keeps the visual shape of a line."""
+    n = len(x)
+    if n_out >= n or n_out < 3:
+        return np.arange(n)
+    x = np.asarray(x, dtype=np.float64)
+    y = np.asarray(y, dtype=np.float64)
+    # Interior points are split into n_out - 2 buckets; the first and last
+    # points are always kept.
+    edges = (np.arange(n_out - 1) * ((n - 2) / (n_out - 2))).astype(np.int64) + 1
+    edges[-1] = n - 1
+    out = np.empty(n_out, dtype=np.int64)
+    out[0] = 0
+    out[-1] = n - 1
+    a = 0
+    for i in range(n_out - 2):
+        start, end = edges[i], edges[i + 1]
+        if i + 2 < len(edges):
+            nxt = slice(end, edges[i + 2])
+        else:
+            nxt = slice(n - 1, n)
+        avg_x = x[nxt].mean()
+        avg_y = y[nxt].mean()
+        xs = x[start:end]
+        ys = y[start:end]
+        area = np.abs((x[a] - avg_x) * (ys - y[a]) - (x[a] - xs) * (avg_y - y[a]))
+        a = start + int(np.argmax(area))
+        out[i + 1] = a
+    return out
+
+
+def minmax(x, y, n_out):
+    """Keep the minimum and maximum of each bucket: preserves spikes.
+
+    Buckets hold the same number of points; x is not needed.
+    """
+    n = len(y)
+    buckets = n_out // 2
+    if buckets < 1 or n <= n_out:
+        return np.arange(n)
+    y = np.asarray(y)
+    edges = np.linspace(0, n, buckets + 1).astype(np.int64)
+    out = np.empty(2 * buckets, dtype=np.int64)
+    for i in range(buckets):
+        lo, hi = edges[i], edges[i + 1]
+        seg = y[lo:hi]
+        a = lo + int(np.argmin(seg))
+        b = lo + int(np.argmax(seg))
+        out[2 * i], out[2 * i + 1] = (a, b) if a <= b else (b, a)
+    return out
@@ -1,22 +1,39 @@
 import json
 import threading
+import time
+import numpy as np
 import paho.mqtt.client as mqtt
-from collections import deque
-from dash import Dash, dcc, html
-from dash.dependencies import Output, Input
+from datetime import datetime
+from dash import Dash, dcc, html, no_update
+from dash.dependencies import Output, Input, State
 import plotly.graph_objs as go
+import batch
+import query_api
+from downsample import lttb, minmax
+from track_index import TrackIndex
+from track_store import TrackStore, check_device
 
 # MQTT Configuration
 BROKER = "test.mosquitto.org"
 PORT = 1883
-TOPIC = "/egress/ESP_01"
-
-# Shared data buffers
-maxlen = 100
-latitudes = deque(maxlen=maxlen)
-longitudes = deque(maxlen=maxlen)
-batteries = deque(maxlen=maxlen)
-timestamps = deque(maxlen=maxlen)
+TOPIC = "/egress/+"
+
+# Track storage
+STORE_DIR = "tracks"
+store = TrackStore(STORE_DIR)
+index = TrackIndex(store)
+
+# Dashboard
+# Points per trace sent to the browser; roughly the plot width in pixels.
+MAX_POINTS = 1000
+# (field, label, line dash, downsampling) of the series plotted for every
+# device. Battery dips are what matters there, and LTTB may drop single-point
+# spikes; min-max keeps the extremes of every bucket.
+SERIES = [
+    ("lat", "Latitude", "dash", lttb),
+    ("lng", "Longitude", "dot", lttb),
+    ("bat", "Battery (%)", "solid", minmax),
+]
 latest_data = {"id": "", "date": "", "time": ""}
 
 
@@ -27,30 +44,49 @@ def on_connect(client, userdata, flags, rc):
 
 
 def on_message(client, userdata, msg):
-    global latest_data
     try:
-        payload = json.loads(msg.payload.decode())
-        lat = int(payload["payload"][0:4], 16)
-        lng = int(payload["payload"][4:8], 16)
-        bat = int(payload["payload"][8:10], 16)
+        # Large batches arrive as one compressed message.
+        for message in batch.messages(msg.payload):
+            handle_message(message)
+    except Exception as e:
+        print("Error processing message:", e)
 
-        latitude = (float(lat) / 65535.0) * 180.0 - 90.0
-        longitude = (float(lng) / 65535.0) * 360.0 - 180.0
-        battery = (float(bat) / 255.0) * 100.0
+
+def handle_message(message):
+    global latest_data
+    try:
+        payload = json.loads(message.decode())
+        if "status" in payload:
+            # Reply to a configuration update sent on /ingress/<id>.
+            print(f"Config reply from {payload.get('id')}: {payload}")
+            return
+        if "event" in payload:
+            # Geofence transition; carries the fence and the fix, no payload.
+            print(
+                f"Fence {payload['fence']} {payload['event']} by {payload['id']} "
+                f"at {payload['lat']}, {payload['lng']} "
+                f"({payload['date']} {payload['time']})"
+            )
+            return
+        # The id names a directory of the store; anyone can publish here.
+        check_device(payload["id"])
+        latitude, longitude, battery, speed, heading = decode_fix(payload)
 
         latest_data = {
             "id": payload["id"],
-            "lat": str(round(latitude, 3)),
-            "lng": str(round(longitude, 3)),
+            "lat": str(round(latitude, 7)),
+            "lng": str(round(longitude, 7)),
             "bat": str(round(battery, 3)),
+            "speed": str(round(speed, 2)),
+            "heading": str(round(heading, 2)),
             "date": payload["date"],
             "time": payload["time"],
         }
 
-        latitudes.append(latitude)
-        longitudes.append(longitude)
-        batteries.append(battery)
-        timestamps.append(payload["time"])
+        t = datetime.strptime(
+            f"{payload['date']} {payload['time']}", "%Y-%m-%d %H:%M:%S"
+        )
+        store.append(payload["id"], t.timestamp() * 1000, latitude, longitude, battery)
 
         print(latest_data)
 
@@ -58,6 +94,33 @@ def on_message(client, userdata, msg):
         print("Error processing message:", e)
 
 
+def decode_fix(payload):
+    """(lat, lng, battery %, speed m/s, heading deg) of a fix message.
+
+    Version 2 ("v": 2) sends 1e-7 degree coordinates in two's complement,
+    speed in cm/s and heading in 0.01 degrees. Version 1 (no "v") sent
+    16-bit coordinates and no motion.
+    """
+    hex_fix = payload["payload"]
+    if payload.get("v", 1) == 1:
+        latitude = int(hex_fix[0:4], 16) / 65535.0 * 180.0 - 90.0
+        longitude = int(hex_fix[4:8], 16) / 65535.0 * 360.0 - 180.0
+        return latitude, longitude, int(hex_fix[8:10], 16) / 255.0 * 100.0, 0.0, 0.0
+    if payload["v"] != 2:
+        raise ValueError(f"unsupported fix version {payload['v']}")
+    lat_e7, lng_e7 = (
+        int.from_bytes(bytes.fromhex(hex_fix[i : i + 8]), "big", signed=True)
+        for i in (0, 8)
+    )
+    return (
+        lat_e7 / 1e7,
+        lng_e7 / 1e7,
+        int(hex_fix[24:26], 16) / 255.0 * 100.0,
+        int(hex_fix[16:20], 16) / 100.0,
+        int(hex_fix[20:24], 16) / 100.0,
+    )
+
+
 # Start MQTT in background thread
 def start_mqtt():
     client = mqtt.Client()
@@ -72,12 +135,18 @@ mqtt_thread.start()
 
 # Dash App
 app = Dash(__name__)
+query_api.register(app.server, store, index)
 
 app.layout = html.Div(
     [
         html.H2("Live MQTT Telemetry Dashboard"),
         html.Div(id="text-info", style={"marginBottom": "20px"}),
+        dcc.Dropdown(id="device-select", multi=True, placeholder="Devices"),
         dcc.Graph(id="live-graph"),
+        # Newest timestamp already sent to the browser for each device.
+        dcc.Store(id="sent-until", data={}),
+        # Points appended to every trace since the last full redraw.
+        dcc.Store(id="appended", data=0),
         dcc.Interval(
             id="interval-component",
             interval=1000,  # update every 1 second
@@ -87,59 +156,160 @@ app.layout = html.Div(
 )
 
 
+def to_local_datetimes(t_ms):
+    # Plot in the dashboard's local time, like the time strings sent by the
+    # firmware. The UTC offset is looked up for every timestamp, so history
+    # from before a DST change is not shifted by an hour.
+    offset_s = np.array(
+        [time.localtime(s).tm_gmtoff for s in (t_ms // 1000).tolist()],
+        dtype=np.int64,
+    )
+    return np.datetime_as_string((t_ms + offset_s * 1000).astype("datetime64[ms]"))
+
+
+def to_epoch_ms(value):
+    # Inverse of to_local_datetimes() for axis range strings from Plotly; a
+    # naive datetime is converted with the offset in effect at that time.
+    local = datetime.fromisoformat(str(value).replace(" ", "T"))
+    return int(local.timestamp() * 1000)
+
+
+def load_series(device, t_from=None, t_to=None):
+    """Stored fixes of a device, downsampled per series to MAX_POINTS."""
+    cols = store.scan(device, t_from, t_to)
+    x = cols["t"].astype(np.float64)
+    series = []
+    for field, _, _, downsample in SERIES:
+        keep = downsample(x, cols[field], MAX_POINTS)
+        series.append((to_local_datetimes(cols["t"][keep]), cols[field][keep]))
+    newest = int(cols["t"].max()) if cols["t"].size else 0
+    return series, newest
+
+
 @app.callback(
-    [Output("live-graph", "figure"), Output("text-info", "children")],
+    [Output("device-select", "options"), Output("device-select", "value")],
     [Input("interval-component", "n_intervals")],
+    [State("device-select", "value")],
 )
-def update_graph(n):
-    if not timestamps:
-        return go.Figure(), "Waiting for MQTT data..."
+def update_devices(n, selected):
+    devices = store.devices()
+    if selected is None and devices:
+        return devices, devices[:1]
+    return devices, no_update
+
 
-    # Line chart for lat, lng, battery
+@app.callback(
+    [
+        Output("live-graph", "figure"),
+        Output("sent-until", "data"),
+        Output("appended", "data"),
+    ],
+    [Input("device-select", "value"), Input("live-graph", "relayoutData")],
+)
+def render_graph(devices, relayout):
+    """Full redraw, only when the device selection or the viewport changes."""
+    if not devices:
+        return go.Figure(layout={"template": "plotly_dark"}), {}, 0
+
+    t_from = t_to = None
+    if relayout and "xaxis.range[0]" in relayout:
+        t_from = to_epoch_ms(relayout["xaxis.range[0]"])
+        t_to = to_epoch_ms(relayout["xaxis.range[1]"])
+    fig, sent = draw(devices, t_from, t_to)
+    return fig, sent, 0
+
+
+def draw(devices, t_from=None, t_to=None):
+    """Figure of the downsampled stored fixes, and the newest time sent."""
     fig = go.Figure()
-    fig.add_trace(
-        go.Scatter(
-            y=list(latitudes),
-            x=list(timestamps),
-            mode="lines",
-            name="Latitude",
-            line=dict(dash="dash", color="red"),
-        )
-    )
-    fig.add_trace(
-        go.Scatter(
-            y=list(longitudes),
-            x=list(timestamps),
-            mode="lines",
-            name="Longitude",
-            line=dict(dash="dash", color="blue"),
-        )
-    )
-    fig.add_trace(
-        go.Scatter(
-            y=list(batteries),
-            x=list(timestamps),
-            mode="lines",
-            name="Battery (%)",
-            line=dict(dash="dash", color="green"),
-        )
-    )
+    sent = {}
+    for device in devices:
+        series, newest = load_series(device, t_from, t_to)
+        for (field, label, dash, _), (x, y) in zip(SERIES, series):
+            fig.add_trace(
+                go.Scatter(
+                    x=x,
+                    y=y,
+                    mode="lines",
+                    name=f"{device} {label}",
+                    legendgroup=device,
+                    line=dict(dash=dash),
+                )
+            )
+        sent[device] = newest
     fig.update_layout(
         title="Latitude, Longitude, and Battery (Live)",
         xaxis_title="Time",
         yaxis_title="Value",
         template="plotly_dark",
+        # Keep zoom and legend state across incremental updates.
+        uirevision="live",
     )
+    # While zoomed in on history there is nothing to append.
+    if t_to is not None:
+        sent = {device: None for device in devices}
+    return fig, sent
 
-    # Display text data
-    info_text = (
-        f"ID: {latest_data['id']} | "
-        f"Date: {latest_data['date']} | "
-        f"Time: {latest_data['time']}"
-    )
 
-    return fig, info_text
+@app.callback(
+    [
+        Output("live-graph", "extendData"),
+        Output("live-graph", "figure", allow_duplicate=True),
+        Output("sent-until", "data", allow_duplicate=True),
+        Output("appended", "data", allow_duplicate=True),
+        Output("text-info", "children"),
+    ],
+    [Input("interval-component", "n_intervals")],
+    [
+        State("device-select", "value"),
+        State("sent-until", "data"),
+        State("appended", "data"),
+    ],
+    prevent_initial_call=True,
+)
+def append_points(n, devices, sent, appended):
+    """Send only the fixes stored since the previous tick.
+
+    Once as many points were appended as the history was downsampled to,
+    redraw instead, so that the live view stays cheap to render and still
+    shows the whole history.
+    """
+    if not latest_data["id"]:
+        info = "Waiting for MQTT data..."
+    else:
+        info = (
+            f"ID: {latest_data['id']} | "
+            f"Date: {latest_data['date']} | "
+            f"Time: {latest_data['time']}"
+        )
+    if not devices or not sent:
+        return no_update, no_update, no_update, no_update, info
+
+    xs, ys, traces = [], [], []
+    count = 0
+    for i, device in enumerate(devices):
+        since = sent.get(device)
+        if since is None:
+            continue
+        cols = store.scan(device, since + 1, None)
+        if cols["t"].size == 0:
+            continue
+        x = to_local_datetimes(cols["t"]).tolist()
+        for j, (field, _, _, _) in enumerate(SERIES):
+            xs.append(x)
+            ys.append(cols[field].tolist())
+            traces.append(i * len(SERIES) + j)
+        sent[device] = int(cols["t"].max())
+        count = max(count, cols["t"].size)
+    if not traces:
+        return no_update, no_update, no_update, no_update, info
+    if appended + count > MAX_POINTS:
+        fig, sent = draw(devices)
+        return no_update, fig, sent, 0, info
+    return (dict(x=xs, y=ys), traces), no_update, sent, appended + count, info
 
 
 if __name__ == "__main__":
-    app.run(host="0.0.0.0", port=8050, debug=True)
+    # The reloader would import this module twice and ingest every message
+    # into the store from two processes.
+    app.run(host="0.0.0.0", port=8050, debug=True, use_reloader=False)
@@ -0,0 +1,77 @@
+"""Local HTTP query API over the track index.
+
+Routes (all responses are JSON, times are epoch milliseconds):
+
+    GET /api/last
+        Last known position of every device.
+
+    GET /api/inside?lat_min=&lat_max=&lng_min=&lng_max=&t_from=&t_to=
+        Devices with at least one fix inside the box during [t_from, t_to].
+        t_from/t_to default to the beginning of time and now.
+
+    GET /api/track/<device>?t_from=&t_to=
+        Stored fixes of one device.
+"""
+
+import time
+
+from flask import jsonify, request
+
+from track_store import check_device
+
+
+def register(server, store, index):
+    @server.route("/api/last")
+    def api_last():
+        return jsonify(
+            {
+                device: {"t": t, "lat": lat, "lng": lng, "bat": bat}
+                for device, (t, lat, lng, bat) in index.last_positions().items()
+            }
+        )
+
+    @server.route("/api/inside")
+    def api_inside():
+        try:
+            box = _box()
+            t_from, t_to = _time_range()
+        except (KeyError, ValueError) as e:
+            return jsonify({"error": f"invalid query: {e}"}), 400
+        started = time.perf_counter()
+        devices = index.inside(*box, t_from, t_to)
+        return jsonify(
+            {
+                "devices": devices,
+                "elapsed_ms": (time.perf_counter() - started) * 1000,
+            }
+        )
+
+    @server.route("/api/track/<device>")
+    def api_track(device):
+        try:
+            check_device(device)
+            t_from, t_to = _time_range()
+        except ValueError as e:
+            return jsonify({"error": f"invalid query: {e}"}), 400
+        cols = store.scan(device, t_from, t_to)
+        return jsonify({name: values.tolist() for name, values in cols.items()})
+
+
+def _box():
+    lat_min, lat_max, lng_min, lng_max = (
+        float(request.args[name])
+        for name in ("lat_min", "lat_max", "lng_min", "lng_max")
+    )
+    if not -90 <= lat_min <= lat_max <= 90:
+        raise ValueError("latitudes reversed or outside [-90, 90]")
+    if not -180 <= lng_min <= lng_max <= 180:
+        raise ValueError("longitudes reversed or outside [-180, 180]")
+    return lat_min, lat_max, lng_min, lng_max
+
+
+def _time_range():
+    t_from = int(request.args.get("t_from", 0))
+    t_to = int(request.args.get("t_to", time.time() * 1000))
+    if t_from > t_to:
+        raise ValueError("t_from is after t_to")
+    return t_from, t_to
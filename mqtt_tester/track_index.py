@@ -0,0 +1,204 @@
+"""Spatial-temporal index over the track store.
+
+For every time partition the index keeps a uniform lat/lng grid. Each
+occupied cell maps the devices seen inside it to the first and last time
+they were there. A box/time query only visits the cells overlapping the box
+in the partitions overlapping the time range. Devices whose cell entries
+prove a hit (cell fully inside the box, visit fully inside the window) are
+accepted directly; the rest are verified against the stored points, using
+the block bounding boxes to skip blocks.
+
+The index also maintains the last known position of every device.
+"""
+
+import math
+import threading
+
+import numpy as np
+
+from track_store import BATTERY_SCALE, LATLNG_SCALE
+
+# Grid columns spanning 360 degrees of longitude at the finest cell size.
+_CELL_COLUMNS = 1 << 24
+
+
+class TrackIndex:
+    def __init__(self, store, cell_deg=0.05):
+        self.store = store
+        self.cell_deg = cell_deg
+        self._cell_fixed = cell_deg * LATLNG_SCALE
+        self._lock = threading.Lock()
+        # partition -> {cell -> {device -> [t_min, t_max]}}
+        self._partitions = {}
+        # device -> (t, lat, lng, bat)
+        self._last = {}
+        # Listen before reading the store, so that no write falls between the
+        # two. A write seen by both is indexed twice, which changes nothing.
+        store.add_listener(self._on_write)
+        self.rebuild()
+
+    # ----------------------------------------------------------------- build
+
+    def rebuild(self):
+        """Index everything already in the store."""
+        with self._lock:
+            self._partitions.clear()
+            self._last.clear()
+        for device in self.store.devices():
+            for partition, block in self.store.blocks(device):
+                self._on_write(
+                    device,
+                    partition,
+                    block.column("t"),
+                    block.column("lat"),
+                    block.column("lng"),
+                    block.column("bat"),
+                )
+
+    def _cells(self, lat, lng):
+        rows = np.floor_divide(lat + 90 * LATLNG_SCALE, self._cell_fixed)
+        cols = np.floor_divide(lng + 180 * LATLNG_SCALE, self._cell_fixed)
+        return rows.astype(np.int64) * _CELL_COLUMNS + cols.astype(np.int64)
+
+    def _on_write(self, device, partition, t, lat, lng, bat):
+        cells = self._cells(lat, lng)
+        order = np.argsort(cells, kind="stable")
+        cells, ts = cells[order], t[order]
+        uniq, starts = np.unique(cells, return_index=True)
+        t_min = np.minimum.reduceat(ts, starts)
+        t_max = np.maximum.reduceat(ts, starts)
+        newest = int(np.argmax(t))
+        with self._lock:
+            grid = self._partitions.setdefault(partition, {})
+            for cell, lo, hi in zip(uniq.tolist(), t_min.tolist(), t_max.tolist()):
+                entry = grid.setdefault(cell, {})
+                span = entry.get(device)
+                if span is None:
+                    entry[device] = [lo, hi]
+                else:
+                    span[0] = min(span[0], lo)
+                    span[1] = max(span[1], hi)
+            last = self._last.get(device)
+            if last is None or t[newest] >= last[0]:
+                self._last[device] = (
+                    int(t[newest]),
+                    int(lat[newest]) / LATLNG_SCALE,
+                    int(lng[newest]) / LATLNG_SCALE,
+                    int(bat[newest]) / BATTERY_SCALE,
+                )
+
+    # ----------------------------------------------------------------- query
+
+    def last_positions(self):
+        """Last known fix of every device as {device: (t, lat, lng, bat)}."""
+        with self._lock:
+            return dict(self._last)
+
+    def inside(self, lat_min, lat_max, lng_min, lng_max, t_from, t_to):
+        """Devices with at least one fix inside the box during [t_from, t_to].
+
+        Times are in ms, coordinates in degrees. Returns a sorted list.
+        """
+        box = _FixedBox(lat_min, lat_max, lng_min, lng_max)
+        row_lo, row_hi = self._span(box.lat_min, box.lat_max, 90)
+        col_lo, col_hi = self._span(box.lng_min, box.lng_max, 180)
+        cell_count = (row_hi - row_lo + 1) * (col_hi - col_lo + 1)
+
+        hits = set()
+        candidates = set()
+        partition_ms = self.store.partition_ms
+        with self._lock:
+            for partition, grid in self._partitions.items():
+                if partition > t_to or partition + partition_ms <= t_from:
+                    continue
+                if cell_count <= len(grid):
+                    cells = (
+                        (row * _CELL_COLUMNS + col, grid.get(row * _CELL_COLUMNS + col))
+                        for row in range(row_lo, row_hi + 1)
+                        for col in range(col_lo, col_hi + 1)
+                    )
+                else:
+                    cells = grid.items()
+                for cell, entry in cells:
+                    if not entry:
+                        continue
+                    row, col = divmod(cell, _CELL_COLUMNS)
+                    if not (row_lo <= row <= row_hi and col_lo <= col <= col_hi):
+                        continue
+                    covered = self._cell_inside(row, col, box)
+                    for device, (lo, hi) in entry.items():
+                        if device in hits or hi < t_from or lo > t_to:
+                            continue
+                        if covered and t_from <= lo and hi <= t_to:
+                            hits.add(device)
+                        else:
+                            candidates.add(device)
+        for device in candidates - hits:
+            if self._verify(device, box, t_from, t_to):
+                hits.add(device)
+        return sorted(hits)
+
+    def _span(self, lo, hi, offset):
+        first = int((lo + offset * LATLNG_SCALE) // self._cell_fixed)
+        last = int((hi + offset * LATLNG_SCALE) // self._cell_fixed)
+        return first, last
+
+    def _cell_inside(self, row, col, box):
+        lat0 = row * self._cell_fixed - 90 * LATLNG_SCALE
+        lng0 = col * self._cell_fixed - 180 * LATLNG_SCALE
+        return (
+            box.lat_min <= lat0
+            and lat0 + self._cell_fixed <= box.lat_max
+            and box.lng_min <= lng0
+            and lng0 + self._cell_fixed <= box.lng_max
+        )
+
+    def _verify(self, device, box, t_from, t_to):
+        for _, block in self.store.blocks(device, t_from, t_to):
+            if (
+                block.lat_max < box.lat_min
+                or block.lat_min > box.lat_max
+                or block.lng_max < box.lng_min
+                or block.lng_min > box.lng_max
+            ):
+                continue
+            if _block_hit(block, box, t_from, t_to):
+                return True
+        return False
+
+
+def brute_force_inside(store, lat_min, lat_max, lng_min, lng_max, t_from, t_to):
+    """Reference answer for TrackIndex.inside() that scans every device."""
+    box = _FixedBox(lat_min, lat_max, lng_min, lng_max)
+    hits = []
+    for device in store.devices():
+        for _, block in store.blocks(device, t_from, t_to):
+            if _block_hit(block, box, t_from, t_to):
+                hits.append(device)
+                break
+    return sorted(hits)
+
+
+class _FixedBox:
+    __slots__ = ("lat_min", "lat_max", "lng_min", "lng_max")
+
+    def __init__(self, lat_min, lat_max, lng_min, lng_max):
+        self.lat_min = math.floor(lat_min * LATLNG_SCALE)
+        self.lat_max = math.ceil(lat_max * LATLNG_SCALE)
+        self.lng_min = math.floor(lng_min * LATLNG_SCALE)
+        self.lng_max = math.ceil(lng_max * LATLNG_SCALE)
+
+
+def _block_hit(block, box, t_from, t_to):
+    t = block.column("t")
+    lat = block.column("lat")
+    lng = block.column("lng")
+    mask = (
+        (t >= t_from)
+        & (t <= t_to)
+        & (lat >= box.lat_min)
+        & (lat <= box.lat_max)
+        & (lng >= box.lng_min)
+        & (lng <= box.lng_max)
+    )
+    return bool(mask.any())
@@ -0,0 +1,586 @@
+"""Append-only columnar track store.
+
+Layout on disk::
+
+    <root>/<device_id>/<partition_start_ms>.seg
+
+Each segment holds the fixes of one device for one time partition as a
+sequence of self-describing blocks. A block stores its four columns (time,
+latitude, longitude, battery) delta-encoded against per-block base values,
+each column using the narrowest integer type that fits its deltas. Blocks are
+only ever appended; a background compactor rewrites sealed partitions into
+few large, time-sorted blocks.
+
+Reads map segments with mmap and build numpy views directly on the mapped
+pages, so scanning never copies the encoded data. Block headers carry the
+time range and bounding box, which lets scans skip blocks without touching
+their columns.
+"""
+
+import mmap
+import os
+import re
+import struct
+import threading
+import time
+import zlib
+from collections import OrderedDict
+
+import numpy as np
+
+# Fixed-point scales of the stored columns.
+LATLNG_SCALE = 10_000_000  # 1e-7 degree
+BATTERY_SCALE = 100  # 0.01 %
+
+# Segment file header: magic, partition start (ms).
+SEGMENT_MAGIC = b"GTSEG\x01\x00\x00"
+SEGMENT_HEADER = struct.Struct("<8sq")
+
+# Block header: magic, count, first/last time, base lat/lng/battery, column
+# dtype codes, bounding box, payload length, payload CRC-32.
+BLOCK_MAGIC = b"BLK1"
+BLOCK_HEADER = struct.Struct("<4sIqqiihBBBBxxiiiiII")
+
+# Column payloads are padded so every numpy view is 8-byte aligned.
+COLUMN_ALIGN = 8
+
+# Column dtype codes, narrowest first.
+DTYPES = (np.int8, np.int16, np.int32, np.int64)
+DTYPE_LIMITS = [(np.iinfo(d).min, np.iinfo(d).max) for d in DTYPES]
+
+# fsync policies.
+FSYNC_NEVER = "never"  # leave it to the OS
+FSYNC_BLOCK = "block"  # after every block write
+FSYNC_INTERVAL = "interval"  # dirty segments every fsync_interval_s
+
+FIELDS = ("t", "lat", "lng", "bat")
+
+# Device ids become directory names, so only a safe subset is accepted.
+DEVICE_ID = re.compile(r"[A-Za-z0-9_-]{1,64}")
+
+
+def check_device(device):
+    """Raise ValueError unless device is a valid device id."""
+    if not isinstance(device, str) or not DEVICE_ID.fullmatch(device):
+        raise ValueError(f"invalid device id {device!r}")
+
+
+def _pad(n):
+    return (n + COLUMN_ALIGN - 1) & ~(COLUMN_ALIGN - 1)
+
+
+def _dtype_code(deltas):
+    if deltas.size == 0:
+        return 0
+    lo, hi = int(deltas.min()), int(deltas.max())
+    for code, (dmin, dmax) in enumerate(DTYPE_LIMITS):
+        if dmin <= lo and hi <= dmax:
+            return code
+    raise ValueError("delta out of int64 range")
+
+
+def encode_block(t, lat, lng, bat):
+    """Encode one block from quantized int64 columns sorted by time."""
+    count = len(t)
+    columns = []
+    codes = []
+    bases = []
+    for values in (t, lat, lng, bat):
+        base = int(values[0])
+        deltas = np.diff(values, prepend=values[:1])
+        code = _dtype_code(deltas)
+        raw = deltas.astype(DTYPES[code]).tobytes()
+        columns.append(raw + b"\x00" * (_pad(len(raw)) - len(raw)))
+        codes.append(code)
+        bases.append(base)
+    payload = b"".join(columns)
+    header = BLOCK_HEADER.pack(
+        BLOCK_MAGIC,
+        count,
+        bases[0],
+        int(t[-1]),
+        bases[1],
+        bases[2],
+        bases[3],
+        *codes,
+        int(lat.min()),
+        int(lat.max()),
+        int(lng.min()),
+        int(lng.max()),
+        len(payload),
+        zlib.crc32(payload),
+    )
+    return header + payload
+
+
+class BlockView:
+    """A block inside a mapped segment; columns are decoded lazily."""
+
+    __slots__ = (
+        "buf",
+        "offset",
+        "count",
+        "t_first",
+        "t_last",
+        "bases",
+        "codes",
+        "lat_min",
+        "lat_max",
+        "lng_min",
+        "lng_max",
+    )
+
+    def __init__(self, buf, offset, fields):
+        (
+            _,
+            self.count,
+            t0,
+            self.t_last,
+            lat0,
+            lng0,
+            bat0,
+            c_t,
+            c_lat,
+            c_lng,
+            c_bat,
+            self.lat_min,
+            self.lat_max,
+            self.lng_min,
+            self.lng_max,
+            _,
+            _,
+        ) = fields
+        self.buf = buf
+        self.offset = offset + BLOCK_HEADER.size
+        self.t_first = t0
+        self.bases = (t0, lat0, lng0, bat0)
+        self.codes = (c_t, c_lat, c_lng, c_bat)
+
+    @property
+    def t_min(self):
+        # Blocks are written sorted by time.
+        return self.t_first
+
+    @property
+    def t_max(self):
+        return self.t_last
+
+    def deltas(self, field):
+        """Zero-copy view of a column's deltas on the mapped pages."""
+        offset = self.offset
+        for i, name in enumerate(FIELDS):
+            dtype = DTYPES[self.codes[i]]
+            if name == field:
+                return np.frombuffer(self.buf, dtype, self.count, offset)
+            offset += _pad(self.count * np.dtype(dtype).itemsize)
+        raise KeyError(field)
+
+    def column(self, field):
+        """Decoded int64 column in stored (fixed-point) units."""
+        i = FIELDS.index(field)
+        out = np.cumsum(self.deltas(field), dtype=np.int64)
+        out += self.bases[i]
+        return out
+
+
+class Segment:
+    """Read side of a single segment file, backed by a shared mmap."""
+
+    def __init__(self, path):
+        self.path = path
+        self._map = None
+        self._size = 0
+        self._blocks = []
+
+    def blocks(self):
+        """Return the blocks of the segment, remapping if the file grew."""
+        try:
+            size = os.path.getsize(self.path)
+        except FileNotFoundError:
+            return []
+        if size != self._size:
+            self._remap(size)
+        return self._blocks
+
+    def _remap(self, size):
+        with open(self.path, "rb") as f:
+            if size == 0:
+                self._map, self._size, self._blocks = None, 0, []
+                return
+            # Replacing the mapping leaves older numpy views valid; the old
+            # map is released once the last view referencing it is gone.
+            buf = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        self._map = buf
+        self._size = size
+        self._blocks = [block for _, _, block in _parse_blocks(buf, size)]
+
+
+def _parse_blocks(buf, size, verify=False):
+    if size < SEGMENT_HEADER.size:
+        return
+    magic, _ = SEGMENT_HEADER.unpack_from(buf, 0)
+    if magic != SEGMENT_MAGIC:
+        return
+    offset = SEGMENT_HEADER.size
+    while offset + BLOCK_HEADER.size <= size:
+        fields = BLOCK_HEADER.unpack_from(buf, offset)
+        payload_len, crc = fields[-2], fields[-1]
+        end = offset + BLOCK_HEADER.size + payload_len
+        if fields[0] != BLOCK_MAGIC or end > size:
+            # Torn write at the tail.
+            return
+        if verify and zlib.crc32(buf[offset + BLOCK_HEADER.size : end]) != crc:
+            return
+        yield offset, end, BlockView(buf, offset, fields)
+        offset = end
+
+
+def _parse_valid_length(path):
+    """Length of the intact prefix of a segment, verifying checksums."""
+    size = os.path.getsize(path)
+    if size < SEGMENT_HEADER.size:
+        return 0
+    with open(path, "rb") as f:
+        buf = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    try:
+        end = SEGMENT_HEADER.size
+        for _, block_end, _ in _parse_blocks(buf, size, verify=True):
+            end = block_end
+        return end
+    finally:
+        buf.close()
+
+
+class _Buffer:
+    """Pending fixes of one device that have not been written yet."""
+
+    __slots__ = ("t", "lat", "lng", "bat", "since")
+
+    def __init__(self):
+        self.t, self.lat, self.lng, self.bat = [], [], [], []
+        self.since = time.monotonic()
+
+    def __len__(self):
+        return len(self.t)
+
+
+class TrackStore:
+    """Per-device, time-partitioned, append-only columnar store."""
+
+    def __init__(
+        self,
+        root,
+        partition_s=3600,
+        batch_size=1024,
+        flush_interval_s=1.0,
+        fsync=FSYNC_INTERVAL,
+        fsync_interval_s=1.0,
+        compact_interval_s=60.0,
+        compact_block_size=65536,
+        max_open_files=256,
+        background=True,
+    ):
+        if fsync not in (FSYNC_NEVER, FSYNC_BLOCK, FSYNC_INTERVAL):
+            raise ValueError(f"unknown fsync policy {fsync!r}")
+        self.root = root
+        self.partition_ms = int(partition_s * 1000)
+        self.batch_size = batch_size
+        self.flush_interval_s = flush_interval_s
+        self.fsync = fsync
+        self.fsync_interval_s = fsync_interval_s
+        self.compact_interval_s = compact_interval_s
+        self.compact_block_size = compact_block_size
+        self.max_open_files = max_open_files
+
+        os.makedirs(root, exist_ok=True)
+        self._lock = threading.RLock()
+        self._buffers = {}
+        self._writers = OrderedDict()  # (device, partition) -> file
+        self._dirty = set()
+        self._segments = {}  # path -> Segment
+        self._listeners = []
+        self._stop = threading.Event()
+        self._threads = []
+        self._recover()
+        if background:
+            for target in (self._flush_loop, self._compact_loop):
+                thread = threading.Thread(target=target, daemon=True)
+                thread.start()
+                self._threads.append(thread)
+
+    # ------------------------------------------------------------------ write
+
+    def append(self, device, t_ms, lat, lng, bat):
+        """Buffer a single fix given in ms, degrees and percent."""
+        check_device(device)
+        with self._lock:
+            buf = self._buffers.get(device)
+            if buf is None:
+                buf = self._buffers[device] = _Buffer()
+            buf.t.append(int(t_ms))
+            buf.lat.append(round(lat * LATLNG_SCALE))
+            buf.lng.append(round(lng * LATLNG_SCALE))
+            buf.bat.append(round(bat * BATTERY_SCALE))
+            if len(buf) >= self.batch_size:
+                self._flush_device(device)
+
+    def append_many(self, device, t_ms, lat, lng, bat):
+        """Write a batch of fixes given as arrays, bypassing the buffer."""
+        check_device(device)
+        t = np.asarray(t_ms, dtype=np.int64)
+        lat = np.rint(np.asarray(lat, dtype=np.float64) * LATLNG_SCALE)
+        lng = np.rint(np.asarray(lng, dtype=np.float64) * LATLNG_SCALE)
+        bat = np.rint(np.asarray(bat, dtype=np.float64) * BATTERY_SCALE)
+        with self._lock:
+            self._write(
+                device, t, lat.astype(np.int64), lng.astype(np.int64),
+                bat.astype(np.int64),
+            )
+
+    def flush(self, sync=False):
+        """Write out all buffered fixes; optionally fsync every segment."""
+        with self._lock:
+            for device in list(self._buffers):
+                self._flush_device(device)
+            if sync:
+                self._sync_dirty()
+
+    def close(self):
+        self._stop.set()
+        for thread in self._threads:
+            thread.join()
+        with self._lock:
+            self.flush(sync=self.fsync != FSYNC_NEVER)
+            for f in self._writers.values():
+                f.close()
+            self._writers.clear()
+
+    def _flush_device(self, device):
+        buf = self._buffers.pop(device, None)
+        if not buf:
+            return
+        self._write(
+            device,
+            np.array(buf.t, dtype=np.int64),
+            np.array(buf.lat, dtype=np.int64),
+            np.array(buf.lng, dtype=np.int64),
+            np.array(buf.bat, dtype=np.int64),
+        )
+
+    def _write(self, device, t, lat, lng, bat):
+        if t.size == 0:
+            return
+        order = np.argsort(t, kind="stable")
+        t, lat, lng, bat = t[order], lat[order], lng[order], bat[order]
+        parts = t // self.partition_ms
+        bounds = np.flatnonzero(np.diff(parts)) + 1
+        starts = np.concatenate(([0], bounds))
+        ends = np.concatenate((bounds, [t.size]))
+        for start, end in zip(starts, ends):
+            partition = int(parts[start]) * self.partition_ms
+            f = self._writer(device, partition)
+            for lo in range(start, end, self.compact_block_size):
+                hi = min(lo + self.compact_block_size, end)
+                f.write(encode_block(t[lo:hi], lat[lo:hi], lng[lo:hi], bat[lo:hi]))
+            f.flush()
+            if self.fsync == FSYNC_BLOCK:
+                os.fsync(f.fileno())
+            else:
+                self._dirty.add((device, partition))
+            for listener in self._listeners:
+                listener(device, partition, t[start:end], lat[start:end],
+                         lng[start:end], bat[start:end])
+
+    def add_listener(self, listener):
+        """Call listener(device, partition, t, lat, lng, bat) on every write.
+
+        Columns are passed in stored (fixed-point) units. Listeners run with
+        the store lock held and must not call back into the store.
+        """
+        with self._lock:
+            self._listeners.append(listener)
+
+    def _writer(self, device, partition):
+        key = (device, partition)
+        f = self._writers.get(key)
+        if f is not None:
+            self._writers.move_to_end(key)
+            return f
+        while len(self._writers) >= self.max_open_files:
+            old_key, old = self._writers.popitem(last=False)
+            if old_key in self._dirty and self.fsync != FSYNC_NEVER:
+                os.fsync(old.fileno())
+                self._dirty.discard(old_key)
+            old.close()
+        path = self.segment_path(device, partition)
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        f = open(path, "ab")
+        if f.tell() == 0:
+            f.write(SEGMENT_HEADER.pack(SEGMENT_MAGIC, partition))
+        self._writers[key] = f
+        return f
+
+    def _sync_dirty(self):
+        for key in list(self._dirty):
+            f = self._writers.get(key)
+            if f is not None:
+                os.fsync(f.fileno())
+        self._dirty.clear()
+
+    # ------------------------------------------------------------------- read
+
+    def devices(self):
+        with self._lock:
+            buffered = set(self._buffers)
+        try:
+            stored = {
+                d for d in os.listdir(self.root)
+                if os.path.isdir(os.path.join(self.root, d))
+            }
+        except FileNotFoundError:
+            stored = set()
+        return sorted(stored | buffered)
+
+    def partitions(self, device):
+        """Sorted partition start times (ms) stored for a device."""
+        try:
+            names = os.listdir(os.path.join(self.root, device))
+        except FileNotFoundError:
+            return []
+        return sorted(int(n[:-4]) for n in names if n.endswith(".seg"))
+
+    def segment_path(self, device, partition):
+        return os.path.join(self.root, device, f"{partition}.seg")
+
+    def blocks(self, device, t_from=None, t_to=None):
+        """Yield (partition, BlockView) overlapping [t_from, t_to]."""
+        for partition in self.partitions(device):
+            if t_to is not None and partition > t_to:
+                break
+            if t_from is not None and partition + self.partition_ms <= t_from:
+                continue
+            for block in self._segment(device, partition).blocks():
+                if t_from is not None and block.t_max < t_from:
+                    continue
+                if t_to is not None and block.t_min > t_to:
+                    continue
+                yield partition, block
+
+    def scan(self, device, t_from=None, t_to=None, fields=FIELDS):
+        """Decode the stored fixes of a device inside [t_from, t_to].
+
+        Returns a dict of numpy arrays. Times are in ms, positions in
+        degrees and battery in percent. Unflushed fixes are not included.
+        """
+        chunks = {name: [] for name in fields}
+        for _, block in self.blocks(device, t_from, t_to):
+            t = block.column("t")
+            mask = None
+            if (t_from is not None and block.t_min < t_from) or (
+                t_to is not None and block.t_max > t_to
+            ):
+                lo = -np.inf if t_from is None else t_from
+                hi = np.inf if t_to is None else t_to
+                mask = (t >= lo) & (t <= hi)
+            for name in fields:
+                values = t if name == "t" else block.column(name)
+                chunks[name].append(values if mask is None else values[mask])
+        out = {}
+        for name in fields:
+            values = (
+                np.concatenate(chunks[name]) if chunks[name]
+                else np.empty(0, dtype=np.int64)
+            )
+            if name in ("lat", "lng"):
+                values = values / LATLNG_SCALE
+            elif name == "bat":
+                values = values / BATTERY_SCALE
+            out[name] = values
+        return out
+
+    def _segment(self, device, partition):
+        path = self.segment_path(device, partition)
+        seg = self._segments.get(path)
+        if seg is None:
+            seg = self._segments[path] = Segment(path)
+        return seg
+
+    # -------------------------------------------------------------- recovery
+
+    def _recover(self):
+        """Truncate torn blocks left behind by a crash."""
+        for device in self.devices():
+            for partition in self.partitions(device):
+                path = self.segment_path(device, partition)
+                valid = _parse_valid_length(path)
+                if valid < os.path.getsize(path):
+                    with open(path, "r+b") as f:
+                        f.truncate(valid)
+
+    # ------------------------------------------------------------ background
+
+    def _flush_loop(self):
+        last_sync = time.monotonic()
+        period = min(self.flush_interval_s, self.fsync_interval_s) / 2
+        while not self._stop.wait(period):
+            now = time.monotonic()
+            with self._lock:
+                for device, buf in list(self._buffers.items()):
+                    if now - buf.since >= self.flush_interval_s:
+                        self._flush_device(device)
+                if (
+                    self.fsync == FSYNC_INTERVAL
+                    and now - last_sync >= self.fsync_interval_s
+                ):
+                    self._sync_dirty()
+                    last_sync = now
+
+    def _compact_loop(self):
+        while not self._stop.wait(self.compact_interval_s):
+            self.compact()
+
+    def compact(self, min_blocks=2, sealed_only=True):
+        """Rewrite fragmented partitions into time-sorted large blocks.
+
+        Only sealed partitions (whose time range has passed and which have
+        not been written for a partition length) are touched unless
+        sealed_only is False. Returns the number of partitions rewritten.
+        """
+        now_ms = int(time.time() * 1000)
+        rewritten = 0
+        for device in self.devices():
+            for partition in self.partitions(device):
+                if self._stop.is_set():
+                    return rewritten
+                if sealed_only and partition + 2 * self.partition_ms > now_ms:
+                    continue
+                if self._compact_partition(device, partition, min_blocks):
+                    rewritten += 1
+        return rewritten
+
+    def _compact_partition(self, device, partition, min_blocks):
+        path = self.segment_path(device, partition)
+        with self._lock:
+            blocks = Segment(path).blocks()
+            if len(blocks) < min_blocks:
+                return False
+            key = (device, partition)
+            f = self._writers.pop(key, None)
+            if f is not None:
+                f.close()
+            self._dirty.discard(key)
+            cols = [np.concatenate([b.column(n) for b in blocks]) for n in FIELDS]
+            order = np.argsort(cols[0], kind="stable")
+            cols = [c[order] for c in cols]
+            tmp = path + ".tmp"
+            with open(tmp, "wb") as out:
+                out.write(SEGMENT_HEADER.pack(SEGMENT_MAGIC, partition))
+                for lo in range(0, cols[0].size, self.compact_block_size):
+                    hi = lo + self.compact_block_size
+                    out.write(encode_block(*(c[lo:hi] for c in cols)))
+                out.flush()
+                os.fsync(out.fileno())
+            os.replace(tmp, path)
+            # Readers holding the old mapping keep reading the old inode.
+            self._segments.pop(path, None)
+            return True
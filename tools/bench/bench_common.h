@@ -0,0 +1,35 @@
+#ifndef _BENCH_COMMON_H_
+#define _BENCH_COMMON_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief Monotonic clock in nanoseconds.
+ */
+static inline uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief xorshift64* pseudo-random generator.
+ */
+static inline uint64_t bench_rand(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545F4914F6CDD1Dull;
+}
+
+/**
+ * @brief Uniform random float in [lo, hi).
+ */
+static inline float bench_uniform(uint64_t *state, float lo, float hi) {
+  return lo + (hi - lo) * (float)((bench_rand(state) >> 40) / 16777216.0);
+}
+
+#endif
@@ -0,0 +1,324 @@
+/**
+ * Compression ratio and CPU time of batched uploads.
+ *
+ * Generates the messages the firmware queues for a moving device (JSON fixes
+ * as published over MQTT, binary fixes as sent over UDP), groups them into
+ * batches of increasing size and compresses every batch with the firmware's
+ * codec (components/mqtt_mgt/mqtt_mgt_lz.c). Reports, per batch size:
+ *   - uncompressed and compressed bytes per message, and the ratio,
+ *   - encode and decode time per batch and per input byte,
+ * and checks that every batch decompresses to its input.
+ *
+ * The firmware logs the cycles spent compressing every batch at debug level,
+ * for the same measurement on the target.
+ *
+ * Usage: compress_bench [-t track.csv] [-n fixes] [-i interval_s] [-r]
+ */
+#include "bench_common.h"
+#include "mqtt_mgt_lz.h"
+#include "payload_encoder.h"
+#include "track.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Center and radius of the synthetic walk (degrees).
+ */
+#define BENCH_LAT0 (13.7563)
+#define BENCH_LNG0 (100.5018)
+#define BENCH_RADIUS_DEG (0.05)
+
+/**
+ * @brief Device identifier of the generated messages.
+ */
+#define BENCH_DEVICE_ID "ESP_01"
+
+/**
+ * @brief Time of the first fix (2026-01-01T00:00:00Z).
+ */
+#define BENCH_START_S (1767225600u)
+
+/**
+ * @brief Minimum input compressed per measurement, for stable timings.
+ */
+#define BENCH_MIN_BYTES (4u << 20)
+
+/********************************************************************************
+ *
+ *                              Type Declarations
+ *
+ ********************************************************************************/
+
+/**
+ * @brief Messages of one encoding, stored back to back.
+ */
+typedef struct {
+  const char *name; ///< Encoding name
+  uint8_t *data;    ///< Messages
+  size_t *offset;   ///< Offset of each message in data
+  size_t *len;      ///< Length of each message
+  size_t count;     ///< Number of messages
+} bench_stream_t;
+
+/********************************************************************************
+ *
+ *                              Private Global Variables
+ *
+ ********************************************************************************/
+
+static const size_t g_batch_sizes[] = {1, 2, 5, 10, 20, 64, 256};
+
+/********************************************************************************
+ *
+ *                              Private Function Definitions
+ *
+ ********************************************************************************/
+static int bench_stream_alloc(bench_stream_t *stream, const char *name,
+                              size_t count, size_t msg_max_len) {
+  stream->name = name;
+  stream->data = malloc(count * msg_max_len);
+  stream->offset = malloc(count * sizeof(size_t));
+  stream->len = malloc(count * sizeof(size_t));
+  stream->count = 0;
+  return NULL == stream->data || NULL == stream->offset || NULL == stream->len
+             ? -1
+             : 0;
+}
+
+static void bench_stream_push(bench_stream_t *stream, const void *msg,
+                              size_t len) {
+  size_t offset =
+      stream->count ? stream->offset[stream->count - 1] +
+                          stream->len[stream->count - 1]
+                    : 0;
+  memcpy(stream->data + offset, msg, len);
+  stream->offset[stream->count] = offset;
+  stream->len[stream->count] = len;
+  stream->count++;
+}
+
+static void bench_stream_free(bench_stream_t *stream) {
+  free(stream->data);
+  free(stream->offset);
+  free(stream->len);
+}
+
+// Compress messages [first, first + n) as one batch; returns its length.
+static int bench_compress(const bench_stream_t *stream, size_t first, size_t n,
+                          mqtt_mgt_lz_encoder_t *enc, uint8_t *out,
+                          size_t size) {
+  if (0 != mqtt_mgt_lz_batch_begin(enc, out, size)) {
+    return -1;
+  }
+  for (size_t i = first; i < first + n; i++) {
+    if (0 != mqtt_mgt_lz_batch_add(enc, stream->data + stream->offset[i],
+                                   stream->len[i])) {
+      return -1;
+    }
+  }
+  return mqtt_mgt_lz_batch_end(enc);
+}
+
+// Whether a decompressed batch holds messages [first, first + n).
+static bool bench_verify(const bench_stream_t *stream, size_t first, size_t n,
+                         const uint8_t *raw, size_t raw_len) {
+  size_t offset = 0;
+  size_t len;
+  const uint8_t *msg;
+  size_t i = first;
+  while (NULL != (msg = mqtt_mgt_lz_batch_next(raw, raw_len, &offset, &len))) {
+    if (i == first + n || len != stream->len[i] ||
+        0 != memcmp(msg, stream->data + stream->offset[i], len)) {
+      return false;
+    }
+    i++;
+  }
+  return i == first + n;
+}
+
+static int bench_run(const bench_stream_t *stream, size_t batch) {
+  size_t batches = stream->count / batch;
+  if (0 == batches) {
+    return 0;
+  }
+  size_t raw_size = batch * (MQTT_MGT_LZ_BATCH_MSG_MAX_LEN + 1);
+  size_t out_size =
+      MQTT_MGT_LZ_BATCH_HEADER_LEN + MQTT_MGT_LZ_BOUND(raw_size);
+  uint8_t *out = malloc(out_size);
+  uint8_t *raw = malloc(raw_size);
+  mqtt_mgt_lz_encoder_t enc;
+  if (NULL == out || NULL == raw) {
+    free(out);
+    free(raw);
+    return -1;
+  }
+
+  // One pass for the sizes and the round trip check. Raw bytes are what
+  // the messages take uncompressed, without the batch's length prefixes.
+  size_t raw_bytes = 0;
+  size_t packed_bytes = 0;
+  for (size_t b = 0; b < batches; b++) {
+    int len = bench_compress(stream, b * batch, batch, &enc, out, out_size);
+    int raw_len = len < 0 ? -1
+                          : mqtt_mgt_lz_batch_decode(out, (size_t)len, raw,
+                                                     raw_size);
+    if (raw_len < 0 ||
+        !bench_verify(stream, b * batch, batch, raw, (size_t)raw_len)) {
+      fprintf(stderr, "Round trip failed (%s, batch %zu)\n", stream->name,
+              batch);
+      free(out);
+      free(raw);
+      return -1;
+    }
+    for (size_t i = b * batch; i < (b + 1) * batch; i++) {
+      raw_bytes += stream->len[i];
+    }
+    packed_bytes += (size_t)len;
+  }
+
+  // Timed passes over the same batches, repeated for at least
+  // BENCH_MIN_BYTES of input.
+  size_t rounds = BENCH_MIN_BYTES / raw_bytes + 1;
+  uint64_t start = bench_now_ns();
+  for (size_t r = 0; r < rounds; r++) {
+    for (size_t b = 0; b < batches; b++) {
+      bench_compress(stream, b * batch, batch, &enc, out, out_size);
+    }
+  }
+  double encode_ns = (double)(bench_now_ns() - start) / (double)rounds;
+
+  int last = bench_compress(stream, 0, batch, &enc, out, out_size);
+  start = bench_now_ns();
+  size_t decode_rounds = rounds * batches;
+  for (size_t r = 0; r < decode_rounds; r++) {
+    mqtt_mgt_lz_batch_decode(out, (size_t)last, raw, raw_size);
+  }
+  double decode_ns = (double)(bench_now_ns() - start) / (double)decode_rounds;
+  double first_raw = (double)enc.in_len;
+
+  double msgs = (double)(batches * batch);
+  printf("%-6s %6zu %9.1f %9.1f %7.2f %10.1f %8.1f %10.1f\n", stream->name,
+         batch, (double)raw_bytes / msgs, (double)packed_bytes / msgs,
+         (double)raw_bytes / (double)packed_bytes,
+         encode_ns / (double)batches / 1000.0, encode_ns / (double)raw_bytes,
+         decode_ns / first_raw);
+  free(out);
+  free(raw);
+  return 0;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-t track.csv] [-n fixes] [-i interval_s] [-r]\n"
+          "  -t  replay a recorded \"lat,lng\" track instead of a random walk\n"
+          "  -n  number of fixes generated (default 20480)\n"
+          "  -i  seconds between fixes (default 5)\n"
+          "  -r  random battery level on every fix, like the firmware's "
+          "simulator\n",
+          prog);
+}
+
+int main(int argc, char **argv) {
+  const char *track_path = NULL;
+  size_t count = 20480;
+  unsigned interval_s = 5;
+  bool random_battery = false;
+  int opt;
+  while (-1 != (opt = getopt(argc, argv, "t:n:i:rh"))) {
+    switch (opt) {
+    case 't':
+      track_path = optarg;
+      break;
+    case 'n':
+      count = (size_t)strtoul(optarg, NULL, 10);
+      break;
+    case 'i':
+      interval_s = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      random_battery = true;
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (0 == count || 0 == interval_s) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  track_t track = {0};
+  if (NULL != track_path && 0 != track_load_csv(&track, track_path)) {
+    fprintf(stderr, "Failed to load %s\n", track_path);
+    return EXIT_FAILURE;
+  }
+  track_cursor_t cursor;
+  track_cursor_init(&cursor, track_path ? &track : NULL, 0x4C5A5353ull,
+                    BENCH_LAT0, BENCH_LNG0, BENCH_RADIUS_DEG);
+
+  bench_stream_t json;
+  bench_stream_t binary;
+  if (0 != bench_stream_alloc(&json, "json", count,
+                              PAYLOAD_ENCODER_MSG_MAX_LEN) ||
+      0 != bench_stream_alloc(&binary, "binary", count,
+                              PAYLOAD_ENCODER_BIN_LEN)) {
+    fprintf(stderr, "Out of memory\n");
+    return EXIT_FAILURE;
+  }
+  uint64_t rng = 0x42415454ull;
+  for (size_t i = 0; i < count; i++) {
+    float lat, lng, battery;
+    track_cursor_next(&cursor, interval_s, &lat, &lng, &battery);
+    if (random_battery) {
+      battery = (float)(bench_rand(&rng) % 10001) / 100.0f;
+    }
+    payload_fix_t fix;
+    payload_fix_from_degrees(&fix, lat, lng, battery);
+    uint32_t time_s = BENCH_START_S + (uint32_t)(i * interval_s);
+
+    // Date and time as the firmware formats them (UTC here).
+    time_t t = (time_t)time_s;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char date[16];
+    char clock[16];
+    strftime(date, sizeof(date), "%Y-%m-%d", &tm);
+    strftime(clock, sizeof(clock), "%H:%M:%S", &tm);
+    char msg[PAYLOAD_ENCODER_MSG_MAX_LEN];
+    int len = payload_encode_json(msg, sizeof(msg), BENCH_DEVICE_ID, &fix,
+                                  date, clock);
+    bench_stream_push(&json, msg, (size_t)len);
+
+    uint8_t bin[PAYLOAD_ENCODER_BIN_LEN];
+    payload_encode_binary(bin, &fix, time_s);
+    bench_stream_push(&binary, bin, sizeof(bin));
+  }
+
+  printf("%zu fixes every %u s (%s, %s battery), window %u B, matches "
+         "%u-%u B, encoder state %zu B\n",
+         count, interval_s, track_path ? track_path : "random walk",
+         random_battery ? "random" : "draining", MQTT_MGT_LZ_WINDOW_LEN,
+         MQTT_MGT_LZ_MIN_MATCH, MQTT_MGT_LZ_MAX_MATCH,
+         sizeof(mqtt_mgt_lz_encoder_t));
+  printf("%-6s %6s %9s %9s %7s %10s %8s %10s\n", "format", "batch", "raw B/msg",
+         "lz B/msg", "ratio", "enc us", "enc ns/B", "dec ns/B");
+  const bench_stream_t *streams[] = {&json, &binary};
+  int ret = EXIT_SUCCESS;
+  for (size_t s = 0; s < sizeof(streams) / sizeof(streams[0]); s++) {
+    for (size_t b = 0; b < sizeof(g_batch_sizes) / sizeof(g_batch_sizes[0]);
+         b++) {
+      if (0 != bench_run(streams[s], g_batch_sizes[b])) {
+        ret = EXIT_FAILURE;
+      }
+    }
+  }
+  bench_stream_free(&json);
+  bench_stream_free(&binary);
+  track_free(&track);
+  return ret;
+}
@@ -0,0 +1,161 @@
+/**
+ * Geofence evaluation cost per fix.
+ *
+ * Loads a few hundred random circles and polygons over a metro-sized area,
+ * then evaluates a random-walk track against them with the grid index and
+ * with a linear scan over all fences, checking both agree.
+ *
+ * Usage: geofence_bench [fences] [fixes]
+ */
+#include "bench_common.h"
+#include "geofence_index.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * @brief Area covered by fences and the track (degrees).
+ */
+#define BENCH_LAT0 (13.5f)
+#define BENCH_LNG0 (100.3f)
+#define BENCH_EXTENT (0.5f)
+
+/**
+ * @brief Largest polygon generated.
+ */
+#define BENCH_MAX_POLY_VERTICES (16)
+
+/********************************************************************************
+ *
+ *                              Private Global Variables
+ *
+ ********************************************************************************/
+
+// The index is large; keep it out of the stack.
+static geofence_index_t g_index;
+
+/********************************************************************************
+ *
+ *                              Private Function Definitions
+ *
+ ********************************************************************************/
+static void bench_count_transition(const geofence_fence_t *fence,
+                                   geofence_transition_t transition,
+                                   void *ctx) {
+  (void)fence;
+  (void)transition;
+  (*(size_t *)ctx)++;
+}
+
+static void bench_load_fences(uint64_t *rng, int count) {
+  geofence_index_clear(&g_index);
+  for (int i = 0; i < count; i++) {
+    float lat = bench_uniform(rng, BENCH_LAT0, BENCH_LAT0 + BENCH_EXTENT);
+    float lng = bench_uniform(rng, BENCH_LNG0, BENCH_LNG0 + BENCH_EXTENT);
+    float radius_m = bench_uniform(rng, 100.0f, 1500.0f);
+    geofence_index_err_t err;
+    if (i % 2) {
+      err = geofence_index_add_circle(&g_index, (uint16_t)i, lat, lng,
+                                      radius_m);
+    } else {
+      // A star-shaped polygon around (lat, lng).
+      geofence_point_t pts[BENCH_MAX_POLY_VERTICES];
+      int n = 4 + (int)(bench_rand(rng) % (BENCH_MAX_POLY_VERTICES - 3));
+      for (int v = 0; v < n; v++) {
+        float angle = 2.0f * (float)M_PI * (float)v / (float)n;
+        float r = radius_m * bench_uniform(rng, 0.5f, 1.0f) / 111320.0f;
+        pts[v].lat = lat + r * sinf(angle);
+        pts[v].lng = lng + r * cosf(angle);
+      }
+      err = geofence_index_add_polygon(&g_index, (uint16_t)i, pts, (size_t)n);
+    }
+    if (GEOFENCE_INDEX_OK != err) {
+      fprintf(stderr, "Failed to add fence %d (%d)\n", i, err);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (GEOFENCE_INDEX_OK != geofence_index_build(&g_index)) {
+    fprintf(stderr, "Grid overflow; raise GEOFENCE_MAX_CELL_REFS\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+int main(int argc, char **argv) {
+  int fences = argc > 1 ? atoi(argv[1]) : 256;
+  int fixes = argc > 2 ? atoi(argv[2]) : 1000000;
+  if (fences < 1 || fences > GEOFENCE_MAX_FENCES || fixes < 1) {
+    fprintf(stderr, "Usage: %s [fences <= %d] [fixes]\n", argv[0],
+            GEOFENCE_MAX_FENCES);
+    return EXIT_FAILURE;
+  }
+
+  uint64_t rng = 0x6E0FE4CEull;
+  bench_load_fences(&rng, fences);
+
+  // Random-walk track of ~10 m steps across the area.
+  geofence_point_t *track = malloc((size_t)fixes * sizeof(*track));
+  if (NULL == track) {
+    return EXIT_FAILURE;
+  }
+  float lat = BENCH_LAT0 + BENCH_EXTENT / 2, lng = BENCH_LNG0 + BENCH_EXTENT / 2;
+  for (int i = 0; i < fixes; i++) {
+    lat += bench_uniform(&rng, -1e-4f, 1e-4f);
+    lng += bench_uniform(&rng, -1e-4f, 1e-4f);
+    lat = fminf(fmaxf(lat, BENCH_LAT0), BENCH_LAT0 + BENCH_EXTENT);
+    lng = fminf(fmaxf(lng, BENCH_LNG0), BENCH_LNG0 + BENCH_EXTENT);
+    track[i] = (geofence_point_t){.lat = lat, .lng = lng};
+  }
+
+  // Grid index.
+  size_t transitions = 0;
+  size_t inside_total = 0;
+  uint64_t worst_ns = 0;
+  uint64_t start = bench_now_ns();
+  for (int i = 0; i < fixes; i++) {
+    uint64_t t0 = (i % 1024) ? 0 : bench_now_ns();
+    size_t inside = 0;
+    geofence_index_evaluate(&g_index, track[i].lat, track[i].lng,
+                            bench_count_transition, &transitions, &inside);
+    inside_total += inside;
+    if (t0) {
+      uint64_t dt = bench_now_ns() - t0;
+      worst_ns = dt > worst_ns ? dt : worst_ns;
+    }
+  }
+  double grid_ns = (double)(bench_now_ns() - start) / fixes;
+
+  // Linear scan over every fence, for reference.
+  size_t linear_total = 0;
+  start = bench_now_ns();
+  for (int i = 0; i < fixes; i++) {
+    for (uint16_t f = 0; f < g_index.fence_count; f++) {
+      linear_total += geofence_index_contains(&g_index, &g_index.fences[f],
+                                              track[i].lat, track[i].lng);
+    }
+  }
+  double linear_ns = (double)(bench_now_ns() - start) / fixes;
+
+  int max_refs = 0;
+  for (int c = 0; c < GEOFENCE_GRID_DIM * GEOFENCE_GRID_DIM; c++) {
+    int refs = g_index.cell_start[c + 1] - g_index.cell_start[c];
+    max_refs = refs > max_refs ? refs : max_refs;
+  }
+
+  printf("fences            %d (%u vertices), grid %dx%d, %u cell refs, "
+         "densest cell %d\n",
+         fences, g_index.vertex_count, GEOFENCE_GRID_DIM, GEOFENCE_GRID_DIM,
+         g_index.cell_start[GEOFENCE_GRID_DIM * GEOFENCE_GRID_DIM], max_refs);
+  printf("index memory      %zu bytes\n", sizeof(g_index));
+  printf("fixes             %d, %zu transitions, %.3f fences/fix inside\n",
+         fixes, transitions, (double)inside_total / fixes);
+  printf("grid index        %.1f ns/fix (sampled worst %.1f us)\n", grid_ns,
+         worst_ns / 1000.0);
+  printf("linear scan       %.1f ns/fix\n", linear_ns);
+  free(track);
+  if (inside_total != linear_total) {
+    fprintf(stderr, "MISMATCH: grid %zu vs linear %zu\n", inside_total,
+            linear_total);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,473 @@
+/**
+ * Kalman filter cost per update and accuracy on noisy tracks.
+ *
+ * Replays a 1 Hz ground-truth track (synthetic vehicle by default, or a
+ * recorded "lat,lng" CSV), adds Gaussian GNSS noise and occasional gross
+ * outliers, and reports:
+ *   - time per update of the fixed-point filter and of a double-precision
+ *     reference implementing the same equations,
+ *   - position error of raw fixes vs the filtered estimate,
+ *   - speed and heading error,
+ *   - outlier detection,
+ *   - position error of the estimate after a round trip through the
+ *     binary record sent to the uplink (payload_encoder.c), compared with
+ *     the former 16-bit coordinates,
+ *   - dead-reckoning error when only every k-th fix is fed to the filter,
+ *     compared with holding the last reported fix.
+ *
+ * Usage: payload_filter_bench [-t track.csv] [-n fixes] [-s sigma_m]
+ *                             [-o outlier_rate] [-k report_every]
+ *                             [-a accel_sigma_m_s2] [-g gate_sigma]
+ */
+#include "bench_common.h"
+#include "payload_encoder.h"
+#include "payload_filter.h"
+#include "track.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * @brief Meters per degree of latitude.
+ */
+#define BENCH_METERS_PER_DEG (111320.0)
+
+/**
+ * @brief Origin of the synthetic track (degrees).
+ */
+#define BENCH_LAT0 (13.7563)
+#define BENCH_LNG0 (100.5018)
+
+/**
+ * @brief Lateral acceleration of the synthetic vehicle in turns (m/s^2).
+ */
+#define BENCH_MAX_LATERAL_ACCEL (3.0)
+
+/**
+ * @brief Heading is only scored above this true speed (m/s).
+ */
+#define BENCH_MIN_HEADING_SPEED (3.0)
+
+/********************************************************************************
+ *
+ *                              Type Declarations
+ *
+ ********************************************************************************/
+
+/**
+ * @brief Ground truth of one second of the track.
+ */
+typedef struct {
+  double lat;   ///< Degrees
+  double lng;   ///< Degrees
+  double speed; ///< m/s
+  double heading; ///< Degrees clockwise from north
+} bench_truth_t;
+
+/**
+ * @brief Double-precision reference filter with the same model.
+ */
+typedef struct {
+  double pos[2], vel[2];
+  double p_pp, p_pv, p_vv;
+  double r, q, gate2;
+  int outliers, max_outliers;
+  bool started;
+} bench_ref_filter_t;
+
+/**
+ * @brief Running error statistics.
+ */
+typedef struct {
+  double sum2;
+  double max;
+  size_t n;
+} bench_err_t;
+
+/********************************************************************************
+ *
+ *                              Private Function Definitions
+ *
+ ********************************************************************************/
+static double bench_gauss(uint64_t *rng) {
+  double u1 = track_rand_unit(rng), u2 = track_rand_unit(rng);
+  if (u1 < 1e-300) {
+    u1 = 1e-300;
+  }
+  return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+static void bench_err_add(bench_err_t *err, double value) {
+  err->sum2 += value * value;
+  err->max = fabs(value) > err->max ? fabs(value) : err->max;
+  err->n++;
+}
+
+static double bench_err_rms(const bench_err_t *err) {
+  return err->n ? sqrt(err->sum2 / (double)err->n) : 0.0;
+}
+
+// Distance in meters between two points close to each other.
+static double bench_distance(double lat1, double lng1, double lat2,
+                             double lng2) {
+  double dn = (lat2 - lat1) * BENCH_METERS_PER_DEG;
+  double de = (lng2 - lng1) * BENCH_METERS_PER_DEG *
+              cos((lat1 + lat2) * 0.5 * M_PI / 180.0);
+  return sqrt(dn * dn + de * de);
+}
+
+static double bench_bearing(double lat1, double lng1, double lat2,
+                            double lng2) {
+  double dn = (lat2 - lat1) * BENCH_METERS_PER_DEG;
+  double de = (lng2 - lng1) * BENCH_METERS_PER_DEG *
+              cos((lat1 + lat2) * 0.5 * M_PI / 180.0);
+  double h = atan2(de, dn) * 180.0 / M_PI;
+  return h < 0 ? h + 360.0 : h;
+}
+
+// A vehicle that accelerates, brakes, stops and turns: every 20 s it
+// changes speed for 5 s and, some of the time, turns by 30 to 120 degrees
+// with at most BENCH_MAX_LATERAL_ACCEL of lateral acceleration.
+static bench_truth_t *bench_synthetic(uint64_t *rng, size_t count) {
+  bench_truth_t *truth = malloc(count * sizeof(*truth));
+  if (NULL == truth) {
+    return NULL;
+  }
+  double lat = BENCH_LAT0, lng = BENCH_LNG0, speed = 10.0, heading = 0.0;
+  double accel = 0.0, turn = 0.0;
+  for (size_t i = 0; i < count; i++) {
+    if (0 == i % 20) {
+      accel = (track_rand_unit(rng) * 2.0 - 1.0) * 1.5;
+      if (track_rand_unit(rng) < 0.3) {
+        turn = (30.0 + 90.0 * track_rand_unit(rng)) * M_PI / 180.0;
+        turn = track_rand_unit(rng) < 0.5 ? turn : -turn;
+      }
+    } else if (5 == i % 20) {
+      accel = 0.0;
+    }
+    speed = fmin(fmax(speed + accel, 0.0), 30.0);
+    double rate = BENCH_MAX_LATERAL_ACCEL / fmax(speed, 1.0);
+    double step = fmax(fmin(turn, rate), -rate);
+    turn -= step;
+    heading = fmod(heading + step + 2.0 * M_PI, 2.0 * M_PI);
+    lat += speed * cos(heading) / BENCH_METERS_PER_DEG;
+    lng += speed * sin(heading) /
+           (BENCH_METERS_PER_DEG * cos(lat * M_PI / 180.0));
+    truth[i].lat = lat;
+    truth[i].lng = lng;
+    truth[i].speed = speed;
+    truth[i].heading = heading * 180.0 / M_PI;
+  }
+  return truth;
+}
+
+// A recorded track, assumed to be sampled at 1 Hz.
+static bench_truth_t *bench_recorded(const char *path, size_t *count) {
+  track_t track;
+  if (track_load_csv(&track, path)) {
+    return NULL;
+  }
+  bench_truth_t *truth = malloc(track.count * sizeof(*truth));
+  if (NULL != truth) {
+    for (size_t i = 0; i < track.count; i++) {
+      truth[i].lat = track.lat[i];
+      truth[i].lng = track.lng[i];
+      size_t a = i ? i - 1 : 0, b = i + 1 < track.count ? i + 1 : i;
+      double span = (double)(b - a);
+      truth[i].speed = span > 0 ? bench_distance(track.lat[a], track.lng[a],
+                                                 track.lat[b], track.lng[b]) /
+                                      span
+                                : 0.0;
+      truth[i].heading =
+          bench_bearing(track.lat[a], track.lng[a], track.lat[b], track.lng[b]);
+    }
+    *count = track.count;
+  }
+  track_free(&track);
+  return truth;
+}
+
+static void bench_ref_init(bench_ref_filter_t *f,
+                           const payload_filter_config_t *cfg) {
+  *f = (bench_ref_filter_t){0};
+  f->r = pow(cfg->meas_sigma_cm / 100.0, 2);
+  f->q = pow(cfg->accel_sigma_cm_s2 / 100.0, 2);
+  f->gate2 = (double)cfg->gate_sigma * cfg->gate_sigma;
+  f->max_outliers = cfg->max_outliers;
+  f->p_vv = pow(cfg->init_speed_sigma_cm_s / 100.0, 2);
+}
+
+// Measurement in meters on the same plane as the fixed-point filter.
+static void bench_ref_update(bench_ref_filter_t *f, double dt,
+                             const double z[2], double init_vv) {
+  if (!f->started) {
+    f->pos[0] = z[0];
+    f->pos[1] = z[1];
+    f->started = true;
+    f->p_pp = f->r;
+    return;
+  }
+  for (int a = 0; a < 2; a++) {
+    f->pos[a] += f->vel[a] * dt;
+  }
+  f->p_pp += 2 * dt * f->p_pv + dt * dt * f->p_vv + f->q * dt * dt * dt / 3;
+  f->p_pv += dt * f->p_vv + f->q * dt * dt / 2;
+  f->p_vv += f->q * dt;
+  double y[2] = {z[0] - f->pos[0], z[1] - f->pos[1]};
+  double s = f->p_pp + f->r;
+  if (y[0] * y[0] + y[1] * y[1] > f->gate2 * s) {
+    if (++f->outliers > f->max_outliers) {
+      f->pos[0] = z[0];
+      f->pos[1] = z[1];
+      f->vel[0] = f->vel[1] = 0;
+      f->p_pp = f->r;
+      f->p_pv = 0;
+      f->p_vv = init_vv;
+      f->outliers = 0;
+    }
+    return;
+  }
+  f->outliers = 0;
+  double kp = f->p_pp / s, kv = f->p_pv / s;
+  for (int a = 0; a < 2; a++) {
+    f->pos[a] += kp * y[a];
+    f->vel[a] += kv * y[a];
+  }
+  double p_pv = f->p_pv;
+  f->p_pp *= f->r / s;
+  f->p_pv *= f->r / s;
+  f->p_vv -= p_pv * p_pv / s;
+}
+
+static int32_t bench_e7(double degrees) { return (int32_t)llround(degrees * 1e7); }
+
+// The estimate as the receiver decodes it from the uplink record.
+static void bench_wire(const payload_filter_estimate_t *est, double *lat,
+                       double *lng) {
+  payload_fix_t fix;
+  payload_fix_from_e7(&fix, est->lat_e7, est->lng_e7, 0.0f);
+  uint8_t record[PAYLOAD_ENCODER_BIN_LEN];
+  payload_encode_binary(record, &fix, 0);
+  uint32_t time_s;
+  payload_decode_binary(record, &fix, &time_s);
+  *lat = fix.lat_e7 * 1e-7;
+  *lng = fix.lng_e7 * 1e-7;
+}
+
+// Round trip through the 16-bit coordinates of encoding version 1.
+static double bench_wire_v1(double degrees, double max) {
+  double step = 2.0 * max / 65535.0;
+  return floor((degrees + max) / step + 0.5) * step - max;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-t track.csv] [-n fixes] [-s sigma_m] [-o outlier_rate] "
+          "[-k report_every] [-a accel_sigma_m_s2] [-g gate_sigma]\n",
+          prog);
+}
+
+int main(int argc, char **argv) {
+  const char *track_path = NULL;
+  size_t count = 200000;
+  double sigma_m = 5.0;
+  double outlier_rate = 0.01;
+  int report_every = 10;
+  payload_filter_config_t cfg = PAYLOAD_FILTER_CONFIG_DEFAULT();
+  int opt;
+  while (-1 != (opt = getopt(argc, argv, "t:n:s:o:k:a:g:h"))) {
+    switch (opt) {
+    case 't':
+      track_path = optarg;
+      break;
+    case 'n':
+      count = (size_t)strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      sigma_m = atof(optarg);
+      break;
+    case 'o':
+      outlier_rate = atof(optarg);
+      break;
+    case 'k':
+      report_every = atoi(optarg);
+      break;
+    case 'a':
+      cfg.accel_sigma_cm_s2 = (uint16_t)lround(atof(optarg) * 100.0);
+      break;
+    case 'g':
+      cfg.gate_sigma = (uint8_t)atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (count < 2 || report_every < 1 || sigma_m <= 0.0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  uint64_t rng = 0x4B414C4Dull;
+  bench_truth_t *truth = track_path ? bench_recorded(track_path, &count)
+                                    : bench_synthetic(&rng, count);
+  int32_t *lat_e7 = malloc(count * sizeof(int32_t));
+  int32_t *lng_e7 = malloc(count * sizeof(int32_t));
+  bool *is_outlier = malloc(count * sizeof(bool));
+  payload_filter_estimate_t *est = malloc(count * sizeof(*est));
+  payload_filter_result_t *res = malloc(count * sizeof(*res));
+  if (!truth || !lat_e7 || !lng_e7 || !is_outlier || !est || !res) {
+    fprintf(stderr, "Out of memory\n");
+    return EXIT_FAILURE;
+  }
+
+  // Noisy fixes.
+  size_t injected = 0;
+  for (size_t i = 0; i < count; i++) {
+    double dn = sigma_m * bench_gauss(&rng);
+    double de = sigma_m * bench_gauss(&rng);
+    is_outlier[i] = i > 0 && track_rand_unit(&rng) < outlier_rate;
+    if (is_outlier[i]) {
+      // Multipath jump of 100 to 500 m in a random direction.
+      double d = 100.0 + 400.0 * track_rand_unit(&rng);
+      double a = 2.0 * M_PI * track_rand_unit(&rng);
+      dn += d * cos(a);
+      de += d * sin(a);
+      injected++;
+    }
+    double lat = truth[i].lat + dn / BENCH_METERS_PER_DEG;
+    double lng = truth[i].lng + de / (BENCH_METERS_PER_DEG *
+                                      cos(truth[i].lat * M_PI / 180.0));
+    lat_e7[i] = bench_e7(lat);
+    lng_e7[i] = bench_e7(lng);
+  }
+
+  // Fixed-point filter: timing.
+  cfg.meas_sigma_cm = (uint16_t)lround(sigma_m * 100.0);
+  payload_filter_t filter;
+  payload_filter_init(&filter, &cfg);
+  uint64_t start = bench_now_ns();
+  for (size_t i = 0; i < count; i++) {
+    res[i] = payload_filter_update(&filter, (uint32_t)(i * 1000), lat_e7[i],
+                                   lng_e7[i], &est[i]);
+  }
+  double fixed_ns = (double)(bench_now_ns() - start) / (double)count;
+
+  // Double-precision reference on the plane of the first fix.
+  double cos0 = cos(truth[0].lat * M_PI / 180.0);
+  bench_ref_filter_t ref;
+  bench_ref_init(&ref, &cfg);
+  double init_vv = ref.p_vv;
+  bench_err_t ref_diff = {0};
+  start = bench_now_ns();
+  for (size_t i = 0; i < count; i++) {
+    double z[2] = {(lat_e7[i] - lat_e7[0]) * 1e-7 * BENCH_METERS_PER_DEG,
+                   (lng_e7[i] - lng_e7[0]) * 1e-7 * BENCH_METERS_PER_DEG *
+                       cos0};
+    bench_ref_update(&ref, 1.0, z, init_vv);
+  }
+  double ref_ns = (double)(bench_now_ns() - start) / (double)count;
+
+  // Accuracy, replaying the reference alongside for the fixed-point error.
+  bench_err_t raw = {0}, filtered = {0}, speed = {0}, heading = {0};
+  bench_err_t wire = {0}, wire_v1 = {0};
+  size_t detected = 0, false_alarms = 0, restarts = 0;
+  bench_ref_init(&ref, &cfg);
+  for (size_t i = 0; i < count; i++) {
+    double z[2] = {(lat_e7[i] - lat_e7[0]) * 1e-7 * BENCH_METERS_PER_DEG,
+                   (lng_e7[i] - lng_e7[0]) * 1e-7 * BENCH_METERS_PER_DEG *
+                       cos0};
+    bench_ref_update(&ref, 1.0, z, init_vv);
+    double lat = est[i].lat_e7 * 1e-7, lng = est[i].lng_e7 * 1e-7;
+    double ref_lat = lat_e7[0] * 1e-7 + ref.pos[0] / BENCH_METERS_PER_DEG;
+    double ref_lng =
+        lng_e7[0] * 1e-7 + ref.pos[1] / (BENCH_METERS_PER_DEG * cos0);
+    // The fixed-point filter re-centers its plane as it travels; compare
+    // while both still share the plane of the first fix.
+    if (i < 1000) {
+      bench_err_add(&ref_diff, bench_distance(lat, lng, ref_lat, ref_lng));
+    }
+
+    if (!is_outlier[i]) {
+      bench_err_add(&raw, bench_distance(truth[i].lat, truth[i].lng,
+                                         lat_e7[i] * 1e-7, lng_e7[i] * 1e-7));
+    }
+    bench_err_add(&filtered,
+                  bench_distance(truth[i].lat, truth[i].lng, lat, lng));
+    double wire_lat, wire_lng;
+    bench_wire(&est[i], &wire_lat, &wire_lng);
+    bench_err_add(&wire, bench_distance(truth[i].lat, truth[i].lng, wire_lat,
+                                        wire_lng));
+    bench_err_add(&wire_v1, bench_distance(truth[i].lat, truth[i].lng,
+                                           bench_wire_v1(lat, 90.0),
+                                           bench_wire_v1(lng, 180.0)));
+    if (i >= 10) {
+      bench_err_add(&speed, est[i].speed_mm_s / 1000.0 - truth[i].speed);
+      if (truth[i].speed > BENCH_MIN_HEADING_SPEED) {
+        double dh = fabs(est[i].heading_cdeg / 100.0 - truth[i].heading);
+        bench_err_add(&heading, dh > 180.0 ? 360.0 - dh : dh);
+      }
+    }
+    if (res[i] == PAYLOAD_FILTER_OUTLIER ||
+        res[i] == PAYLOAD_FILTER_RESTARTED) {
+      if (is_outlier[i]) {
+        detected++;
+      } else {
+        false_alarms++;
+      }
+    }
+    restarts += res[i] == PAYLOAD_FILTER_RESTARTED;
+  }
+
+  // Dead reckoning between sparse reports.
+  bench_err_t predicted = {0}, held = {0};
+  payload_filter_init(&filter, &cfg);
+  int32_t last_lat = 0, last_lng = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint32_t t_ms = (uint32_t)(i * 1000);
+    if (0 == i % (size_t)report_every) {
+      payload_filter_estimate_t e;
+      payload_filter_update(&filter, t_ms, lat_e7[i], lng_e7[i], &e);
+      last_lat = lat_e7[i];
+      last_lng = lng_e7[i];
+      continue;
+    }
+    payload_filter_estimate_t e;
+    payload_filter_predict(&filter, t_ms, &e);
+    bench_err_add(&predicted, bench_distance(truth[i].lat, truth[i].lng,
+                                             e.lat_e7 * 1e-7, e.lng_e7 * 1e-7));
+    bench_err_add(&held, bench_distance(truth[i].lat, truth[i].lng,
+                                        last_lat * 1e-7, last_lng * 1e-7));
+  }
+
+  printf("fixes             %zu at 1 Hz (%s), noise %.1f m, %zu outliers "
+         "injected\n",
+         count, track_path ? track_path : "synthetic", sigma_m, injected);
+  printf("update cost       %.1f ns fixed-point, %.1f ns double reference\n",
+         fixed_ns, ref_ns);
+  printf("filter state      %zu bytes\n", sizeof(payload_filter_t));
+  printf("position error    raw rms %.2f m, filtered rms %.2f m (max %.1f m)\n",
+         bench_err_rms(&raw), bench_err_rms(&filtered), filtered.max);
+  printf("on the wire       rms %.2f m (16-bit v1 coordinates: rms %.1f m)\n",
+         bench_err_rms(&wire), bench_err_rms(&wire_v1));
+  printf("fixed vs double   rms %.3f m over the first 1000 fixes\n",
+         bench_err_rms(&ref_diff));
+  printf("speed error       rms %.2f m/s\n", bench_err_rms(&speed));
+  printf("heading error     rms %.1f deg above %.0f m/s\n",
+         bench_err_rms(&heading), BENCH_MIN_HEADING_SPEED);
+  printf("outliers          %zu/%zu flagged, %zu false alarms, %zu restarts\n",
+         detected, injected, false_alarms, restarts);
+  printf("report every %2ds dead-reckoned rms %.2f m, hold-last-fix rms %.2f "
+         "m\n",
+         report_every, bench_err_rms(&predicted), bench_err_rms(&held));
+
+  free(truth);
+  free(lat_e7);
+  free(lng_e7);
+  free(is_outlier);
+  free(est);
+  free(res);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,333 @@
+/**
+ * Full vs resumed TLS handshakes against an mqtts broker.
+ *
+ * Connects repeatedly with the same settings as the firmware's TLS transport
+ * (components/mqtt_mgt/mqtt_mgt_tls.c: TLS 1.2, session ID or ticket
+ * resumption) and reports, separately for full and resumed handshakes:
+ *   - handshake wall time and client CPU time,
+ *   - peak heap allocated by the TLS library during the handshake,
+ *   - bytes exchanged (what the radio has to carry),
+ *   - optionally the time to MQTT CONNACK.
+ * Every other connection offers the session of the previous one, so both
+ * kinds are measured under the same network conditions.
+ *
+ * Usage: tls_resume_bench [-H host] [-p port] [-c ca.pem] [-n connections]
+ *                         [-k] [-m]
+ */
+#include "bench_common.h"
+#include "mqtt_codec.h"
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+ * @brief Size of the allocation header used to track heap use.
+ */
+#define BENCH_ALLOC_HEADER (16)
+
+/**
+ * @brief MQTT keep-alive sent in CONNECT (s).
+ */
+#define BENCH_KEEPALIVE_S (60)
+
+/********************************************************************************
+ *
+ *                              Type Declarations
+ *
+ ********************************************************************************/
+
+/**
+ * @brief Accumulated measurements of one kind of handshake.
+ */
+typedef struct {
+  size_t count;
+  double wall_ms;
+  double cpu_ms;
+  double connack_ms;
+  size_t peak_heap;
+  size_t bytes;
+} bench_stats_t;
+
+/********************************************************************************
+ *
+ *                              Private Global Variables
+ *
+ ********************************************************************************/
+
+// Heap currently allocated by OpenSSL, and its peak since the last reset.
+static size_t g_heap_now = 0;
+static size_t g_heap_peak = 0;
+
+/********************************************************************************
+ *
+ *                              Private Function Definitions
+ *
+ ********************************************************************************/
+static void *bench_malloc(size_t size, const char *file, int line) {
+  (void)file;
+  (void)line;
+  unsigned char *p = malloc(size + BENCH_ALLOC_HEADER);
+  if (NULL == p) {
+    return NULL;
+  }
+  memcpy(p, &size, sizeof(size));
+  g_heap_now += size;
+  g_heap_peak = g_heap_now > g_heap_peak ? g_heap_now : g_heap_peak;
+  return p + BENCH_ALLOC_HEADER;
+}
+
+static void bench_free(void *ptr, const char *file, int line) {
+  (void)file;
+  (void)line;
+  if (NULL == ptr) {
+    return;
+  }
+  unsigned char *p = (unsigned char *)ptr - BENCH_ALLOC_HEADER;
+  size_t size;
+  memcpy(&size, p, sizeof(size));
+  g_heap_now -= size;
+  free(p);
+}
+
+static void *bench_realloc(void *ptr, size_t size, const char *file,
+                           int line) {
+  if (NULL == ptr) {
+    return bench_malloc(size, file, line);
+  }
+  size_t old;
+  memcpy(&old, (unsigned char *)ptr - BENCH_ALLOC_HEADER, sizeof(old));
+  void *p = bench_malloc(size, file, line);
+  if (NULL != p) {
+    memcpy(p, ptr, old < size ? old : size);
+    bench_free(ptr, file, line);
+  }
+  return p;
+}
+
+static double bench_cpu_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int bench_tcp_connect(const char *host, const char *port) {
+  struct addrinfo hints = {.ai_socktype = SOCK_STREAM};
+  struct addrinfo *res = NULL;
+  if (0 != getaddrinfo(host, port, &hints, &res)) {
+    return -1;
+  }
+  int fd = -1;
+  for (struct addrinfo *ai = res; NULL != ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd >= 0 && 0 == connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+      // As the firmware does; otherwise the client's Finished and CONNECT
+      // wait for a delayed ACK after a resumed handshake.
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      break;
+    }
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+// Send CONNECT and wait for CONNACK. Returns 0 on an accepted connection.
+static int bench_mqtt_connect(SSL *ssl, int index) {
+  uint8_t buf[256];
+  char client_id[32];
+  snprintf(client_id, sizeof(client_id), "tls_bench_%d", index);
+  int len = mqtt_codec_connect(buf, sizeof(buf), client_id, BENCH_KEEPALIVE_S);
+  if (len < 0 || SSL_write(ssl, buf, len) != len) {
+    return -1;
+  }
+  size_t got = 0;
+  mqtt_codec_packet_t packet;
+  while (got < sizeof(buf)) {
+    int n = SSL_read(ssl, buf + got, (int)(sizeof(buf) - got));
+    if (n <= 0) {
+      return -1;
+    }
+    got += (size_t)n;
+    int ret = mqtt_codec_decode(buf, got, &packet);
+    if (ret < 0) {
+      return -1;
+    }
+    if (ret > 0) {
+      return MQTT_CODEC_CONNACK == packet.type && packet.body_len >= 2 &&
+                     0 == packet.body[1]
+                 ? 0
+                 : -1;
+    }
+  }
+  return -1;
+}
+
+static void bench_print(const char *name, const bench_stats_t *s, bool mqtt) {
+  if (0 == s->count) {
+    printf("%-8s  none\n", name);
+    return;
+  }
+  double n = (double)s->count;
+  printf("%-8s  %5zu  %8.2f ms  %8.2f ms cpu  %7.1f KiB peak  %6.0f B",
+         name, s->count, s->wall_ms / n, s->cpu_ms / n, s->peak_heap / 1024.0,
+         s->bytes / n);
+  if (mqtt) {
+    printf("  %8.2f ms to CONNACK", s->connack_ms / n);
+  }
+  printf("\n");
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-H host] [-p port] [-c ca.pem] [-n connections] [-k] "
+          "[-m]\n"
+          "  -k  do not verify the broker certificate\n"
+          "  -m  send MQTT CONNECT and wait for CONNACK after the handshake\n",
+          prog);
+}
+
+int main(int argc, char **argv) {
+  // Must come before any OpenSSL allocation.
+  CRYPTO_set_mem_functions(bench_malloc, bench_realloc, bench_free);
+
+  const char *host = "localhost";
+  const char *port = "8883";
+  const char *ca_path = NULL;
+  int connections = 20;
+  bool verify = true;
+  bool mqtt = false;
+  int opt;
+  while (-1 != (opt = getopt(argc, argv, "H:p:c:n:kmh"))) {
+    switch (opt) {
+    case 'H':
+      host = optarg;
+      break;
+    case 'p':
+      port = optarg;
+      break;
+    case 'c':
+      ca_path = optarg;
+      break;
+    case 'n':
+      connections = atoi(optarg);
+      break;
+    case 'k':
+      verify = false;
+      break;
+    case 'm':
+      mqtt = true;
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (connections < 2) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT);
+  if (verify) {
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+    if (NULL != ca_path
+            ? 1 != SSL_CTX_load_verify_locations(ctx, ca_path, NULL)
+            : 1 != SSL_CTX_set_default_verify_paths(ctx)) {
+      fprintf(stderr, "Failed to load CA certificates\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  bench_stats_t full = {0}, resumed = {0};
+  SSL_SESSION *session = NULL;
+  size_t offered = 0;
+  for (int i = 0; i < connections; i++) {
+    int fd = bench_tcp_connect(host, port);
+    if (fd < 0) {
+      fprintf(stderr, "Failed to connect to %s:%s\n", host, port);
+      return EXIT_FAILURE;
+    }
+    SSL *ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, fd);
+    SSL_set_tlsext_host_name(ssl, host);
+    if (verify) {
+      SSL_set1_host(ssl, host);
+    }
+    // Alternate: odd connections offer the session of the previous one.
+    if (i % 2 && NULL != session) {
+      SSL_set_session(ssl, session);
+      offered++;
+    }
+
+    size_t heap_base = g_heap_now;
+    g_heap_peak = g_heap_now;
+    double cpu0 = bench_cpu_ms();
+    uint64_t t0 = bench_now_ns();
+    int ret = SSL_connect(ssl);
+    double wall_ms = (bench_now_ns() - t0) / 1e6;
+    double cpu_ms = bench_cpu_ms() - cpu0;
+    size_t peak = g_heap_peak - heap_base;
+    if (1 != ret) {
+      fprintf(stderr, "Handshake %d failed:\n", i);
+      ERR_print_errors_fp(stderr);
+      return EXIT_FAILURE;
+    }
+    size_t bytes = BIO_number_read(SSL_get_rbio(ssl)) +
+                   BIO_number_written(SSL_get_wbio(ssl));
+
+    double connack_ms = 0.0;
+    if (mqtt) {
+      if (0 != bench_mqtt_connect(ssl, i)) {
+        fprintf(stderr, "MQTT CONNECT %d was not accepted\n", i);
+        return EXIT_FAILURE;
+      }
+      connack_ms = (bench_now_ns() - t0) / 1e6;
+    }
+
+    bench_stats_t *s = SSL_session_reused(ssl) ? &resumed : &full;
+    s->count++;
+    s->wall_ms += wall_ms;
+    s->cpu_ms += cpu_ms;
+    s->connack_ms += connack_ms;
+    s->peak_heap = peak > s->peak_heap ? peak : s->peak_heap;
+    s->bytes += bytes;
+
+    if (0 == i % 2) {
+      SSL_SESSION_free(session);
+      session = SSL_get1_session(ssl);
+    }
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+    close(fd);
+  }
+  SSL_SESSION_free(session);
+  SSL_CTX_free(ctx);
+
+  printf("broker    %s:%s, TLS 1.2, %d connections, %zu offered a session\n",
+         host, port, connections, offered);
+  printf("kind      count      wall            cpu          heap      bytes\n");
+  bench_print("full", &full, mqtt);
+  bench_print("resumed", &resumed, mqtt);
+  if (resumed.count < offered) {
+    printf("%zu offered session(s) were not resumed; check the broker's "
+           "session cache and ticket settings\n",
+           offered - resumed.count);
+  }
+  return EXIT_SUCCESS;
+}
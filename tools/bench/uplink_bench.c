@@ -0,0 +1,672 @@
+/**
+ * MQTT vs UDP uplink: latency, bytes per fix and throughput.
+ *
+ * Sends the same fixes over both uplinks of the firmware
+ * (components/mqtt_mgt) and times when each one reaches the cloud side:
+ *   - mqtt: one JSON PUBLISH per fix to a broker, with the firmware's topic
+ *     layout and QoS (but not its retain flag, which costs no bytes); a
+ *     second connection subscribes to the topic and stands in for the
+ *     dashboard.
+ *   - udp: binary fixes batched into CoAP non-confirmable frames by the
+ *     firmware's codec, sent to an in-process receiver over loopback.
+ *
+ * With -z, batches of at least that many bytes are compressed as the
+ * firmware does (components/mqtt_mgt/mqtt_mgt_lz.h): published as one
+ * message over MQTT, per frame over UDP. Fixes are random positions, which
+ * compress worse than a real track (see compress_bench).
+ *
+ * Each uplink runs twice: paced at the given rate to measure latency, then
+ * flooding to measure throughput. Fixes are handed to the uplink in batches,
+ * like the firmware does after waking the radio; latency runs from handing
+ * a fix over to its delivery. Bytes are counted on the device's side only,
+ * in both directions, once connected; the IP estimate adds 28 bytes per
+ * datagram and 40 bytes per MQTT packet (one TCP segment each, no options).
+ *
+ * Usage: uplink_bench [-b broker[:port]] [-n fixes] [-B batch] [-r rate]
+ *                     [-q qos] [-t mqtt|udp] [-z threshold]
+ */
+#include "bench_common.h"
+#include "latency_hist.h"
+#include "mqtt_codec.h"
+#include "mqtt_mgt_frame.h"
+#include "mqtt_mgt_lz.h"
+#include "payload_encoder.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Device identifier and topic, as used by the firmware.
+ */
+#define BENCH_DEVICE_ID "ESP32_001"
+#define BENCH_TOPIC_PREFIX "/egress/"
+
+/**
+ * @brief Per-packet IP overhead: IPv4 + UDP, IPv4 + TCP without options.
+ */
+#define BENCH_UDP_IP_OVERHEAD (28)
+#define BENCH_TCP_IP_OVERHEAD (40)
+
+/**
+ * @brief A run ends once nothing has been delivered for this long.
+ */
+#define BENCH_IDLE_TIMEOUT_NS (1000000000ull)
+
+/**
+ * @brief Poll timeout of the receiving threads.
+ */
+#define BENCH_POLL_MS (50)
+
+/**
+ * @brief Receive buffer of the MQTT connections.
+ */
+#define BENCH_MQTT_RX_SIZE (65536)
+
+/********************************************************************************
+ *
+ *                              Type Declarations
+ *
+ ********************************************************************************/
+
+/**
+ * @brief Command-line options.
+ */
+typedef struct {
+  const char *broker; ///< MQTT broker as host[:port]
+  size_t fixes;       ///< Fixes per run
+  size_t batch;       ///< Fixes handed over together
+  double rate;        ///< Fixes per second of the paced runs
+  int qos;            ///< QoS of the MQTT publishes
+  bool mqtt;          ///< Run the MQTT uplink
+  bool udp;           ///< Run the UDP uplink
+  size_t compress;    ///< Smallest batch compressed in bytes, 0 for none
+} bench_opts_t;
+
+/**
+ * @brief Measurements of one run.
+ */
+typedef struct {
+  size_t delivered;        ///< Distinct fixes delivered
+  uint64_t first_ns;       ///< Start of the run until the first delivery
+  uint64_t elapsed_ns;     ///< First hand-over until the last delivery
+  uint64_t connect_bytes;  ///< Bytes exchanged to connect
+  uint64_t bytes;          ///< Bytes exchanged once connected
+  uint64_t packets;        ///< Datagrams or MQTT packets once connected
+  latency_hist_t hist;     ///< Hand-over to delivery, in microseconds
+} bench_result_t;
+
+/********************************************************************************
+ *
+ *                              Private Global Variables
+ *
+ ********************************************************************************/
+
+// Hand-over and delivery time of every fix of the current run; 0 if not yet.
+static uint64_t *g_sent_ns = NULL;
+static uint64_t *g_recv_ns = NULL;
+static size_t g_fixes = 0;
+
+// Distinct fixes delivered in the current run.
+static atomic_size_t g_delivered;
+
+// Tells the receiving thread to return.
+static atomic_bool g_rx_stop;
+
+// Receiving socket of the current run.
+static int g_rx_fd = -1;
+
+/********************************************************************************
+ *
+ *                              Private Function Definitions
+ *
+ ********************************************************************************/
+static void bench_sleep_until(uint64_t deadline_ns) {
+  uint64_t now = bench_now_ns();
+  if (deadline_ns > now) {
+    struct timespec ts = {
+        .tv_sec = (time_t)((deadline_ns - now) / 1000000000ull),
+        .tv_nsec = (long)((deadline_ns - now) % 1000000000ull),
+    };
+    nanosleep(&ts, NULL);
+  }
+}
+
+static void bench_delivered(size_t index) {
+  if (index < g_fixes && 0 == g_recv_ns[index]) {
+    g_recv_ns[index] = bench_now_ns();
+    atomic_fetch_add(&g_delivered, 1);
+  }
+}
+
+// Wait until every fix is delivered or deliveries stop.
+static void bench_wait_delivered(void) {
+  size_t last = atomic_load(&g_delivered);
+  uint64_t last_ns = bench_now_ns();
+  while (last < g_fixes && bench_now_ns() - last_ns < BENCH_IDLE_TIMEOUT_NS) {
+    bench_sleep_until(bench_now_ns() + 1000000ull);
+    size_t now = atomic_load(&g_delivered);
+    if (now != last) {
+      last = now;
+      last_ns = bench_now_ns();
+    }
+  }
+}
+
+static void bench_collect(bench_result_t *result, uint64_t start_ns) {
+  latency_hist_reset(&result->hist);
+  result->delivered = 0;
+  uint64_t first = UINT64_MAX;
+  uint64_t last = 0;
+  for (size_t i = 0; i < g_fixes; i++) {
+    if (0 == g_recv_ns[i]) {
+      continue;
+    }
+    result->delivered++;
+    latency_hist_record(&result->hist, (g_recv_ns[i] - g_sent_ns[i]) / 1000);
+    first = g_recv_ns[i] < first ? g_recv_ns[i] : first;
+    last = g_recv_ns[i] > last ? g_recv_ns[i] : last;
+  }
+  result->first_ns = result->delivered ? first - start_ns : 0;
+  result->elapsed_ns = result->delivered ? last - g_sent_ns[0] : 0;
+}
+
+static void bench_fix(uint64_t *rng, payload_fix_t *fix) {
+  payload_fix_from_degrees(fix, bench_uniform(rng, 13.5f, 14.0f),
+                           bench_uniform(rng, 100.3f, 100.8f),
+                           bench_uniform(rng, 20.0f, 100.0f));
+}
+
+static int bench_tcp_connect(const char *broker) {
+  char host[256];
+  snprintf(host, sizeof(host), "%s", broker);
+  const char *port = "1883";
+  char *colon = strrchr(host, ':');
+  if (NULL != colon) {
+    *colon = '\0';
+    port = colon + 1;
+  }
+  struct addrinfo hints = {.ai_socktype = SOCK_STREAM};
+  struct addrinfo *res = NULL;
+  if (0 != getaddrinfo(host, port, &hints, &res)) {
+    return -1;
+  }
+  int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (fd >= 0 && 0 != connect(fd, res->ai_addr, res->ai_addrlen)) {
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if (fd >= 0) {
+    // As the firmware's transports do.
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return fd;
+}
+
+// Send a packet and wait for the expected reply; returns bytes exchanged.
+static int bench_mqtt_request(int fd, const uint8_t *req, int len,
+                              mqtt_codec_type_t reply) {
+  if (len < 0 || write(fd, req, len) != len) {
+    return -1;
+  }
+  uint8_t buf[64];
+  size_t got = 0;
+  mqtt_codec_packet_t packet;
+  while (got < sizeof(buf)) {
+    ssize_t n = read(fd, buf + got, sizeof(buf) - got);
+    if (n <= 0) {
+      return -1;
+    }
+    got += (size_t)n;
+    if (1 == mqtt_codec_decode(buf, got, &packet)) {
+      return reply == packet.type ? len + (int)packet.total_len : -1;
+    }
+  }
+  return -1;
+}
+
+static int bench_mqtt_connect(const char *broker, const char *client_id,
+                              uint64_t *bytes) {
+  int fd = bench_tcp_connect(broker);
+  if (fd < 0) {
+    return -1;
+  }
+  uint8_t buf[64];
+  int len = mqtt_codec_connect(buf, sizeof(buf), client_id, 0);
+  int n = bench_mqtt_request(fd, buf, len, MQTT_CODEC_CONNACK);
+  if (n < 0) {
+    close(fd);
+    return -1;
+  }
+  *bytes += (uint64_t)n;
+  return fd;
+}
+
+// Number of fixes in a message: 1, or the size of a compressed batch.
+static size_t bench_mqtt_fixes(const uint8_t *msg, size_t len, uint8_t *raw) {
+  if (MQTT_MGT_LZ_BATCH_MAGIC != msg[0]) {
+    return 1;
+  }
+  int raw_len =
+      mqtt_mgt_lz_batch_decode(msg, len, raw, MQTT_MGT_LZ_BATCH_MAX_LEN);
+  size_t offset = 0;
+  size_t fix_len;
+  size_t fixes = 0;
+  while (raw_len > 0 && NULL != mqtt_mgt_lz_batch_next(raw, (size_t)raw_len,
+                                                       &offset, &fix_len)) {
+    fixes++;
+  }
+  return fixes;
+}
+
+static void *bench_mqtt_rx(void *arg) {
+  (void)arg;
+  uint8_t *buf = malloc(BENCH_MQTT_RX_SIZE);
+  uint8_t *raw = malloc(MQTT_MGT_LZ_BATCH_MAX_LEN);
+  size_t len = 0;
+  size_t index = 0;
+  struct pollfd pfd = {.fd = g_rx_fd, .events = POLLIN};
+  while (NULL != buf && NULL != raw && !atomic_load(&g_rx_stop)) {
+    if (poll(&pfd, 1, BENCH_POLL_MS) <= 0) {
+      continue;
+    }
+    ssize_t n = read(g_rx_fd, buf + len, BENCH_MQTT_RX_SIZE - len);
+    if (n <= 0) {
+      break;
+    }
+    len += (size_t)n;
+    size_t pos = 0;
+    mqtt_codec_packet_t packet;
+    while (1 == mqtt_codec_decode(buf + pos, len - pos, &packet)) {
+      // Per-topic order is kept by the broker: the k-th delivery is fix k.
+      if (MQTT_CODEC_PUBLISH == packet.type && packet.body_len >= 2) {
+        // Delivered at QoS 0: topic, then the message.
+        size_t skip = 2 + ((size_t)packet.body[0] << 8 | packet.body[1]);
+        size_t fixes = packet.body_len > skip
+                           ? bench_mqtt_fixes(packet.body + skip,
+                                              packet.body_len - skip, raw)
+                           : 1;
+        for (size_t i = 0; i < fixes; i++) {
+          bench_delivered(index++);
+        }
+      }
+      pos += packet.total_len;
+    }
+    memmove(buf, buf + pos, len - pos);
+    len -= pos;
+  }
+  free(buf);
+  free(raw);
+  return NULL;
+}
+
+static void *bench_udp_rx(void *arg) {
+  (void)arg;
+  uint8_t datagram[MQTT_MGT_FRAME_MAX_LEN];
+  uint8_t inflated[MQTT_MGT_FRAME_MAX_LEN];
+  struct pollfd pfd = {.fd = g_rx_fd, .events = POLLIN};
+  while (!atomic_load(&g_rx_stop)) {
+    if (poll(&pfd, 1, BENCH_POLL_MS) <= 0) {
+      continue;
+    }
+    ssize_t n = recv(g_rx_fd, datagram, sizeof(datagram), 0);
+    mqtt_mgt_frame_t frame;
+    if (n <= 0 || 0 != mqtt_mgt_frame_decode(datagram, (size_t)n, &frame) ||
+        0 != mqtt_mgt_frame_inflate(&frame, inflated, sizeof(inflated))) {
+      continue;
+    }
+    for (size_t i = 0; i < frame.count; i++) {
+      bench_delivered(frame.seq + i);
+    }
+  }
+  return NULL;
+}
+
+// Read the PUBACKs that have arrived, without blocking unless asked to.
+static void bench_mqtt_drain(int fd, uint8_t *buf, size_t *len, bool block,
+                             bench_result_t *result) {
+  int flags = block ? 0 : MSG_DONTWAIT;
+  ssize_t n;
+  while ((n = recv(fd, buf + *len, BENCH_MQTT_RX_SIZE - *len, flags)) > 0) {
+    *len += (size_t)n;
+    size_t pos = 0;
+    mqtt_codec_packet_t packet;
+    while (1 == mqtt_codec_decode(buf + pos, *len - pos, &packet)) {
+      result->bytes += packet.total_len;
+      result->packets++;
+      pos += packet.total_len;
+    }
+    memmove(buf, buf + pos, *len - pos);
+    *len -= pos;
+    if (block) {
+      break;
+    }
+  }
+}
+
+static int bench_run_mqtt(const bench_opts_t *opts, double rate,
+                          bench_result_t *result) {
+  char topic[64];
+  snprintf(topic, sizeof(topic), BENCH_TOPIC_PREFIX "bench_%d", (int)getpid());
+  uint64_t ignored = 0;
+  g_rx_fd = bench_mqtt_connect(opts->broker, "uplink_bench_sub", &ignored);
+  uint8_t buf[256];
+  if (g_rx_fd < 0 ||
+      bench_mqtt_request(g_rx_fd, buf,
+                         mqtt_codec_subscribe(buf, sizeof(buf), topic, 0, 1),
+                         MQTT_CODEC_SUBACK) < 0) {
+    fprintf(stderr, "Failed to subscribe on %s\n", opts->broker);
+    return -1;
+  }
+  pthread_t rx;
+  atomic_store(&g_rx_stop, false);
+  pthread_create(&rx, NULL, bench_mqtt_rx, NULL);
+
+  uint64_t rng = 0x9E3779B97F4A7C15ull;
+  char date[16];
+  char clock[16];
+  time_t now = time(NULL);
+  strftime(date, sizeof(date), "%Y-%m-%d", localtime(&now));
+  strftime(clock, sizeof(clock), "%H:%M:%S", localtime(&now));
+  uint8_t *ack_buf = malloc(BENCH_MQTT_RX_SIZE);
+  size_t ack_len = 0;
+  // A whole batch, compressed or not, and its packet.
+  char(*json)[PAYLOAD_ENCODER_MSG_MAX_LEN] =
+      malloc(opts->batch * sizeof(*json));
+  size_t *json_len = malloc(opts->batch * sizeof(size_t));
+  size_t pub_size = MQTT_MGT_LZ_BATCH_HEADER_LEN +
+                    MQTT_MGT_LZ_BOUND(opts->batch * sizeof(*json)) + 256;
+  uint8_t *packed = malloc(pub_size);
+  uint8_t *pub = malloc(pub_size);
+  mqtt_mgt_lz_encoder_t enc;
+
+  // Cold start: connecting is part of the time to the first delivery.
+  uint64_t start = bench_now_ns();
+  int fd = bench_mqtt_connect(opts->broker, "uplink_bench_pub",
+                              &result->connect_bytes);
+  if (fd < 0 || NULL == ack_buf || NULL == json || NULL == json_len ||
+      NULL == packed || NULL == pub) {
+    fprintf(stderr, "Failed to connect to %s\n", opts->broker);
+    return -1;
+  }
+  uint64_t next = bench_now_ns();
+  uint64_t period = rate > 0 ? (uint64_t)(1e9 * opts->batch / rate) : 0;
+  uint16_t pkt_id = 0;
+  size_t published = 0;
+  for (size_t i = 0; i < g_fixes; i += opts->batch) {
+    bench_sleep_until(next);
+    next += period;
+    uint64_t t = bench_now_ns();
+    size_t count = i + opts->batch < g_fixes ? opts->batch : g_fixes - i;
+    size_t raw_len = 0;
+    for (size_t j = 0; j < count; j++) {
+      payload_fix_t fix;
+      bench_fix(&rng, &fix);
+      json_len[j] = (size_t)payload_encode_json(
+          json[j], sizeof(json[j]), BENCH_DEVICE_ID, &fix, date, clock);
+      raw_len += json_len[j];
+      g_sent_ns[i + j] = t;
+    }
+    // Compressed like the firmware: one message, if it comes out smaller.
+    int packed_len = -1;
+    if (opts->compress > 0 && count > 1 && raw_len >= opts->compress &&
+        0 == mqtt_mgt_lz_batch_begin(&enc, packed, raw_len)) {
+      int ret = 0;
+      for (size_t j = 0; 0 == ret && j < count; j++) {
+        ret = mqtt_mgt_lz_batch_add(&enc, json[j], json_len[j]);
+      }
+      packed_len = 0 == ret ? mqtt_mgt_lz_batch_end(&enc) : -1;
+    }
+    for (size_t j = 0; j < (packed_len < 0 ? count : 1); j++) {
+      pkt_id = (uint16_t)(pkt_id % UINT16_MAX + 1);
+      int len = packed_len < 0
+                    ? mqtt_codec_publish(pub, pub_size, topic, json[j],
+                                         json_len[j], opts->qos, 0, pkt_id)
+                    : mqtt_codec_publish(pub, pub_size, topic, packed,
+                                         (size_t)packed_len, opts->qos, 0,
+                                         pkt_id);
+      if (write(fd, pub, len) != len) {
+        fprintf(stderr, "Lost the broker connection\n");
+        return -1;
+      }
+      result->bytes += (uint64_t)len;
+      result->packets++;
+      published++;
+    }
+    bench_mqtt_drain(fd, ack_buf, &ack_len, false, result);
+  }
+  bench_wait_delivered();
+  // Collect the remaining acknowledgements.
+  uint64_t acks = opts->qos > 0 ? published * (opts->qos > 1 ? 3 : 1) : 0;
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  while (result->packets < published + acks &&
+         poll(&pfd, 1, BENCH_POLL_MS) > 0) {
+    bench_mqtt_drain(fd, ack_buf, &ack_len, true, result);
+  }
+  bench_collect(result, start);
+
+  atomic_store(&g_rx_stop, true);
+  pthread_join(rx, NULL);
+  close(fd);
+  close(g_rx_fd);
+  free(ack_buf);
+  free(json);
+  free(json_len);
+  free(packed);
+  free(pub);
+  return 0;
+}
+
+static int bench_run_udp(const bench_opts_t *opts, double rate,
+                         bench_result_t *result) {
+  struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+  socklen_t addr_len = sizeof(addr);
+  g_rx_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (g_rx_fd < 0 || 0 != bind(g_rx_fd, (struct sockaddr *)&addr, addr_len) ||
+      0 != getsockname(g_rx_fd, (struct sockaddr *)&addr, &addr_len)) {
+    perror("receiver");
+    return -1;
+  }
+  pthread_t rx;
+  atomic_store(&g_rx_stop, false);
+  pthread_create(&rx, NULL, bench_udp_rx, NULL);
+
+  uint64_t rng = 0x9E3779B97F4A7C15ull;
+  uint32_t time_s = (uint32_t)time(NULL);
+  uint8_t frame[MQTT_MGT_FRAME_MAX_LEN];
+  uint8_t scratch[MQTT_MGT_FRAME_MAX_LEN];
+  mqtt_mgt_lz_encoder_t enc;
+
+  // Cold start, as for MQTT: there is nothing to set up but a socket.
+  uint64_t start = bench_now_ns();
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0 || 0 != connect(fd, (struct sockaddr *)&addr, addr_len)) {
+    perror("sender");
+    return -1;
+  }
+  uint64_t next = bench_now_ns();
+  uint64_t period = rate > 0 ? (uint64_t)(1e9 * opts->batch / rate) : 0;
+  uint16_t message_id = 0;
+  size_t end = 0;
+  for (size_t i = 0; i < g_fixes; i = end) {
+    bench_sleep_until(next);
+    next += period;
+    uint64_t t = bench_now_ns();
+    size_t batch_end = i + opts->batch < g_fixes ? i + opts->batch : g_fixes;
+    // A batch takes as many frames as it needs, like the firmware.
+    for (end = i; end < batch_end;) {
+      mqtt_mgt_frame_writer_t writer;
+      mqtt_mgt_frame_begin(&writer, frame, sizeof(frame), BENCH_DEVICE_ID,
+                           message_id++, (uint32_t)end);
+      while (end < batch_end) {
+        payload_fix_t fix;
+        uint8_t record[PAYLOAD_ENCODER_BIN_LEN];
+        bench_fix(&rng, &fix);
+        payload_encode_binary(record, &fix, time_s);
+        if (0 != mqtt_mgt_frame_add(&writer, record, sizeof(record))) {
+          break;
+        }
+        g_sent_ns[end++] = t;
+      }
+      if (opts->compress > 0 && writer.count > 1 &&
+          writer.len - writer.count_pos - 1 >= opts->compress) {
+        mqtt_mgt_frame_compress(&writer, &enc, scratch, sizeof(scratch));
+      }
+      if (send(fd, writer.buf, writer.len, 0) < 0) {
+        perror("send");
+      }
+      result->bytes += writer.len;
+      result->packets++;
+    }
+  }
+  bench_wait_delivered();
+  bench_collect(result, start);
+
+  atomic_store(&g_rx_stop, true);
+  pthread_join(rx, NULL);
+  close(fd);
+  close(g_rx_fd);
+  return 0;
+}
+
+static void bench_print(const char *name, double rate,
+                        const bench_result_t *r, size_t overhead) {
+  char rate_str[32];
+  if (rate > 0) {
+    snprintf(rate_str, sizeof(rate_str), "%.0f/s", rate);
+  } else {
+    snprintf(rate_str, sizeof(rate_str), "flood");
+  }
+  // Bytes are spent on every fix sent, delivered or not.
+  double fixes = (double)g_fixes;
+  printf("%-8s %8s %7zu %7.2f%% %9.2f %8.3f %8.3f %8.3f %7.1f %7.1f %10.0f\n",
+         name, rate_str, r->delivered, 100.0 * r->delivered / g_fixes,
+         r->first_ns / 1e6, latency_hist_percentile(&r->hist, 50) / 1e3,
+         latency_hist_percentile(&r->hist, 99) / 1e3, r->hist.max / 1e3,
+         r->bytes / fixes, (r->bytes + r->packets * overhead) / fixes,
+         r->elapsed_ns ? r->delivered / (r->elapsed_ns / 1e9) : 0.0);
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-b broker[:port]] [-n fixes] [-B batch] [-r rate] "
+          "[-q qos] [-t mqtt|udp] [-z threshold]\n"
+          "  -b  MQTT broker (default localhost:1883)\n"
+          "  -n  fixes per run (default 10000)\n"
+          "  -B  fixes handed to the uplink at once (default 10)\n"
+          "  -r  fixes per second of the paced runs (default 1000)\n"
+          "  -q  QoS of the MQTT publishes (default 1, as the firmware)\n"
+          "  -t  run only this uplink\n"
+          "  -z  compress batches of at least this many bytes (default 0, "
+          "off)\n",
+          prog);
+}
+
+int main(int argc, char **argv) {
+  bench_opts_t opts = {
+      .broker = "localhost:1883",
+      .fixes = 10000,
+      .batch = 10,
+      .rate = 1000.0,
+      .qos = 1,
+      .mqtt = true,
+      .udp = true,
+  };
+  int opt;
+  while (-1 != (opt = getopt(argc, argv, "b:n:B:r:q:t:z:h"))) {
+    switch (opt) {
+    case 'b':
+      opts.broker = optarg;
+      break;
+    case 'n':
+      opts.fixes = strtoul(optarg, NULL, 10);
+      break;
+    case 'B':
+      opts.batch = strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      opts.rate = atof(optarg);
+      break;
+    case 'q':
+      opts.qos = atoi(optarg);
+      break;
+    case 't':
+      opts.mqtt = 0 == strcmp(optarg, "mqtt");
+      opts.udp = 0 == strcmp(optarg, "udp");
+      break;
+    case 'z':
+      opts.compress = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (0 == opts.fixes || 0 == opts.batch || opts.rate <= 0 || opts.qos < 0 ||
+      opts.qos > 2 || (!opts.mqtt && !opts.udp)) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  g_fixes = opts.fixes;
+  g_sent_ns = calloc(g_fixes, sizeof(uint64_t));
+  g_recv_ns = calloc(g_fixes, sizeof(uint64_t));
+  bench_result_t *result = malloc(sizeof(bench_result_t));
+  if (NULL == g_sent_ns || NULL == g_recv_ns || NULL == result) {
+    return EXIT_FAILURE;
+  }
+
+  printf("%zu fixes per run, batches of %zu, MQTT QoS %d via %s, ",
+         opts.fixes, opts.batch, opts.qos, opts.broker);
+  if (opts.compress > 0) {
+    printf("compressed from %zu bytes\n", opts.compress);
+  } else {
+    printf("uncompressed\n");
+  }
+  printf("%-8s %8s %7s %8s %9s %8s %8s %8s %7s %7s %10s\n", "uplink", "rate",
+         "fixes", "deliv", "first ms", "p50 ms", "p99 ms", "max ms",
+         "B/fix", "IP B/fix", "fixes/s");
+  const double rates[] = {opts.rate, 0.0};
+  for (int t = 0; t < 2; t++) {
+    bool mqtt = 0 == t;
+    if ((mqtt && !opts.mqtt) || (!mqtt && !opts.udp)) {
+      continue;
+    }
+    for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+      memset(g_sent_ns, 0, g_fixes * sizeof(uint64_t));
+      memset(g_recv_ns, 0, g_fixes * sizeof(uint64_t));
+      memset(result, 0, sizeof(*result));
+      atomic_store(&g_delivered, 0);
+      int ret = mqtt ? bench_run_mqtt(&opts, rates[r], result)
+                     : bench_run_udp(&opts, rates[r], result);
+      if (0 != ret) {
+        return EXIT_FAILURE;
+      }
+      bench_print(mqtt ? "mqtt" : "udp", rates[r], result,
+                  mqtt ? BENCH_TCP_IP_OVERHEAD : BENCH_UDP_IP_OVERHEAD);
+      if (mqtt) {
+        printf("%-8s %8s connecting took %llu bytes over TCP\n", "", "",
+               (unsigned long long)result->connect_bytes);
+      }
+    }
+  }
+  free(result);
+  free(g_sent_ns);
+  free(g_recv_ns);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+#include "latency_hist.h"
+#include <string.h>
+
+/********************************************************************************
+ *
+ *                              Private Function Prototypes
+ *
+ ********************************************************************************/
+
+// Index of the highest set bit; value must be non-zero.
+static unsigned latency_hist_msb(uint64_t value);
+
+// Map a value to its (magnitude, sub-bucket) coordinates.
+static void latency_hist_index(uint64_t value, unsigned *mag, unsigned *sub);
+
+// Largest value that maps into the given bucket.
+static uint64_t latency_hist_upper(unsigned mag, unsigned sub);
+
+/********************************************************************************
+ *
+ *                              Public Function Definitions
+ *
+ ********************************************************************************/
+void latency_hist_reset(latency_hist_t *hist) {
+  memset(hist, 0, sizeof(*hist));
+}
+
+void latency_hist_record(latency_hist_t *hist, uint64_t value_us) {
+  unsigned mag, sub;
+  latency_hist_index(value_us, &mag, &sub);
+  hist->counts[mag][sub]++;
+  hist->total++;
+  hist->sum += value_us;
+  if (value_us > hist->max) {
+    hist->max = value_us;
+  }
+}
+
+void latency_hist_merge(latency_hist_t *dst, const latency_hist_t *src) {
+  for (unsigned m = 0; m <= LATENCY_HIST_MAGNITUDES; m++) {
+    for (unsigned s = 0; s < LATENCY_HIST_SUB_BUCKETS; s++) {
+      dst->counts[m][s] += src->counts[m][s];
+    }
+  }
+  dst->total += src->total;
+  dst->sum += src->sum;
+  if (src->max > dst->max) {
+    dst->max = src->max;
+  }
+}
+
+uint64_t latency_hist_percentile(const latency_hist_t *hist,
+                                 double percentile) {
+  if (0 == hist->total) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)((percentile / 100.0) * (double)hist->total + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (unsigned m = 0; m <= LATENCY_HIST_MAGNITUDES; m++) {
+    for (unsigned s = 0; s < LATENCY_HIST_SUB_BUCKETS; s++) {
+      seen += hist->counts[m][s];
+      if (seen >= rank) {
+        uint64_t upper = latency_hist_upper(m, s);
+        return upper < hist->max ? upper : hist->max;
+      }
+    }
+  }
+  return hist->max;
+}
+
+/********************************************************************************
+ *
+ *                              Private Function Definitions
+ *
+ ********************************************************************************/
+static unsigned latency_hist_msb(uint64_t value) {
+  return 63u - (unsigned)__builtin_clzll(value);
+}
+
+static void latency_hist_index(uint64_t value, unsigned *mag, unsigned *sub) {
+  // Values below the sub-bucket count are stored exactly in magnitude 0.
+  if (value < LATENCY_HIST_SUB_BUCKETS) {
+    *mag = 0;
+    *sub = (unsigned)value;
+    return;
+  }
+  // LATENCY_HIST_SUB_BUCKETS == 2^6, so magnitude 1 starts at bit 6.
+  unsigned bit = latency_hist_msb(value);
+  unsigned m = bit - 5;
+  if (m > LATENCY_HIST_MAGNITUDES) {
+    *mag = LATENCY_HIST_MAGNITUDES;
+    *sub = LATENCY_HIST_SUB_BUCKETS - 1;
+    return;
+  }
+  *mag = m;
+  *sub = (unsigned)((value >> (bit - 6)) & (LATENCY_HIST_SUB_BUCKETS - 1));
+}
+
+static uint64_t latency_hist_upper(unsigned mag, unsigned sub) {
+  if (0 == mag) {
+    return sub;
+  }
+  unsigned shift = mag - 1;
+  uint64_t base = (uint64_t)LATENCY_HIST_SUB_BUCKETS << shift;
+  return base + (((uint64_t)sub + 1) << shift) - 1;
+}
@@ -0,0 +1,54 @@
+#ifndef _LATENCY_HIST_H_
+#define _LATENCY_HIST_H_
+
+#include <stdint.h>
+
+/**
+ * @brief Number of linear sub-buckets per power of two.
+ *
+ * Bounds the relative quantization error of a recorded value to ~1.5 %.
+ */
+#define LATENCY_HIST_SUB_BUCKETS (64)
+
+/**
+ * @brief Number of powers of two covered above the exact range (up to ~2^31 us).
+ */
+#define LATENCY_HIST_MAGNITUDES (26)
+
+/**
+ * @brief Fixed-size log-linear latency histogram in microseconds.
+ *
+ * Recording is O(1) and allocation-free, so it can sit on the hot path of the
+ * event loop.
+ */
+typedef struct latency_hist {
+  uint64_t counts[LATENCY_HIST_MAGNITUDES + 1][LATENCY_HIST_SUB_BUCKETS];
+  uint64_t total; ///< Number of recorded samples
+  uint64_t max;   ///< Largest recorded sample
+  uint64_t sum;   ///< Sum of all samples
+} latency_hist_t;
+
+/**
+ * @brief Clear all recorded samples.
+ */
+void latency_hist_reset(latency_hist_t *hist);
+
+/**
+ * @brief Record a single latency sample.
+ */
+void latency_hist_record(latency_hist_t *hist, uint64_t value_us);
+
+/**
+ * @brief Add all samples of @p src into @p dst.
+ */
+void latency_hist_merge(latency_hist_t *dst, const latency_hist_t *src);
+
+/**
+ * @brief Value at the given percentile (0-100).
+ *
+ * @return The upper bound of the bucket holding the percentile, or 0 if the
+ *         histogram is empty.
+ */
+uint64_t latency_hist_percentile(const latency_hist_t *hist, double percentile);
+
+#endif
@@ -0,0 +1,889 @@
+/**
+ * Fleet load generator.
+ *
+ * Simulates N trackers, each with its own MQTT connection, publishing fixes
+ * encoded with the firmware's payload encoder (components/payload). A single
+ * epoll event loop drives all connections and a min-heap of per-device
+ * deadlines drives the report schedule, so one process can sustain tens of
+ * thousands of messages per second.
+ */
+#include "latency_hist.h"
+#include "mqtt_codec.h"
+#include "payload_encoder.h"
+#include "track.h"
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Receive buffer size per device in bytes.
+ */
+#define LOADGEN_RX_BUF_SIZE (256)
+
+/**
+ * @brief Transmit buffer size per device in bytes.
+ */
+#define LOADGEN_TX_BUF_SIZE (1024)
+
+/**
+ * @brief Maximum number of unacknowledged QoS 1 publishes per device.
+ *
+ * Must be a power of two.
+ */
+#define LOADGEN_INFLIGHT_MAX (16)
+
+/**
+ * @brief Maximum number of events handled per epoll_wait() call.
+ */
+#define LOADGEN_MAX_EVENTS (1024)
+
+/**
+ * @brief Maximum length of device identifiers and topics.
+ */
+#define LOADGEN_ID_MAX_LEN (32)
+#define LOADGEN_TOPIC_MAX_LEN (64)
+
+/**
+ * @brief Timeout for TCP connect plus MQTT CONNACK.
+ */
+#define LOADGEN_CONNECT_TIMEOUT_NS (10ull * 1000000000ull)
+
+/**
+ * @brief Delay before reconnecting a device that lost its connection.
+ */
+#define LOADGEN_RECONNECT_DELAY_NS (1ull * 1000000000ull)
+
+#define LOADGEN_NS_PER_MS (1000000ull)
+#define LOADGEN_NS_PER_S (1000000000ull)
+
+/********************************************************************************
+ *
+ *                              Type Declarations
+ *
+ ********************************************************************************/
+
+/**
+ * @brief Connection state of a simulated device.
+ */
+typedef enum {
+  DEVICE_IDLE,       /**< Not connected; timer starts a connection. */
+  DEVICE_CONNECTING, /**< TCP connect in progress. */
+  DEVICE_HANDSHAKE,  /**< CONNECT sent, waiting for CONNACK. */
+  DEVICE_READY,      /**< Publishing; timer sends the next fix. */
+} device_state_t;
+
+/**
+ * @brief A simulated tracker.
+ */
+typedef struct device {
+  int fd;                /**< Socket, or -1 when idle. */
+  device_state_t state;  /**< Connection state. */
+  bool want_write;       /**< EPOLLOUT is currently registered. */
+  uint16_t next_pkt_id;  /**< Next MQTT packet identifier. */
+  uint32_t inflight_cnt; /**< Number of unacknowledged publishes. */
+  uint64_t due_ns;       /**< Deadline of the next timer action. */
+  uint64_t last_fix_ns;  /**< Time of the previous fix. */
+  size_t heap_idx;       /**< Position in the deadline heap. */
+  size_t rx_len;         /**< Bytes buffered in rx. */
+  size_t tx_len;         /**< Bytes pending in tx. */
+  uint64_t inflight[LOADGEN_INFLIGHT_MAX]; /**< Publish time, 0 if free. */
+  track_cursor_t cursor;                   /**< Position source. */
+  char id[LOADGEN_ID_MAX_LEN];             /**< MQTT client id. */
+  char topic[LOADGEN_TOPIC_MAX_LEN];       /**< Egress topic. */
+  uint8_t rx[LOADGEN_RX_BUF_SIZE];         /**< Receive buffer. */
+  uint8_t tx[LOADGEN_TX_BUF_SIZE];         /**< Transmit buffer. */
+} device_t;
+
+/**
+ * @brief Counters collected over a reporting interval.
+ */
+typedef struct loadgen_stats {
+  uint64_t published;      /**< PUBLISH packets written. */
+  uint64_t acked;          /**< PUBACKs received. */
+  uint64_t bytes;          /**< Bytes written to sockets. */
+  uint64_t payload_bytes;  /**< Application payload bytes published. */
+  uint64_t connects;       /**< Successful MQTT sessions. */
+  uint64_t connect_errors; /**< Failed connects or handshakes. */
+  uint64_t disconnects;    /**< Established sessions that dropped. */
+  uint64_t lost;           /**< In-flight publishes lost on disconnect. */
+  uint64_t backpressure;   /**< Fixes skipped because a device was saturated. */
+  latency_hist_t ack_us;   /**< PUBLISH to PUBACK latency. */
+} loadgen_stats_t;
+
+/**
+ * @brief Command-line configuration.
+ */
+typedef struct loadgen_config {
+  const char *host;         /**< Broker host. */
+  const char *port;         /**< Broker port. */
+  uint32_t devices;         /**< Number of simulated devices. */
+  uint32_t interval_ms;     /**< Mean report interval per device. */
+  double jitter;            /**< Relative jitter of the report interval. */
+  int qos;                  /**< Publish QoS (0 or 1). */
+  int retain;               /**< Publish retain flag. */
+  uint32_t duration_s;      /**< Run time, 0 for unlimited. */
+  uint32_t connect_rate;    /**< New connections per second. */
+  uint32_t report_ms;       /**< Statistics reporting period. */
+  const char *track_path;   /**< Optional CSV track to replay. */
+  double center_lat;        /**< Center of the simulated fleet. */
+  double center_lng;        /**< Center of the simulated fleet. */
+  double radius_deg;        /**< Spread of the simulated fleet. */
+  const char *id_prefix;    /**< Device id prefix. */
+  const char *topic_prefix; /**< Egress topic prefix. */
+} loadgen_config_t;
+
+/********************************************************************************
+ *
+ *                              Private Global Variables
+ *
+ ********************************************************************************/
+
+// Set from the signal handler to stop the event loop.
+static volatile sig_atomic_t g_stop = 0;
+
+// Configuration with defaults matching the firmware.
+static loadgen_config_t g_cfg = {
+    .host = "127.0.0.1",
+    .port = "1883",
+    .devices = 1000,
+    .interval_ms = 5000,
+    .jitter = 0.1,
+    .qos = 1,
+    .retain = 0,
+    .duration_s = 60,
+    .connect_rate = 1000,
+    .report_ms = 1000,
+    .track_path = NULL,
+    .center_lat = 13.7563,
+    .center_lng = 100.5018,
+    .radius_deg = 0.5,
+    .id_prefix = "SIM_",
+    .topic_prefix = "/egress/",
+};
+
+// Resolved broker address.
+static struct addrinfo *g_addr = NULL;
+
+// epoll instance driving all sockets.
+static int g_epfd = -1;
+
+// All simulated devices.
+static device_t *g_devices = NULL;
+
+// Min-heap of devices ordered by due_ns.
+static device_t **g_heap = NULL;
+static size_t g_heap_len = 0;
+
+// Interval and cumulative statistics.
+static loadgen_stats_t g_interval = {0};
+static loadgen_stats_t g_total = {0};
+
+// Cached wall-clock date and time strings, refreshed once per second.
+static char g_date[16] = {0};
+static char g_time[16] = {0};
+static time_t g_cached_second = 0;
+
+/********************************************************************************
+ *
+ *                              Private Function Prototypes
+ *
+ ********************************************************************************/
+
+// Monotonic clock in nanoseconds.
+static uint64_t loadgen_now_ns(void);
+
+// Parse the command line into g_cfg; returns false on invalid input.
+static bool loadgen_parse_args(int argc, char **argv);
+
+// Restore the heap property after dev->due_ns changed.
+static void loadgen_heap_update(device_t *dev);
+
+// Handle the timer of the device at the top of the heap.
+static void loadgen_on_timer(device_t *dev, uint64_t now);
+
+// Start a non-blocking TCP connection.
+static void loadgen_connect(device_t *dev, uint64_t now);
+
+// Tear down the connection and schedule a reconnect.
+static void loadgen_close(device_t *dev, uint64_t now);
+
+// Encode and send the next fix of a ready device.
+static void loadgen_publish(device_t *dev, uint64_t now);
+
+// Append bytes to the transmit buffer and try to flush it.
+static bool loadgen_send(device_t *dev, const uint8_t *data, size_t len,
+                         uint64_t now);
+
+// Flush as much of the transmit buffer as the socket accepts.
+static void loadgen_flush(device_t *dev, uint64_t now);
+
+// Handle EPOLLOUT.
+static void loadgen_on_writable(device_t *dev, uint64_t now);
+
+// Handle EPOLLIN.
+static void loadgen_on_readable(device_t *dev, uint64_t now);
+
+// Update the epoll interest set of a device.
+static void loadgen_set_events(device_t *dev, bool want_write);
+
+// Next report deadline with jitter applied.
+static uint64_t loadgen_next_interval_ns(device_t *dev);
+
+// Print interval statistics and fold them into the totals.
+static void loadgen_report(double elapsed_s, double period_s);
+
+// Fold the interval statistics into the totals and reset them.
+static void loadgen_fold(void);
+
+// Print cumulative statistics.
+static void loadgen_summary(double elapsed_s);
+
+// Signal handler for SIGINT/SIGTERM.
+static void loadgen_on_signal(int sig);
+
+/********************************************************************************
+ *
+ *                              Public Function Definitions
+ *
+ ********************************************************************************/
+int main(int argc, char **argv) {
+  if (!loadgen_parse_args(argc, argv)) {
+    return EXIT_FAILURE;
+  }
+
+  struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+  int gai = getaddrinfo(g_cfg.host, g_cfg.port, &hints, &g_addr);
+  if (0 != gai) {
+    fprintf(stderr, "Failed to resolve %s:%s: %s\n", g_cfg.host, g_cfg.port,
+            gai_strerror(gai));
+    return EXIT_FAILURE;
+  }
+
+  // Every device needs its own socket.
+  struct rlimit lim;
+  if (0 == getrlimit(RLIMIT_NOFILE, &lim)) {
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+    if (lim.rlim_cur < (rlim_t)g_cfg.devices + 16) {
+      fprintf(stderr, "Warning: open file limit %llu is below %u devices\n",
+              (unsigned long long)lim.rlim_cur, g_cfg.devices);
+    }
+  }
+
+  track_t track = {0};
+  if (g_cfg.track_path && 0 != track_load_csv(&track, g_cfg.track_path)) {
+    return EXIT_FAILURE;
+  }
+
+  g_epfd = epoll_create1(0);
+  g_devices = calloc(g_cfg.devices, sizeof(device_t));
+  g_heap = calloc(g_cfg.devices, sizeof(device_t *));
+  if (g_epfd < 0 || NULL == g_devices || NULL == g_heap) {
+    fprintf(stderr, "Failed to allocate %u devices\n", g_cfg.devices);
+    return EXIT_FAILURE;
+  }
+
+  signal(SIGINT, loadgen_on_signal);
+  signal(SIGTERM, loadgen_on_signal);
+  signal(SIGPIPE, SIG_IGN);
+
+  uint64_t start = loadgen_now_ns();
+  uint64_t connect_spacing =
+      g_cfg.connect_rate ? LOADGEN_NS_PER_S / g_cfg.connect_rate : 0;
+  for (uint32_t i = 0; i < g_cfg.devices; i++) {
+    device_t *dev = &g_devices[i];
+    dev->fd = -1;
+    dev->state = DEVICE_IDLE;
+    dev->next_pkt_id = 1;
+    snprintf(dev->id, sizeof(dev->id), "%s%05u", g_cfg.id_prefix, i);
+    snprintf(dev->topic, sizeof(dev->topic), "%s%s", g_cfg.topic_prefix,
+             dev->id);
+    track_cursor_init(&dev->cursor, g_cfg.track_path ? &track : NULL,
+                      0x5EED0000ull + i * 0x9E3779B9ull, g_cfg.center_lat,
+                      g_cfg.center_lng, g_cfg.radius_deg);
+    // Ramp connections up at connect_rate; deadlines are already ordered.
+    dev->due_ns = start + (uint64_t)i * connect_spacing;
+    dev->heap_idx = i;
+    g_heap[i] = dev;
+  }
+  g_heap_len = g_cfg.devices;
+
+  printf("Simulating %u devices against %s:%s, interval %u ms ±%.0f%%, "
+         "QoS %d\n",
+         g_cfg.devices, g_cfg.host, g_cfg.port, g_cfg.interval_ms,
+         g_cfg.jitter * 100.0, g_cfg.qos);
+  printf("%8s %10s %10s %8s %8s %8s %8s %8s %6s %6s %6s\n", "time_s",
+         "pub/s", "ack/s", "p50_ms", "p90_ms", "p99_ms", "max_ms", "ready",
+         "conn", "disc", "skip");
+
+  uint64_t end =
+      g_cfg.duration_s ? start + g_cfg.duration_s * LOADGEN_NS_PER_S : 0;
+  uint64_t report_period = g_cfg.report_ms * LOADGEN_NS_PER_MS;
+  uint64_t next_report = start + report_period;
+  uint64_t last_report = start;
+  struct epoll_event events[LOADGEN_MAX_EVENTS];
+
+  while (!g_stop) {
+    uint64_t now = loadgen_now_ns();
+    if (end && now >= end) {
+      break;
+    }
+    uint64_t wake = next_report;
+    if (g_heap_len && g_heap[0]->due_ns < wake) {
+      wake = g_heap[0]->due_ns;
+    }
+    int timeout_ms = 0;
+    if (wake > now) {
+      timeout_ms = (int)((wake - now + LOADGEN_NS_PER_MS - 1) /
+                         LOADGEN_NS_PER_MS);
+    }
+
+    int n = epoll_wait(g_epfd, events, LOADGEN_MAX_EVENTS, timeout_ms);
+    now = loadgen_now_ns();
+    for (int i = 0; i < n; i++) {
+      device_t *dev = events[i].data.ptr;
+      uint32_t ev = events[i].events;
+      if (dev->fd < 0) {
+        continue;
+      }
+      if (ev & EPOLLOUT) {
+        loadgen_on_writable(dev, now);
+      }
+      if (dev->fd >= 0 && (ev & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+        loadgen_on_readable(dev, now);
+      }
+    }
+
+    while (g_heap_len && g_heap[0]->due_ns <= now) {
+      loadgen_on_timer(g_heap[0], now);
+    }
+
+    if (now >= next_report) {
+      loadgen_report((double)(now - start) / LOADGEN_NS_PER_S,
+                     (double)(now - last_report) / LOADGEN_NS_PER_S);
+      last_report = now;
+      next_report += report_period;
+      if (next_report <= now) {
+        next_report = now + report_period;
+      }
+    }
+  }
+
+  uint64_t now = loadgen_now_ns();
+  if (now - last_report >= report_period / 10) {
+    loadgen_report((double)(now - start) / LOADGEN_NS_PER_S,
+                   (double)(now - last_report) / LOADGEN_NS_PER_S);
+  } else {
+    loadgen_fold();
+  }
+  loadgen_summary((double)(now - start) / LOADGEN_NS_PER_S);
+
+  for (uint32_t i = 0; i < g_cfg.devices; i++) {
+    if (g_devices[i].fd >= 0) {
+      close(g_devices[i].fd);
+    }
+  }
+  close(g_epfd);
+  free(g_heap);
+  free(g_devices);
+  track_free(&track);
+  freeaddrinfo(g_addr);
+  return (g_total.connects > 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/********************************************************************************
+ *
+ *                              Private Function Definitions
+ *
+ ********************************************************************************/
+static uint64_t loadgen_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * LOADGEN_NS_PER_S + (uint64_t)ts.tv_nsec;
+}
+
+static bool loadgen_parse_args(int argc, char **argv) {
+  static const struct option options[] = {
+      {"host", required_argument, NULL, 'H'},
+      {"port", required_argument, NULL, 'p'},
+      {"devices", required_argument, NULL, 'n'},
+      {"interval-ms", required_argument, NULL, 'i'},
+      {"jitter", required_argument, NULL, 'j'},
+      {"qos", required_argument, NULL, 'q'},
+      {"retain", no_argument, NULL, 'r'},
+      {"duration", required_argument, NULL, 'd'},
+      {"connect-rate", required_argument, NULL, 'c'},
+      {"report-ms", required_argument, NULL, 'R'},
+      {"track", required_argument, NULL, 't'},
+      {"center", required_argument, NULL, 'C'},
+      {"radius", required_argument, NULL, 'a'},
+      {"id-prefix", required_argument, NULL, 'I'},
+      {"topic-prefix", required_argument, NULL, 'T'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+  int opt;
+  while (-1 != (opt = getopt_long(argc, argv, "H:p:n:i:j:q:rd:c:R:t:C:a:I:T:h",
+                                  options, NULL))) {
+    switch (opt) {
+    case 'H':
+      g_cfg.host = optarg;
+      break;
+    case 'p':
+      g_cfg.port = optarg;
+      break;
+    case 'n':
+      g_cfg.devices = (uint32_t)strtoul(optarg, NULL, 10);
+      break;
+    case 'i':
+      g_cfg.interval_ms = (uint32_t)strtoul(optarg, NULL, 10);
+      break;
+    case 'j':
+      g_cfg.jitter = strtod(optarg, NULL);
+      break;
+    case 'q':
+      g_cfg.qos = atoi(optarg);
+      break;
+    case 'r':
+      g_cfg.retain = 1;
+      break;
+    case 'd':
+      g_cfg.duration_s = (uint32_t)strtoul(optarg, NULL, 10);
+      break;
+    case 'c':
+      g_cfg.connect_rate = (uint32_t)strtoul(optarg, NULL, 10);
+      break;
+    case 'R':
+      g_cfg.report_ms = (uint32_t)strtoul(optarg, NULL, 10);
+      break;
+    case 't':
+      g_cfg.track_path = optarg;
+      break;
+    case 'C':
+      if (2 != sscanf(optarg, "%lf,%lf", &g_cfg.center_lat,
+                      &g_cfg.center_lng)) {
+        fprintf(stderr, "--center expects LAT,LNG\n");
+        return false;
+      }
+      break;
+    case 'a':
+      g_cfg.radius_deg = strtod(optarg, NULL);
+      break;
+    case 'I':
+      g_cfg.id_prefix = optarg;
+      break;
+    case 'T':
+      g_cfg.topic_prefix = optarg;
+      break;
+    case 'h':
+    default:
+      fprintf(stderr,
+              "Usage: %s [options]\n"
+              "  -H, --host HOST          broker host (127.0.0.1)\n"
+              "  -p, --port PORT          broker port (1883)\n"
+              "  -n, --devices N          simulated devices (1000)\n"
+              "  -i, --interval-ms MS     report interval per device (5000)\n"
+              "  -j, --jitter FRAC        relative interval jitter (0.1)\n"
+              "  -q, --qos 0|1            publish QoS (1)\n"
+              "  -r, --retain             set the retain flag\n"
+              "  -d, --duration S         run time, 0 = until ^C (60)\n"
+              "  -c, --connect-rate N     new connections per second (1000)\n"
+              "  -R, --report-ms MS       statistics period (1000)\n"
+              "  -t, --track FILE         replay \"lat,lng\" CSV track\n"
+              "  -C, --center LAT,LNG     fleet center (13.7563,100.5018)\n"
+              "  -a, --radius DEG         fleet spread in degrees (0.5)\n"
+              "  -I, --id-prefix STR      device id prefix (SIM_)\n"
+              "  -T, --topic-prefix STR   egress topic prefix (/egress/)\n",
+              argv[0]);
+      return false;
+    }
+  }
+  if (0 == g_cfg.devices || 0 == g_cfg.interval_ms || 0 == g_cfg.report_ms ||
+      g_cfg.qos < 0 || g_cfg.qos > 1 || g_cfg.jitter < 0.0 ||
+      g_cfg.jitter >= 1.0) {
+    fprintf(stderr, "Invalid arguments; see --help\n");
+    return false;
+  }
+  return true;
+}
+
+static void loadgen_heap_update(device_t *dev) {
+  size_t i = dev->heap_idx;
+  // Sift up.
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (g_heap[parent]->due_ns <= dev->due_ns) {
+      break;
+    }
+    g_heap[i] = g_heap[parent];
+    g_heap[i]->heap_idx = i;
+    i = parent;
+  }
+  // Sift down.
+  for (;;) {
+    size_t left = 2 * i + 1;
+    if (left >= g_heap_len) {
+      break;
+    }
+    size_t child = left;
+    if (left + 1 < g_heap_len &&
+        g_heap[left + 1]->due_ns < g_heap[left]->due_ns) {
+      child = left + 1;
+    }
+    if (g_heap[child]->due_ns >= dev->due_ns) {
+      break;
+    }
+    g_heap[i] = g_heap[child];
+    g_heap[i]->heap_idx = i;
+    i = child;
+  }
+  g_heap[i] = dev;
+  dev->heap_idx = i;
+}
+
+static void loadgen_on_timer(device_t *dev, uint64_t now) {
+  switch (dev->state) {
+  case DEVICE_IDLE:
+    loadgen_connect(dev, now);
+    break;
+  case DEVICE_CONNECTING:
+  case DEVICE_HANDSHAKE:
+    // Connect or CONNACK timed out.
+    loadgen_close(dev, now);
+    break;
+  case DEVICE_READY:
+    loadgen_publish(dev, now);
+    if (dev->state == DEVICE_READY) {
+      dev->due_ns = now + loadgen_next_interval_ns(dev);
+      loadgen_heap_update(dev);
+    }
+    break;
+  }
+}
+
+static void loadgen_connect(device_t *dev, uint64_t now) {
+  dev->fd = socket(g_addr->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (dev->fd < 0) {
+    perror("socket");
+    g_interval.connect_errors++;
+    dev->due_ns = now + LOADGEN_RECONNECT_DELAY_NS;
+    loadgen_heap_update(dev);
+    return;
+  }
+  int one = 1;
+  setsockopt(dev->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  dev->rx_len = 0;
+  dev->tx_len = 0;
+  dev->inflight_cnt = 0;
+  memset(dev->inflight, 0, sizeof(dev->inflight));
+
+  int ret = connect(dev->fd, g_addr->ai_addr, g_addr->ai_addrlen);
+  if (ret < 0 && errno != EINPROGRESS) {
+    loadgen_close(dev, now);
+    return;
+  }
+  dev->state = DEVICE_CONNECTING;
+  struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT, .data.ptr = dev};
+  epoll_ctl(g_epfd, EPOLL_CTL_ADD, dev->fd, &ev);
+  dev->want_write = true;
+  dev->due_ns = now + LOADGEN_CONNECT_TIMEOUT_NS;
+  loadgen_heap_update(dev);
+}
+
+static void loadgen_close(device_t *dev, uint64_t now) {
+  if (dev->fd >= 0) {
+    close(dev->fd);
+    dev->fd = -1;
+  }
+  if (dev->state == DEVICE_READY) {
+    g_interval.disconnects++;
+    g_interval.lost += dev->inflight_cnt;
+  } else {
+    g_interval.connect_errors++;
+  }
+  dev->state = DEVICE_IDLE;
+  dev->want_write = false;
+  dev->due_ns = now + LOADGEN_RECONNECT_DELAY_NS;
+  loadgen_heap_update(dev);
+}
+
+static void loadgen_publish(device_t *dev, uint64_t now) {
+  uint16_t pkt_id = 0;
+  size_t slot = 0;
+  if (g_cfg.qos > 0) {
+    pkt_id = dev->next_pkt_id;
+    slot = pkt_id & (LOADGEN_INFLIGHT_MAX - 1);
+    if (dev->inflight[slot]) {
+      // The broker is not keeping up with this device.
+      g_interval.backpressure++;
+      return;
+    }
+  }
+
+  double dt_s = dev->last_fix_ns
+                    ? (double)(now - dev->last_fix_ns) / LOADGEN_NS_PER_S
+                    : (double)g_cfg.interval_ms / 1000.0;
+  dev->last_fix_ns = now;
+  float lat, lng, battery;
+  track_cursor_next(&dev->cursor, dt_s, &lat, &lng, &battery);
+  payload_fix_t fix;
+  payload_fix_from_degrees(&fix, lat, lng, battery);
+
+  time_t wall = time(NULL);
+  if (wall != g_cached_second) {
+    struct tm tm;
+    localtime_r(&wall, &tm);
+    strftime(g_date, sizeof(g_date), "%Y-%m-%d", &tm);
+    strftime(g_time, sizeof(g_time), "%H:%M:%S", &tm);
+    g_cached_second = wall;
+  }
+
+  char msg[PAYLOAD_ENCODER_MSG_MAX_LEN];
+  int msg_len =
+      payload_encode_json(msg, sizeof(msg), dev->id, &fix, g_date, g_time);
+  if (msg_len < 0) {
+    g_interval.backpressure++;
+    return;
+  }
+
+  uint8_t packet[LOADGEN_TX_BUF_SIZE];
+  int len = mqtt_codec_publish(packet, sizeof(packet), dev->topic, msg,
+                               (size_t)msg_len, g_cfg.qos, g_cfg.retain,
+                               pkt_id);
+  if (len < 0 || !loadgen_send(dev, packet, (size_t)len, now)) {
+    return;
+  }
+  if (g_cfg.qos > 0) {
+    dev->inflight[slot] = now;
+    dev->inflight_cnt++;
+    dev->next_pkt_id = (uint16_t)(pkt_id + 1);
+    if (0 == dev->next_pkt_id) {
+      dev->next_pkt_id = 1;
+    }
+  }
+  g_interval.published++;
+  g_interval.payload_bytes += (uint64_t)msg_len;
+}
+
+static bool loadgen_send(device_t *dev, const uint8_t *data, size_t len,
+                         uint64_t now) {
+  if (dev->tx_len + len > sizeof(dev->tx)) {
+    g_interval.backpressure++;
+    return false;
+  }
+  memcpy(dev->tx + dev->tx_len, data, len);
+  dev->tx_len += len;
+  loadgen_flush(dev, now);
+  return dev->fd >= 0;
+}
+
+static void loadgen_flush(device_t *dev, uint64_t now) {
+  if (dev->state == DEVICE_CONNECTING) {
+    return;
+  }
+  size_t sent = 0;
+  while (sent < dev->tx_len) {
+    ssize_t n = send(dev->fd, dev->tx + sent, dev->tx_len - sent, 0);
+    if (n > 0) {
+      sent += (size_t)n;
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    loadgen_close(dev, now);
+    return;
+  }
+  g_interval.bytes += sent;
+  if (sent > 0) {
+    memmove(dev->tx, dev->tx + sent, dev->tx_len - sent);
+    dev->tx_len -= sent;
+  }
+  loadgen_set_events(dev, dev->tx_len > 0);
+}
+
+static void loadgen_on_writable(device_t *dev, uint64_t now) {
+  if (dev->state == DEVICE_CONNECTING) {
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+    getsockopt(dev->fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+    if (0 != err) {
+      loadgen_close(dev, now);
+      return;
+    }
+    dev->state = DEVICE_HANDSHAKE;
+    uint8_t packet[64];
+    int len = mqtt_codec_connect(packet, sizeof(packet), dev->id, 0);
+    if (len < 0) {
+      loadgen_close(dev, now);
+      return;
+    }
+    loadgen_send(dev, packet, (size_t)len, now);
+    return;
+  }
+  loadgen_flush(dev, now);
+}
+
+static void loadgen_on_readable(device_t *dev, uint64_t now) {
+  for (;;) {
+    ssize_t n = recv(dev->fd, dev->rx + dev->rx_len,
+                     sizeof(dev->rx) - dev->rx_len, 0);
+    if (n == 0) {
+      loadgen_close(dev, now);
+      return;
+    }
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      loadgen_close(dev, now);
+      return;
+    }
+    dev->rx_len += (size_t)n;
+
+    size_t consumed = 0;
+    mqtt_codec_packet_t packet;
+    int ret;
+    while (1 == (ret = mqtt_codec_decode(dev->rx + consumed,
+                                         dev->rx_len - consumed, &packet))) {
+      consumed += packet.total_len;
+      if (packet.type == MQTT_CODEC_CONNACK && packet.body_len >= 2) {
+        if (0 != packet.body[1] || dev->state != DEVICE_HANDSHAKE) {
+          loadgen_close(dev, now);
+          return;
+        }
+        dev->state = DEVICE_READY;
+        g_interval.connects++;
+        // Spread the first report over one interval to avoid bursts.
+        uint64_t interval = g_cfg.interval_ms * LOADGEN_NS_PER_MS;
+        dev->due_ns =
+            now + (uint64_t)(track_rand_unit(&dev->cursor.rng) * interval);
+        dev->last_fix_ns = 0;
+        loadgen_heap_update(dev);
+      } else if (packet.type == MQTT_CODEC_PUBACK && packet.body_len >= 2) {
+        uint16_t pkt_id = (uint16_t)((packet.body[0] << 8) | packet.body[1]);
+        size_t slot = pkt_id & (LOADGEN_INFLIGHT_MAX - 1);
+        if (dev->inflight[slot]) {
+          latency_hist_record(&g_interval.ack_us,
+                              (now - dev->inflight[slot]) / 1000);
+          dev->inflight[slot] = 0;
+          dev->inflight_cnt--;
+          g_interval.acked++;
+        }
+      }
+    }
+    if (ret < 0 || (consumed == 0 && dev->rx_len == sizeof(dev->rx))) {
+      // Malformed stream or a packet larger than we are willing to buffer.
+      loadgen_close(dev, now);
+      return;
+    }
+    memmove(dev->rx, dev->rx + consumed, dev->rx_len - consumed);
+    dev->rx_len -= consumed;
+  }
+}
+
+static void loadgen_set_events(device_t *dev, bool want_write) {
+  if (dev->fd < 0 || dev->want_write == want_write) {
+    return;
+  }
+  struct epoll_event ev = {.events = EPOLLIN | (want_write ? EPOLLOUT : 0),
+                           .data.ptr = dev};
+  epoll_ctl(g_epfd, EPOLL_CTL_MOD, dev->fd, &ev);
+  dev->want_write = want_write;
+}
+
+static uint64_t loadgen_next_interval_ns(device_t *dev) {
+  double jitter = (track_rand_unit(&dev->cursor.rng) * 2.0 - 1.0) *
+                  g_cfg.jitter;
+  return (uint64_t)((double)g_cfg.interval_ms * (1.0 + jitter) *
+                    (double)LOADGEN_NS_PER_MS);
+}
+
+static void loadgen_report(double elapsed_s, double period_s) {
+  uint32_t ready = 0;
+  for (uint32_t i = 0; i < g_cfg.devices; i++) {
+    ready += (g_devices[i].state == DEVICE_READY);
+  }
+  const latency_hist_t *h = &g_interval.ack_us;
+  printf("%8.1f %10.0f %10.0f %8.2f %8.2f %8.2f %8.2f %8u %6llu %6llu "
+         "%6llu\n",
+         elapsed_s, (double)g_interval.published / period_s,
+         (double)g_interval.acked / period_s,
+         latency_hist_percentile(h, 50.0) / 1000.0,
+         latency_hist_percentile(h, 90.0) / 1000.0,
+         latency_hist_percentile(h, 99.0) / 1000.0, h->max / 1000.0, ready,
+         (unsigned long long)g_interval.connects,
+         (unsigned long long)g_interval.disconnects,
+         (unsigned long long)g_interval.backpressure);
+  fflush(stdout);
+  loadgen_fold();
+}
+
+static void loadgen_fold(void) {
+  g_total.published += g_interval.published;
+  g_total.acked += g_interval.acked;
+  g_total.bytes += g_interval.bytes;
+  g_total.payload_bytes += g_interval.payload_bytes;
+  g_total.connects += g_interval.connects;
+  g_total.connect_errors += g_interval.connect_errors;
+  g_total.disconnects += g_interval.disconnects;
+  g_total.lost += g_interval.lost;
+  g_total.backpressure += g_interval.backpressure;
+  latency_hist_merge(&g_total.ack_us, &g_interval.ack_us);
+  memset(&g_interval, 0, sizeof(g_interval));
+}
+
+static void loadgen_summary(double elapsed_s) {
+  const latency_hist_t *h = &g_total.ack_us;
+  double published = g_total.published ? (double)g_total.published : 1.0;
+  printf("\n==== Summary (%.1f s) ====\n", elapsed_s);
+  printf("published        %llu (%.0f msg/s)\n",
+         (unsigned long long)g_total.published,
+         (double)g_total.published / elapsed_s);
+  printf("acked            %llu (%.0f msg/s)\n",
+         (unsigned long long)g_total.acked, (double)g_total.acked / elapsed_s);
+  printf("bytes/fix        %.1f on the wire, %.1f payload\n",
+         (double)g_total.bytes / published,
+         (double)g_total.payload_bytes / published);
+  if (h->total) {
+    printf("ack latency ms   avg %.2f p50 %.2f p90 %.2f p99 %.2f p99.9 %.2f "
+           "max %.2f\n",
+           (double)h->sum / (double)h->total / 1000.0,
+           latency_hist_percentile(h, 50.0) / 1000.0,
+           latency_hist_percentile(h, 90.0) / 1000.0,
+           latency_hist_percentile(h, 99.0) / 1000.0,
+           latency_hist_percentile(h, 99.9) / 1000.0, h->max / 1000.0);
+  }
+  printf("sessions         %llu connected, %llu connect errors, "
+         "%llu disconnects\n",
+         (unsigned long long)g_total.connects,
+         (unsigned long long)g_total.connect_errors,
+         (unsigned long long)g_total.disconnects);
+  printf("errors           %llu lost in flight, %llu skipped (backpressure)\n",
+         (unsigned long long)g_total.lost,
+         (unsigned long long)g_total.backpressure);
+}
+
+static void loadgen_on_signal(int sig) {
+  (void)sig;
+  g_stop = 1;
+}
@@ -0,0 +1,169 @@
+#include "mqtt_codec.h"
+#include <string.h>
+
+/**
+ * @brief Largest value representable by the remaining-length field.
+ */
+#define MQTT_CODEC_MAX_REMAINING_LEN (268435455u)
+
+/********************************************************************************
+ *
+ *                              Private Function Prototypes
+ *
+ ********************************************************************************/
+
+// Number of bytes needed to encode a remaining-length value.
+static size_t mqtt_codec_varint_len(size_t value);
+
+// Write a remaining-length value; returns the number of bytes written.
+static size_t mqtt_codec_write_varint(uint8_t *buf, size_t value);
+
+// Write a length-prefixed UTF-8 string; returns the number of bytes written.
+static size_t mqtt_codec_write_string(uint8_t *buf, const char *str,
+                                      size_t len);
+
+/********************************************************************************
+ *
+ *                              Public Function Definitions
+ *
+ ********************************************************************************/
+int mqtt_codec_connect(uint8_t *buf, size_t size, const char *client_id,
+                       uint16_t keepalive_s) {
+  size_t id_len = strlen(client_id);
+  // Protocol name (6) + level (1) + flags (1) + keepalive (2) + client id
+  size_t remaining = 10 + 2 + id_len;
+  size_t total = 1 + mqtt_codec_varint_len(remaining) + remaining;
+  if (total > size) {
+    return -1;
+  }
+  uint8_t *p = buf;
+  *p++ = MQTT_CODEC_CONNECT << 4;
+  p += mqtt_codec_write_varint(p, remaining);
+  p += mqtt_codec_write_string(p, "MQTT", 4);
+  *p++ = 4;    // Protocol level 3.1.1
+  *p++ = 0x02; // Clean session
+  *p++ = (uint8_t)(keepalive_s >> 8);
+  *p++ = (uint8_t)(keepalive_s & 0xFF);
+  p += mqtt_codec_write_string(p, client_id, id_len);
+  return (int)(p - buf);
+}
+
+int mqtt_codec_publish(uint8_t *buf, size_t size, const char *topic,
+                       const void *payload, size_t payload_len, int qos,
+                       int retain, uint16_t pkt_id) {
+  size_t topic_len = strlen(topic);
+  size_t total = mqtt_codec_publish_overhead(topic_len, payload_len, qos) +
+                 payload_len;
+  if (total > size) {
+    return -1;
+  }
+  size_t remaining = 2 + topic_len + (qos > 0 ? 2 : 0) + payload_len;
+  uint8_t *p = buf;
+  *p++ = (uint8_t)((MQTT_CODEC_PUBLISH << 4) | ((qos & 0x03) << 1) |
+                   (retain ? 1 : 0));
+  p += mqtt_codec_write_varint(p, remaining);
+  p += mqtt_codec_write_string(p, topic, topic_len);
+  if (qos > 0) {
+    *p++ = (uint8_t)(pkt_id >> 8);
+    *p++ = (uint8_t)(pkt_id & 0xFF);
+  }
+  memcpy(p, payload, payload_len);
+  p += payload_len;
+  return (int)(p - buf);
+}
+
+int mqtt_codec_subscribe(uint8_t *buf, size_t size, const char *topic_filter,
+                         int qos, uint16_t pkt_id) {
+  size_t filter_len = strlen(topic_filter);
+  // Packet identifier (2) + topic filter + requested QoS (1)
+  size_t remaining = 2 + 2 + filter_len + 1;
+  size_t total = 1 + mqtt_codec_varint_len(remaining) + remaining;
+  if (total > size) {
+    return -1;
+  }
+  uint8_t *p = buf;
+  *p++ = (MQTT_CODEC_SUBSCRIBE << 4) | 0x02; // Reserved flags are 0010
+  p += mqtt_codec_write_varint(p, remaining);
+  *p++ = (uint8_t)(pkt_id >> 8);
+  *p++ = (uint8_t)(pkt_id & 0xFF);
+  p += mqtt_codec_write_string(p, topic_filter, filter_len);
+  *p++ = (uint8_t)(qos & 0x03);
+  return (int)(p - buf);
+}
+
+size_t mqtt_codec_publish_overhead(size_t topic_len, size_t payload_len,
+                                   int qos) {
+  size_t remaining = 2 + topic_len + (qos > 0 ? 2 : 0) + payload_len;
+  return 1 + mqtt_codec_varint_len(remaining) + remaining - payload_len;
+}
+
+int mqtt_codec_decode(const uint8_t *buf, size_t len,
+                      mqtt_codec_packet_t *packet) {
+  if (len < 2) {
+    return 0;
+  }
+  size_t remaining = 0;
+  size_t multiplier = 1;
+  size_t pos = 1;
+  for (;;) {
+    if (pos >= len) {
+      return 0;
+    }
+    if (pos > 4) {
+      return -1;
+    }
+    uint8_t byte = buf[pos++];
+    remaining += (byte & 0x7F) * multiplier;
+    multiplier *= 128;
+    if (0 == (byte & 0x80)) {
+      break;
+    }
+  }
+  if (len - pos < remaining) {
+    return 0;
+  }
+  packet->type = (mqtt_codec_type_t)(buf[0] >> 4);
+  packet->flags = buf[0] & 0x0F;
+  packet->body = buf + pos;
+  packet->body_len = remaining;
+  packet->total_len = pos + remaining;
+  return 1;
+}
+
+/********************************************************************************
+ *
+ *                              Private Function Definitions
+ *
+ ********************************************************************************/
+static size_t mqtt_codec_varint_len(size_t value) {
+  size_t n = 1;
+  while (value >= 128) {
+    value /= 128;
+    n++;
+  }
+  return n;
+}
+
+static size_t mqtt_codec_write_varint(uint8_t *buf, size_t value) {
+  size_t n = 0;
+  if (value > MQTT_CODEC_MAX_REMAINING_LEN) {
+    value = MQTT_CODEC_MAX_REMAINING_LEN;
+  }
+  do {
+    uint8_t byte = value % 128;
+    value /= 128;
+    if (value > 0) {
+      byte |= 0x80;
+    }
+    buf[n++] = byte;
+  } while (value > 0);
+  return n;
+}
+
+static size_t mqtt_codec_write_string(uint8_t *buf, const char *str,
+                                      size_t len) {
+  buf[0] = (uint8_t)(len >> 8);
+  buf[1] = (uint8_t)(len & 0xFF);
+  memcpy(buf + 2, str, len);
+  return 2 + len;
+}
@@ -0,0 +1,81 @@
+#ifndef _MQTT_CODEC_H_
+#define _MQTT_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Minimal MQTT 3.1.1 packet encoder/decoder.
+ *
+ * Only the packets the host tools need are supported: CONNECT, CONNACK,
+ * PUBLISH, PUBACK, SUBSCRIBE, SUBACK, PINGREQ and PINGRESP.
+ */
+
+/**
+ * @brief MQTT control packet types (upper nibble of the fixed header).
+ */
+typedef enum {
+  MQTT_CODEC_CONNECT = 1,
+  MQTT_CODEC_CONNACK = 2,
+  MQTT_CODEC_PUBLISH = 3,
+  MQTT_CODEC_PUBACK = 4,
+  MQTT_CODEC_SUBSCRIBE = 8,
+  MQTT_CODEC_SUBACK = 9,
+  MQTT_CODEC_PINGREQ = 12,
+  MQTT_CODEC_PINGRESP = 13,
+  MQTT_CODEC_DISCONNECT = 14,
+} mqtt_codec_type_t;
+
+/**
+ * @brief A decoded packet header.
+ */
+typedef struct mqtt_codec_packet {
+  mqtt_codec_type_t type; ///< Control packet type
+  uint8_t flags;          ///< Lower nibble of the fixed header
+  const uint8_t *body;    ///< Start of the variable header
+  size_t body_len;        ///< Remaining length
+  size_t total_len;       ///< Fixed header + remaining length
+} mqtt_codec_packet_t;
+
+/**
+ * @brief Encode a CONNECT packet with a clean session.
+ *
+ * @return Encoded length, or -1 if the buffer is too small.
+ */
+int mqtt_codec_connect(uint8_t *buf, size_t size, const char *client_id,
+                       uint16_t keepalive_s);
+
+/**
+ * @brief Encode a PUBLISH packet.
+ *
+ * @param pkt_id Packet identifier; ignored for QoS 0.
+ * @return Encoded length, or -1 if the buffer is too small.
+ */
+int mqtt_codec_publish(uint8_t *buf, size_t size, const char *topic,
+                       const void *payload, size_t payload_len, int qos,
+                       int retain, uint16_t pkt_id);
+
+/**
+ * @brief Encode a SUBSCRIBE packet for a single topic filter.
+ *
+ * @return Encoded length, or -1 if the buffer is too small.
+ */
+int mqtt_codec_subscribe(uint8_t *buf, size_t size, const char *topic_filter,
+                         int qos, uint16_t pkt_id);
+
+/**
+ * @brief Wire overhead of a PUBLISH packet excluding the payload.
+ */
+size_t mqtt_codec_publish_overhead(size_t topic_len, size_t payload_len,
+                                   int qos);
+
+/**
+ * @brief Try to decode one packet from the start of a receive buffer.
+ *
+ * @return 1 if a complete packet was decoded, 0 if more data is needed,
+ *         -1 if the stream is malformed.
+ */
+int mqtt_codec_decode(const uint8_t *buf, size_t len,
+                      mqtt_codec_packet_t *packet);
+
+#endif
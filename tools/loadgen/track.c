@@ -0,0 +1,152 @@
+#include "track.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * @brief Meters per degree of latitude.
+ */
+#define TRACK_METERS_PER_DEG (111320.0)
+
+/**
+ * @brief Maximum heading change per second of the synthetic walk (radians).
+ */
+#define TRACK_MAX_TURN_RATE (0.15)
+
+/**
+ * @brief Initial capacity of a track being loaded.
+ */
+#define TRACK_INITIAL_CAPACITY (1024)
+
+/********************************************************************************
+ *
+ *                              Public Function Definitions
+ *
+ ********************************************************************************/
+int track_load_csv(track_t *track, const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (NULL == fp) {
+    perror(path);
+    return -1;
+  }
+  size_t capacity = TRACK_INITIAL_CAPACITY;
+  track->lat = malloc(capacity * sizeof(float));
+  track->lng = malloc(capacity * sizeof(float));
+  track->count = 0;
+  char line[256];
+  while (track->lat && track->lng && fgets(line, sizeof(line), fp)) {
+    float lat, lng;
+    if (2 != sscanf(line, "%f,%f", &lat, &lng)) {
+      continue;
+    }
+    if (track->count == capacity) {
+      capacity *= 2;
+      float *new_lat = realloc(track->lat, capacity * sizeof(float));
+      float *new_lng = realloc(track->lng, capacity * sizeof(float));
+      if (new_lat) {
+        track->lat = new_lat;
+      }
+      if (new_lng) {
+        track->lng = new_lng;
+      }
+      if (!new_lat || !new_lng) {
+        break;
+      }
+    }
+    track->lat[track->count] = lat;
+    track->lng[track->count] = lng;
+    track->count++;
+  }
+  fclose(fp);
+  if (0 == track->count) {
+    fprintf(stderr, "%s: no \"lat,lng\" points found\n", path);
+    track_free(track);
+    return -1;
+  }
+  return 0;
+}
+
+void track_free(track_t *track) {
+  free(track->lat);
+  free(track->lng);
+  track->lat = NULL;
+  track->lng = NULL;
+  track->count = 0;
+}
+
+void track_cursor_init(track_cursor_t *cursor, const track_t *track,
+                       uint64_t seed, double center_lat, double center_lng,
+                       double radius_deg) {
+  cursor->rng = seed ? seed : 0x9E3779B97F4A7C15ull;
+  cursor->track = track;
+  cursor->battery = 60.0f + 40.0f * (float)track_rand_unit(&cursor->rng);
+
+  // Place the device uniformly inside the disc around the center.
+  double r = radius_deg * sqrt(track_rand_unit(&cursor->rng));
+  double theta = 2.0 * M_PI * track_rand_unit(&cursor->rng);
+  double dlat = r * sin(theta);
+  double dlng = r * cos(theta);
+
+  if (track) {
+    cursor->index = (size_t)(track_rand(&cursor->rng) % track->count);
+    cursor->lat_offset = (float)dlat;
+    cursor->lng_offset = (float)dlng;
+    return;
+  }
+  cursor->lat = center_lat + dlat;
+  cursor->lng = center_lng + dlng;
+  cursor->heading = 2.0 * M_PI * track_rand_unit(&cursor->rng);
+  // Pedestrians to vehicles: 1 to 25 m/s.
+  cursor->speed_mps = 1.0 + 24.0 * track_rand_unit(&cursor->rng);
+}
+
+void track_cursor_next(track_cursor_t *cursor, double dt_s, float *lat,
+                       float *lng, float *battery) {
+  // Drain roughly 1 % per 500 reports.
+  cursor->battery -= 0.002f;
+  if (cursor->battery < 1.0f) {
+    cursor->battery = 100.0f;
+  }
+  *battery = cursor->battery;
+
+  if (cursor->track) {
+    const track_t *track = cursor->track;
+    *lat = track->lat[cursor->index] + cursor->lat_offset;
+    *lng = track->lng[cursor->index] + cursor->lng_offset;
+    cursor->index = (cursor->index + 1) % track->count;
+    return;
+  }
+
+  double turn = (track_rand_unit(&cursor->rng) * 2.0 - 1.0) *
+                TRACK_MAX_TURN_RATE * dt_s;
+  cursor->heading = fmod(cursor->heading + turn, 2.0 * M_PI);
+  double dist = cursor->speed_mps * dt_s;
+  cursor->lat += dist * cos(cursor->heading) / TRACK_METERS_PER_DEG;
+  cursor->lng += dist * sin(cursor->heading) /
+                 (TRACK_METERS_PER_DEG * cos(cursor->lat * M_PI / 180.0));
+  // Bounce off the poles instead of producing invalid coordinates.
+  if (cursor->lat > 89.0 || cursor->lat < -89.0) {
+    cursor->heading = M_PI - cursor->heading;
+    cursor->lat = cursor->lat > 0 ? 89.0 : -89.0;
+  }
+  if (cursor->lng > 180.0) {
+    cursor->lng -= 360.0;
+  } else if (cursor->lng < -180.0) {
+    cursor->lng += 360.0;
+  }
+  *lat = (float)cursor->lat;
+  *lng = (float)cursor->lng;
+}
+
+uint64_t track_rand(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545F4914F6CDD1Dull;
+}
+
+double track_rand_unit(uint64_t *state) {
+  return (double)(track_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
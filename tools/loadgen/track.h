@@ -0,0 +1,77 @@
+#ifndef _TRACK_H_
+#define _TRACK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief A recorded track loaded from disk and shared by all simulated devices.
+ */
+typedef struct track {
+  float *lat;   ///< Latitudes in degrees
+  float *lng;   ///< Longitudes in degrees
+  size_t count; ///< Number of points
+} track_t;
+
+/**
+ * @brief Per-device cursor into a recorded or synthetic track.
+ */
+typedef struct track_cursor {
+  const track_t *track; ///< Recorded track, or NULL for a synthetic walk
+  size_t index;         ///< Next point of the recorded track
+  float lat_offset;     ///< Per-device displacement of the recorded track
+  float lng_offset;     ///< Per-device displacement of the recorded track
+  double lat;           ///< Current synthetic latitude in degrees
+  double lng;           ///< Current synthetic longitude in degrees
+  double heading;       ///< Current synthetic heading in radians
+  double speed_mps;     ///< Current synthetic speed in meters per second
+  float battery;        ///< Current battery level in percent
+  uint64_t rng;         ///< Per-device xorshift state
+} track_cursor_t;
+
+/**
+ * @brief Load a track from a CSV file with "lat,lng" on each line.
+ *
+ * Lines that do not start with two numbers (e.g. a header) are skipped.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int track_load_csv(track_t *track, const char *path);
+
+/**
+ * @brief Release a track loaded with track_load_csv().
+ */
+void track_free(track_t *track);
+
+/**
+ * @brief Initialize a device cursor.
+ *
+ * @param track      Recorded track to replay, or NULL for a synthetic walk.
+ * @param seed       Per-device random seed (must be non-zero).
+ * @param center_lat Center of the synthetic area in degrees.
+ * @param center_lng Center of the synthetic area in degrees.
+ * @param radius_deg Radius of the synthetic area / replay spread in degrees.
+ */
+void track_cursor_init(track_cursor_t *cursor, const track_t *track,
+                       uint64_t seed, double center_lat, double center_lng,
+                       double radius_deg);
+
+/**
+ * @brief Advance the cursor by one report and return the new position.
+ *
+ * @param dt_s Time since the previous report in seconds.
+ */
+void track_cursor_next(track_cursor_t *cursor, double dt_s, float *lat,
+                       float *lng, float *battery);
+
+/**
+ * @brief xorshift64* step shared by the load generator.
+ */
+uint64_t track_rand(uint64_t *state);
+
+/**
+ * @brief Uniform random double in [0, 1).
+ */
+double track_rand_unit(uint64_t *state);
+
+#endif
@@ -0,0 +1,361 @@
+/**
+ * Stand-in receiver for the UDP uplink.
+ *
+ * Listens for the CoAP non-confirmable frames sent by the firmware's UDP
+ * transport (components/mqtt_mgt/mqtt_mgt_udp.c), decodes them with the
+ * firmware's own codec and prints every message, preceded by its sequence
+ * number, as the JSON the MQTT uplink would have published. Sequence
+ * numbers are checked per device, and lost, duplicated and reordered
+ * messages are reported on exit. Compressed frames are decompressed first.
+ *
+ * With -m the messages are also published to /egress/<id> on an MQTT
+ * broker, so the dashboard (mqtt_tester/main.py) works unchanged.
+ *
+ * Usage: uplink_receiver [-p port] [-m broker[:port]] [-q]
+ */
+#include "mqtt_codec.h"
+#include "mqtt_mgt_frame.h"
+#include "payload_encoder.h"
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Largest number of devices tracked.
+ */
+#define RECEIVER_MAX_DEVICES (256)
+
+/**
+ * @brief A message this far behind the newest one means the device restarted
+ *        its numbering, e.g. after a reboot.
+ */
+#define RECEIVER_RESTART_GAP (4096)
+
+/**
+ * @brief Maximum length of topics and forwarded messages.
+ */
+#define RECEIVER_TOPIC_MAX_LEN (64)
+#define RECEIVER_MQTT_BUF_SIZE (512)
+
+/********************************************************************************
+ *
+ *                              Type Declarations
+ *
+ ********************************************************************************/
+
+/**
+ * @brief Sequence tracking of one device.
+ */
+typedef struct {
+  char id[MQTT_MGT_FRAME_ID_MAX_LEN + 1]; ///< Device identifier
+  uint32_t next;       ///< One past the newest sequence number received
+  uint64_t window;     ///< Bit i set: message next - 1 - i was received
+  uint64_t frames;     ///< Frames received
+  uint64_t compressed; ///< Frames received compressed
+  uint64_t messages;   ///< Distinct messages received
+  int64_t lost;        ///< Messages skipped and not received since
+  uint64_t duplicates; ///< Messages received more than once
+  uint64_t reordered;  ///< Messages received after a newer one
+  uint64_t restarts;   ///< Times the numbering started over
+} receiver_device_t;
+
+/********************************************************************************
+ *
+ *                              Private Global Variables
+ *
+ ********************************************************************************/
+
+static volatile sig_atomic_t g_stop = 0;
+static receiver_device_t g_devices[RECEIVER_MAX_DEVICES];
+static size_t g_device_count = 0;
+static uint64_t g_invalid = 0;
+
+/********************************************************************************
+ *
+ *                              Private Function Definitions
+ *
+ ********************************************************************************/
+static void receiver_on_signal(int sig) {
+  (void)sig;
+  g_stop = 1;
+}
+
+static receiver_device_t *receiver_device(const mqtt_mgt_frame_t *frame) {
+  for (size_t i = 0; i < g_device_count; i++) {
+    if (strlen(g_devices[i].id) == frame->device_id_len &&
+        0 == memcmp(g_devices[i].id, frame->device_id, frame->device_id_len)) {
+      return &g_devices[i];
+    }
+  }
+  if (RECEIVER_MAX_DEVICES == g_device_count) {
+    return NULL;
+  }
+  receiver_device_t *dev = &g_devices[g_device_count++];
+  memset(dev, 0, sizeof(*dev));
+  memcpy(dev->id, frame->device_id, frame->device_id_len);
+  dev->next = frame->seq;
+  return dev;
+}
+
+// Account for one message; returns false if it is a duplicate.
+static bool receiver_track(receiver_device_t *dev, uint32_t seq) {
+  int32_t ahead = (int32_t)(seq - dev->next);
+  if (ahead < -RECEIVER_RESTART_GAP) {
+    dev->restarts++;
+    dev->next = seq;
+    dev->window = 0;
+    ahead = 0;
+  }
+  if (ahead >= 0) {
+    dev->lost += ahead;
+    dev->window = (uint32_t)ahead + 1 < 64 ? dev->window << (ahead + 1) : 0;
+    dev->window |= 1;
+    dev->next = seq + 1;
+    dev->messages++;
+    return true;
+  }
+  uint32_t age = (uint32_t)(-ahead - 1);
+  if (age < 64 && (dev->window & (1ull << age))) {
+    dev->duplicates++;
+    return false;
+  }
+  // Counted as lost when the newer message arrived. Beyond the window a
+  // duplicate cannot be told apart and is counted here as well.
+  if (age < 64) {
+    dev->window |= 1ull << age;
+  }
+  dev->lost--;
+  dev->reordered++;
+  dev->messages++;
+  return true;
+}
+
+// Format a message as the JSON published by the MQTT uplink.
+static int receiver_to_json(char *buf, size_t size,
+                            const receiver_device_t *dev, const uint8_t *msg,
+                            size_t len) {
+  if (len > 0 && '{' == msg[0]) {
+    // Anything but a fix (e.g. a geofence event) is JSON already.
+    if (len >= size) {
+      return -1;
+    }
+    memcpy(buf, msg, len);
+    buf[len] = '\0';
+    return (int)len;
+  }
+  payload_fix_t fix;
+  uint32_t time_s;
+  if (PAYLOAD_ENCODER_BIN_LEN != len ||
+      0 != payload_decode_binary(msg, &fix, &time_s)) {
+    return -1;
+  }
+  time_t t = (time_t)time_s;
+  struct tm tm;
+  localtime_r(&t, &tm);
+  char date[16];
+  char clock[16];
+  strftime(date, sizeof(date), "%Y-%m-%d", &tm);
+  strftime(clock, sizeof(clock), "%H:%M:%S", &tm);
+  return payload_encode_json(buf, size, dev->id, &fix, date, clock);
+}
+
+static int receiver_mqtt_connect(const char *broker) {
+  char host[256];
+  snprintf(host, sizeof(host), "%s", broker);
+  const char *port = "1883";
+  char *colon = strrchr(host, ':');
+  if (NULL != colon) {
+    *colon = '\0';
+    port = colon + 1;
+  }
+  struct addrinfo hints = {.ai_socktype = SOCK_STREAM};
+  struct addrinfo *res = NULL;
+  if (0 != getaddrinfo(host, port, &hints, &res)) {
+    return -1;
+  }
+  int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (fd < 0 || 0 != connect(fd, res->ai_addr, res->ai_addrlen)) {
+    freeaddrinfo(res);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+  freeaddrinfo(res);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  // No keep-alive, so that nothing has to be sent while the uplink is idle.
+  uint8_t buf[64];
+  int len = mqtt_codec_connect(buf, sizeof(buf), "uplink_receiver", 0);
+  mqtt_codec_packet_t packet;
+  size_t got = 0;
+  if (len < 0 || write(fd, buf, len) != len) {
+    close(fd);
+    return -1;
+  }
+  while (got < sizeof(buf)) {
+    ssize_t n = read(fd, buf + got, sizeof(buf) - got);
+    if (n <= 0) {
+      break;
+    }
+    got += (size_t)n;
+    if (1 == mqtt_codec_decode(buf, got, &packet)) {
+      if (MQTT_CODEC_CONNACK == packet.type && packet.body_len >= 2 &&
+          0 == packet.body[1]) {
+        return fd;
+      }
+      break;
+    }
+  }
+  close(fd);
+  return -1;
+}
+
+static void receiver_summary(void) {
+  fprintf(stderr, "%-16s %10s %10s %10s %8s %10s %10s %8s\n", "device",
+          "frames", "compressed", "messages", "lost", "duplicate", "reordered",
+          "restarts");
+  for (size_t i = 0; i < g_device_count; i++) {
+    const receiver_device_t *dev = &g_devices[i];
+    fprintf(stderr, "%-16s %10llu %10llu %10llu %8lld %10llu %10llu %8llu\n",
+            dev->id, (unsigned long long)dev->frames,
+            (unsigned long long)dev->compressed,
+            (unsigned long long)dev->messages,
+            (long long)dev->lost, (unsigned long long)dev->duplicates,
+            (unsigned long long)dev->reordered,
+            (unsigned long long)dev->restarts);
+  }
+  if (g_invalid > 0) {
+    fprintf(stderr, "%llu invalid datagram(s)\n",
+            (unsigned long long)g_invalid);
+  }
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-p port] [-m broker[:port]] [-q]\n"
+          "  -p  UDP port to listen on (default %d)\n"
+          "  -m  also publish every message to /egress/<id> on this broker\n"
+          "  -q  do not print messages, only the summary on exit\n",
+          prog, MQTT_MGT_FRAME_DEFAULT_PORT);
+}
+
+int main(int argc, char **argv) {
+  int port = MQTT_MGT_FRAME_DEFAULT_PORT;
+  const char *broker = NULL;
+  bool quiet = false;
+  int opt;
+  while (-1 != (opt = getopt(argc, argv, "p:m:qh"))) {
+    switch (opt) {
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'm':
+      broker = optarg;
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_port = htons((uint16_t)port),
+      .sin_addr.s_addr = htonl(INADDR_ANY),
+  };
+  if (sock < 0 || 0 != bind(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+    perror("bind");
+    return EXIT_FAILURE;
+  }
+  int mqtt = -1;
+  if (NULL != broker && (mqtt = receiver_mqtt_connect(broker)) < 0) {
+    fprintf(stderr, "Failed to connect to %s\n", broker);
+    return EXIT_FAILURE;
+  }
+  // Without SA_RESTART, so that recv() returns on a signal.
+  struct sigaction sa = {.sa_handler = receiver_on_signal};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  fprintf(stderr, "Listening on UDP port %d\n", port);
+
+  uint8_t datagram[MQTT_MGT_FRAME_MAX_LEN];
+  uint8_t inflated[MQTT_MGT_FRAME_MAX_LEN];
+  char json[RECEIVER_MQTT_BUF_SIZE];
+  uint8_t packet[RECEIVER_MQTT_BUF_SIZE + RECEIVER_TOPIC_MAX_LEN];
+  while (!g_stop) {
+    ssize_t len = recv(sock, datagram, sizeof(datagram), 0);
+    if (len < 0) {
+      if (EINTR != errno) {
+        perror("recv");
+        break;
+      }
+      continue;
+    }
+    mqtt_mgt_frame_t frame;
+    if (0 != mqtt_mgt_frame_decode(datagram, (size_t)len, &frame)) {
+      g_invalid++;
+      continue;
+    }
+    bool compressed = frame.flags & MQTT_MGT_FRAME_FLAG_LZ;
+    receiver_device_t *dev = NULL;
+    if (0 != mqtt_mgt_frame_inflate(&frame, inflated, sizeof(inflated)) ||
+        NULL == (dev = receiver_device(&frame))) {
+      g_invalid++;
+      continue;
+    }
+    dev->frames++;
+    dev->compressed += compressed;
+
+    size_t offset = 0;
+    size_t msg_len;
+    const uint8_t *msg;
+    for (uint32_t seq = frame.seq;
+         NULL != (msg = mqtt_mgt_frame_next(&frame, &offset, &msg_len));
+         seq++) {
+      if (!receiver_track(dev, seq)) {
+        continue;
+      }
+      int json_len = receiver_to_json(json, sizeof(json), dev, msg, msg_len);
+      if (json_len < 0) {
+        continue;
+      }
+      if (!quiet) {
+        printf("%u %.*s", (unsigned)seq, json_len, json);
+        fflush(stdout);
+      }
+      if (mqtt >= 0) {
+        char topic[RECEIVER_TOPIC_MAX_LEN];
+        snprintf(topic, sizeof(topic), "/egress/%s", dev->id);
+        int n = mqtt_codec_publish(packet, sizeof(packet), topic, json,
+                                   (size_t)json_len, 0, 0, 0);
+        if (n > 0 && write(mqtt, packet, n) != n) {
+          fprintf(stderr, "Lost the broker connection\n");
+          close(mqtt);
+          mqtt = -1;
+        }
+      }
+    }
+  }
+  receiver_summary();
+  close(sock);
+  if (mqtt >= 0) {
+    close(mqtt);
+  }
+  return EXIT_SUCCESS;
+}